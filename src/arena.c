@@ -0,0 +1,142 @@
+#include <string.h>
+
+#include "arena.h"
+
+#define ROUND(n) (((n) + MPACK_ARENA_ALIGN - 1) & ~(MPACK_ARENA_ALIGN - 1))
+#define HEADER_SIZE ROUND(sizeof(mpack_arena_block_t))
+#define BLOCK_DATA(b) ((char *)(b) + HEADER_SIZE)
+
+static mpack_arena_block_t *mpack_arena_block(mpack_arena_t *a, size_t size);
+static void mpack_arena_free_list(mpack_arena_t *a, mpack_arena_block_t *b);
+
+MPACK_API void mpack_arena_init(mpack_arena_t *arena,
+    mpack_arena_alloc_cb alloc, mpack_arena_free_cb free, void *ctx,
+    size_t block_size)
+{
+  arena->alloc = alloc;
+  arena->free = free;
+  arena->ctx = ctx;
+  arena->block_size = ROUND(block_size ? block_size : MPACK_ARENA_BLOCK_SIZE);
+  arena->blocks = NULL;
+  arena->spare = NULL;
+  arena->pos = 0;
+}
+
+MPACK_API void *mpack_arena_alloc(mpack_arena_t *arena, size_t size)
+{
+  mpack_arena_block_t *block;
+  size_t rounded = ROUND(size);
+
+  if (rounded < size) return NULL;
+
+  if (arena->blocks && arena->blocks->size - arena->pos >= rounded) {
+    void *rv = BLOCK_DATA(arena->blocks) + arena->pos;
+    arena->pos += rounded;
+    return rv;
+  }
+
+  if (rounded > arena->block_size) {
+    /* large allocations get a block of their own, which is linked after the
+     * block being filled so the rest of it is still used */
+    if (!(block = mpack_arena_block(arena, rounded))) return NULL;
+    if (arena->blocks) {
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    } else {
+      block->next = NULL;
+      arena->blocks = block;
+      arena->pos = rounded;
+    }
+    return BLOCK_DATA(block);
+  }
+
+  if (arena->spare) {
+    block = arena->spare;
+    arena->spare = block->next;
+  } else if (!(block = mpack_arena_block(arena, arena->block_size))) {
+    return NULL;
+  }
+
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->pos = rounded;
+  return BLOCK_DATA(block);
+}
+
+MPACK_API void mpack_arena_reset(mpack_arena_t *arena)
+{
+  mpack_arena_block_t *block = arena->blocks;
+
+  while (block) {
+    mpack_arena_block_t *next = block->next;
+    if (block->size == arena->block_size) {
+      block->next = arena->spare;
+      arena->spare = block;
+    } else {
+      arena->free(arena->ctx, block);
+    }
+    block = next;
+  }
+
+  arena->blocks = NULL;
+  arena->pos = 0;
+}
+
+MPACK_API void mpack_arena_destroy(mpack_arena_t *arena)
+{
+  mpack_arena_free_list(arena, arena->blocks);
+  mpack_arena_free_list(arena, arena->spare);
+  arena->blocks = NULL;
+  arena->spare = NULL;
+  arena->pos = 0;
+}
+
+MPACK_API int mpack_arena_chunk(mpack_arena_t *arena, mpack_node_t *node)
+{
+  mpack_node_t *parent;
+  char *buf;
+
+  switch (node->tok.type) {
+    case MPACK_TOKEN_STR:
+    case MPACK_TOKEN_BIN:
+    case MPACK_TOKEN_EXT:
+      if (!(buf = mpack_arena_alloc(arena, (size_t)node->tok.length + 1))) {
+        return MPACK_NOMEM;
+      }
+      buf[node->tok.length] = 0;
+      node->data[0].p = buf;
+      break;
+    case MPACK_TOKEN_CHUNK:
+      /* parent->pos is the offset of this chunk within the value */
+      parent = MPACK_PARENT_NODE(node);
+      memcpy((char *)parent->data[0].p + parent->pos, node->tok.data.chunk_ptr,
+          node->tok.length);
+      break;
+    default:
+      break;
+  }
+
+  return MPACK_OK;
+}
+
+static mpack_arena_block_t *mpack_arena_block(mpack_arena_t *arena,
+    size_t size)
+{
+  mpack_arena_block_t *block;
+
+  if (size > (size_t)-1 - HEADER_SIZE) return NULL;
+  if (!(block = arena->alloc(arena->ctx, HEADER_SIZE + size))) return NULL;
+  block->size = size;
+  block->next = NULL;
+  return block;
+}
+
+static void mpack_arena_free_list(mpack_arena_t *arena,
+    mpack_arena_block_t *block)
+{
+  while (block) {
+    mpack_arena_block_t *next = block->next;
+    arena->free(arena->ctx, block);
+    block = next;
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef MPACK_ARENA_H
+#define MPACK_ARENA_H
+
+#include "core.h"
+#include "object.h"
+
+#ifndef MPACK_ARENA_BLOCK_SIZE
+# define MPACK_ARENA_BLOCK_SIZE 4096
+#endif
+
+/* arena pointers are aligned for any of the types in mpack_data_t */
+#define MPACK_ARENA_ALIGN sizeof(mpack_data_t)
+
+/* arena used by parser callbacks, stored in `parser->data.p` */
+#define MPACK_ARENA(parser) ((mpack_arena_t *)(parser)->data.p)
+
+typedef void *(*mpack_arena_alloc_cb)(void *ctx, size_t size);
+typedef void (*mpack_arena_free_cb)(void *ctx, void *ptr);
+
+typedef struct mpack_arena_block_s {
+  struct mpack_arena_block_s *next;
+  size_t size;  /* usable bytes after the header */
+} mpack_arena_block_t;
+
+/* Bump allocator for decoded messages. Memory is obtained in blocks from the
+ * user callbacks and released all at once by mpack_arena_reset, which keeps
+ * the blocks around for the next message. */
+typedef struct mpack_arena_s {
+  mpack_arena_alloc_cb alloc;
+  mpack_arena_free_cb free;
+  void *ctx;
+  size_t block_size;
+  mpack_arena_block_t *blocks;  /* in use, the first one is being filled */
+  mpack_arena_block_t *spare;   /* recycled blocks */
+  size_t pos;                   /* fill position of the first block */
+} mpack_arena_t;
+
+MPACK_API void mpack_arena_init(mpack_arena_t *arena,
+    mpack_arena_alloc_cb alloc, mpack_arena_free_cb free, void *ctx,
+    size_t block_size) FUNUSED FNONULL_ARG((1,2,3));
+MPACK_API void *mpack_arena_alloc(mpack_arena_t *arena, size_t size)
+  FUNUSED FNONULL;
+MPACK_API void mpack_arena_reset(mpack_arena_t *arena) FUNUSED FNONULL;
+MPACK_API void mpack_arena_destroy(mpack_arena_t *arena) FUNUSED FNONULL;
+/* To be called from enter_cb. Allocates a NUL-terminated buffer in
+ * `node->data[0].p` for str/bin/ext nodes and copies each of their chunks to
+ * it, so split values end up contiguous. Other nodes are ignored. */
+MPACK_API int mpack_arena_chunk(mpack_arena_t *arena, mpack_node_t *node)
+  FUNUSED FNONULL;
+
+#endif  /* MPACK_ARENA_H */
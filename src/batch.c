@@ -0,0 +1,226 @@
+#include <string.h>
+
+#include "batch.h"
+
+#define RECORD_START(ends, i) ((i) ? (ends)[(i) - 1] : 0)
+
+static mpack_uint32_t mpack_batch_find(const size_t *ends,
+    mpack_uint32_t count, size_t offset);
+
+/* Finds the end of each complete record in `buf`. Returns MPACK_OK when the
+ * buffer ends with a complete record, MPACK_EOF when it ends inside one (the
+ * bytes after the last end belong to the next batch), MPACK_NOMEM when
+ * `capacity` ends were found before the end of the buffer (frame the rest
+ * starting at the last end) and MPACK_ERROR for invalid input. Payloads are
+ * skipped without being looked at, so this is much cheaper than parsing. */
+MPACK_API int mpack_batch_frame(const char *buf, size_t buflen, size_t *ends,
+    mpack_uint32_t capacity, mpack_uint32_t *count)
+{
+  const char *p = buf;
+  size_t left = buflen;
+
+  *count = 0;
+
+  while (left) {
+    int status;
+    mpack_tokbuf_t tokbuf;
+    mpack_uint32_t remaining = 1;
+
+    if (*count == capacity) return MPACK_NOMEM;
+
+    mpack_tokbuf_init(&tokbuf);
+    if ((status = mpack_skip(&tokbuf, &p, &left, &remaining))) return status;
+
+    ends[(*count)++] = (size_t)(p - buf);
+  }
+
+  return MPACK_OK;
+}
+
+/* Splits `count` records into `parts` ranges of about the same number of
+ * bytes, returning the records of range `part` in [first, last). Returns
+ * MPACK_ERROR if `part` is not below `parts`. */
+MPACK_API int mpack_batch_split(const size_t *ends, mpack_uint32_t count,
+    mpack_uint32_t parts, mpack_uint32_t part, mpack_uint32_t *first,
+    mpack_uint32_t *last)
+{
+  size_t total = count ? ends[count - 1] : 0;
+  if (part >= parts) return MPACK_ERROR;
+  /* range `part` starts with the first record starting at or after
+   * `total * part / parts` */
+  *first = part ? mpack_batch_find(ends, count,
+      total / parts * part + total % parts * part / parts) : 0;
+  *last = part + 1 < parts ? mpack_batch_find(ends, count,
+      total / parts * (part + 1) + total % parts * (part + 1) / parts)
+    : count;
+  return MPACK_OK;
+}
+
+/* Parses records [first, last) found by mpack_batch_frame, calling
+ * `record_cb` (if not NULL) after each one. Node offsets are relative to
+ * `buf`. Stops at the first record that can't be parsed and returns its
+ * status (MPACK_ERROR if the framing didn't match the buffer). */
+MPACK_API int mpack_batch_parse(mpack_parser_t *parser, const char *buf,
+    const size_t *ends, mpack_uint32_t first, mpack_uint32_t last,
+    mpack_walk_cb enter_cb, mpack_walk_cb exit_cb, mpack_batch_cb record_cb)
+{
+  mpack_uint32_t i;
+
+  for (i = first; i < last; i++) {
+    size_t start = RECORD_START(ends, i), len = ends[i] - start;
+    const char *p = buf + start;
+    int status;
+
+    parser->offset = start;
+    status = mpack_parse(parser, &p, &len, enter_cb, exit_cb);
+    if (status == MPACK_EOF || (status == MPACK_OK && len)) {
+      return MPACK_ERROR;
+    }
+    if (status) return status;
+    if (record_cb) record_cb(parser, i);
+  }
+
+  return MPACK_OK;
+}
+
+/* Reads the header of the array at the start of `buf` into `length` and
+ * stores the offset of elements 0, stride, 2 * stride, ... followed by the end
+ * of the array in `offsets`, which needs `length / stride + 2` entries.
+ * Returns MPACK_NOMEM (with `length` set) if `capacity` is smaller, MPACK_EOF
+ * if the array is truncated and MPACK_ERROR if `buf` doesn't start with an
+ * array. Elements are skipped by their length like in mpack_batch_frame. */
+MPACK_API int mpack_batch_index(const char *buf, size_t buflen,
+    mpack_uint32_t stride, size_t *offsets, mpack_uint32_t capacity,
+    mpack_uint32_t *length)
+{
+  const char *p = buf;
+  size_t left = buflen;
+  mpack_tokbuf_t tokbuf;
+  mpack_token_t tok;
+  mpack_uint32_t i, segments;
+  int status;
+
+  assert(stride);
+  if (!buflen) return MPACK_EOF;
+  mpack_tokbuf_init(&tokbuf);
+  if ((status = mpack_read(&tokbuf, &p, &left, &tok))) return status;
+  if (tok.type != MPACK_TOKEN_ARRAY) return MPACK_ERROR;
+
+  *length = tok.length;
+  segments = tok.length / stride + (tok.length % stride != 0);
+  if (capacity <= segments) return MPACK_NOMEM;
+
+  for (i = 0; i < tok.length; i++) {
+    mpack_uint32_t remaining = 1;
+    if (!(i % stride)) offsets[i / stride] = (size_t)(p - buf);
+    if (!left) return MPACK_EOF;
+    if ((status = mpack_skip(&tokbuf, &p, &left, &remaining))) return status;
+  }
+
+  offsets[segments] = (size_t)(p - buf);
+  return MPACK_OK;
+}
+
+/* Parses one segment of an array indexed by mpack_batch_index. The parser
+ * (initialized with mpack_parser_init) is seeded with the array as its root
+ * node, so `enter_cb` is called for the elements with the root's `pos` set to
+ * the element index, as if the whole array was being parsed. The root itself
+ * is not entered, and it is exited at the end of each segment: its
+ * `tok.length` is one past the index of the last element of the segment. */
+MPACK_API int mpack_batch_parse_segment(mpack_parser_t *parser,
+    const char *buf, const size_t *offsets, mpack_uint32_t stride,
+    mpack_uint32_t length, mpack_uint32_t segment, mpack_walk_cb enter_cb,
+    mpack_walk_cb exit_cb)
+{
+  mpack_node_t *root = parser->items + 1;
+  mpack_uint32_t first = segment * stride;
+  size_t start = offsets[segment], len = offsets[segment + 1] - start;
+  const char *p = buf + start;
+  int status;
+
+  assert(first < length && parser->capacity);
+  mpack_tokbuf_init(&parser->tokbuf);
+  root->tok = mpack_pack_array(length - first < stride ? length
+      : first + stride);
+  root->pos = first;
+  root->key_visited = 0;
+  root->key_id = MPACK_KEY_UNKNOWN;
+  root->start = root->end = start;
+  root->data[0].p = root->data[1].p = NULL;
+  parser->size = 1;
+  parser->exiting = 0;
+  parser->offset = start;
+
+  status = mpack_parse(parser, &p, &len, enter_cb, exit_cb);
+  return status == MPACK_EOF || (status == MPACK_OK && len) ? MPACK_ERROR
+    : status;
+}
+
+/* Splits `length` elements into `parts` slices whose sizes differ by at most
+ * one, returning the elements of slice `part` in [first, last). Returns
+ * MPACK_ERROR if `part` is not below `parts`. */
+MPACK_API int mpack_batch_slice(mpack_uint32_t length, mpack_uint32_t parts,
+    mpack_uint32_t part, mpack_uint32_t *first, mpack_uint32_t *last)
+{
+  mpack_uint32_t size, extra;
+  if (part >= parts) return MPACK_ERROR;
+  size = length / parts;
+  extra = length % parts;
+  /* the first `extra` slices get one more element */
+  *first = part * size + (part < extra ? part : extra);
+  *last = *first + size + (part < extra);
+  return MPACK_OK;
+}
+
+/* Writes an array 32 header, which has the same size for every length, so
+ * it can be written before the elements are encoded or sent as the first
+ * entry of a gather list. */
+MPACK_API void mpack_batch_array_header(char *buf, mpack_uint32_t length)
+{
+  buf[0] = (char)0xdd;
+  buf[1] = (char)((length >> 24) & 0xff);
+  buf[2] = (char)((length >> 16) & 0xff);
+  buf[3] = (char)((length >> 8) & 0xff);
+  buf[4] = (char)(length & 0xff);
+}
+
+/* Writes an array of `length` elements whose encodings are split across
+ * `slices`. Everything is written or nothing is: MPACK_EOF means the array
+ * needs more than `buflen` bytes. */
+MPACK_API int mpack_batch_stitch(char **buf, size_t *buflen,
+    mpack_uint32_t length, const char *const *slices, const size_t *sizes,
+    mpack_uint32_t count)
+{
+  size_t total = MPACK_BATCH_ARRAY_HEADER;
+  mpack_uint32_t i;
+
+  for (i = 0; i < count; i++) total += sizes[i];
+  if (total > *buflen) return MPACK_EOF;
+
+  mpack_batch_array_header(*buf, length);
+  *buf += MPACK_BATCH_ARRAY_HEADER;
+  for (i = 0; i < count; i++) {
+    memcpy(*buf, slices[i], sizes[i]);
+    *buf += sizes[i];
+  }
+  *buflen -= total;
+  return MPACK_OK;
+}
+
+/* index of the first record that starts at or after `offset` */
+static mpack_uint32_t mpack_batch_find(const size_t *ends,
+    mpack_uint32_t count, size_t offset)
+{
+  mpack_uint32_t lo = 0, hi = count;
+
+  while (lo < hi) {
+    mpack_uint32_t mid = lo + (hi - lo) / 2;
+    if (RECORD_START(ends, mid) < offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
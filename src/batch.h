@@ -0,0 +1,50 @@
+#ifndef MPACK_BATCH_H
+#define MPACK_BATCH_H
+
+#include "core.h"
+#include "object.h"
+
+/* length of the header written by mpack_batch_array_header */
+#define MPACK_BATCH_ARRAY_HEADER 5
+
+/* called after each record parsed by mpack_batch_parse */
+typedef void(*mpack_batch_cb)(mpack_parser_t *parser, mpack_uint32_t record);
+
+/* Batches are buffers holding many top-level values (records). A framing pass
+ * finds the record boundaries, after which ranges of records can be parsed
+ * independently, for example by one thread per range, each with its own
+ * parser and user data. Record `i` spans `ends[i - 1]` (or 0) to `ends[i]`. */
+MPACK_API int mpack_batch_frame(const char *buf, size_t buflen, size_t *ends,
+    mpack_uint32_t capacity, mpack_uint32_t *count) FUNUSED FNONULL;
+MPACK_API int mpack_batch_split(const size_t *ends, mpack_uint32_t count,
+    mpack_uint32_t parts, mpack_uint32_t part, mpack_uint32_t *first,
+    mpack_uint32_t *last) FUNUSED FNONULL;
+MPACK_API int mpack_batch_parse(mpack_parser_t *parser, const char *buf,
+    const size_t *ends, mpack_uint32_t first, mpack_uint32_t last,
+    mpack_walk_cb enter_cb, mpack_walk_cb exit_cb, mpack_batch_cb record_cb)
+  FUNUSED FNONULL_ARG((1,2,3,6,7));
+
+/* A single top-level array can be split in the same way: mpack_batch_index
+ * records the offset of every `stride`-th element, after which segments of
+ * `stride` elements can be parsed independently. */
+MPACK_API int mpack_batch_index(const char *buf, size_t buflen,
+    mpack_uint32_t stride, size_t *offsets, mpack_uint32_t capacity,
+    mpack_uint32_t *length) FUNUSED FNONULL;
+MPACK_API int mpack_batch_parse_segment(mpack_parser_t *parser,
+    const char *buf, const size_t *offsets, mpack_uint32_t stride,
+    mpack_uint32_t length, mpack_uint32_t segment, mpack_walk_cb enter_cb,
+    mpack_walk_cb exit_cb) FUNUSED FNONULL;
+
+/* Large arrays can be serialized in slices, each encoded into its own buffer
+ * (for example by one thread per slice), and stitched behind an array 32
+ * header. */
+MPACK_API int mpack_batch_slice(mpack_uint32_t length, mpack_uint32_t parts,
+    mpack_uint32_t part, mpack_uint32_t *first, mpack_uint32_t *last)
+  FUNUSED FNONULL;
+MPACK_API void mpack_batch_array_header(char *buf, mpack_uint32_t length)
+  FUNUSED FNONULL;
+MPACK_API int mpack_batch_stitch(char **buf, size_t *buflen,
+    mpack_uint32_t length, const char *const *slices, const size_t *sizes,
+    mpack_uint32_t count) FUNUSED FNONULL;
+
+#endif  /* MPACK_BATCH_H */
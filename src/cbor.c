@@ -0,0 +1,415 @@
+#include <string.h>
+
+#include "cbor.h"
+
+/* major types */
+#define CBOR_UINT 0
+#define CBOR_NINT 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+typedef int (*mpack_cbor_read_cb)(mpack_tokbuf_t *tokbuf, const char **buf,
+    size_t *buflen, mpack_token_t *tok);
+typedef int (*mpack_cbor_write_cb)(mpack_tokbuf_t *tokbuf, char **buf,
+    size_t *buflen, const mpack_token_t *tok);
+
+static int mpack_cbor_rhead(mpack_tokbuf_t *tokbuf, const char **buf,
+    size_t *buflen, mpack_token_t *tok);
+static int mpack_cbor_rtoken(const unsigned char *p, size_t n,
+    mpack_token_t *tok, size_t *used);
+static int mpack_cbor_rarg(const unsigned char *p, size_t n,
+    mpack_value_t *v, size_t *used);
+static mpack_uint32_t mpack_cbor_half(mpack_uint32_t h);
+static size_t mpack_cbor_wtoken(const mpack_token_t *tok, unsigned char *p);
+static size_t mpack_cbor_whead(unsigned char *p, int major,
+    mpack_value_t v);
+static void mpack_cbor_wbe(unsigned char *p, mpack_uint32_t v, size_t n);
+static int mpack_cbor_transcode(mpack_cbor_t *cbor, const char **in,
+    size_t *inlen, char **out, size_t *outlen, mpack_cbor_read_cb read,
+    mpack_cbor_write_cb write);
+
+MPACK_API int mpack_cbor_read(mpack_tokbuf_t *tokbuf, const char **buf,
+    size_t *buflen, mpack_token_t *tok)
+{
+  int status;
+  assert(*buf && *buflen);
+
+  if (tokbuf->passthrough) {
+    tok->type = MPACK_TOKEN_CHUNK;
+    tok->data.chunk_ptr = *buf;
+    tok->length = *buflen < tokbuf->passthrough ? (mpack_uint32_t)*buflen
+      : tokbuf->passthrough;
+    tokbuf->passthrough -= tok->length;
+    *buf += tok->length;
+    *buflen -= tok->length;
+    return MPACK_OK;
+  }
+
+  /* A tag and the header of its byte string are read as separate items, so
+   * the pending buffer only ever holds one header. `ppos` (not used by the
+   * reader otherwise) keeps the tag number plus one in between. */
+  for (;;) {
+    if ((status = mpack_cbor_rhead(tokbuf, buf, buflen, tok))) return status;
+    if (tok->type != MPACK_TOKEN_EXT) break;
+    if (tokbuf->ppos) return MPACK_ERROR;
+    tokbuf->ppos = (size_t)tok->data.ext_type + 1;
+    if (!*buflen) return MPACK_EOF;
+  }
+
+  if (tokbuf->ppos) {
+    int type = (int)tokbuf->ppos - 1;
+    if (tok->type != MPACK_TOKEN_BIN) return MPACK_ERROR;
+    *tok = mpack_pack_ext(type, tok->length);
+    tokbuf->ppos = 0;
+  }
+
+  if (tok->type > MPACK_TOKEN_MAP) tokbuf->passthrough = tok->length;
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_cbor_write(mpack_tokbuf_t *tokbuf, char **buf,
+    size_t *buflen, const mpack_token_t *tok)
+{
+  unsigned char enc[MPACK_MAX_TOKEN_LEN];
+  size_t n, count;
+  assert(*buf && *buflen);
+
+  /* chunks and pending bytes are written the same way for both formats */
+  if (tokbuf->plen || tok->type == MPACK_TOKEN_CHUNK
+      || tok->type == MPACK_TOKEN_RAW) {
+    return mpack_write(tokbuf, buf, buflen, tok);
+  }
+
+  if (!(n = mpack_cbor_wtoken(tok, enc))) return MPACK_ERROR;
+
+  count = n < *buflen ? n : *buflen;
+  memcpy(*buf, enc, count);
+  *buf += count;
+  *buflen -= count;
+  if (count == n) return MPACK_OK;
+
+  memcpy(tokbuf->pending, enc, n);
+  tokbuf->plen = n;
+  tokbuf->ppos = count;
+  tokbuf->pending_tok = *tok;
+  return MPACK_EOF;
+}
+
+/* Reads one item header, keeping a partial one in `tokbuf->pending`. */
+static int mpack_cbor_rhead(mpack_tokbuf_t *tokbuf, const char **buf,
+    size_t *buflen, mpack_token_t *tok)
+{
+  int status;
+  size_t used;
+
+  if (!tokbuf->plen) {
+    status = mpack_cbor_rtoken((const unsigned char *)*buf, *buflen, tok,
+        &used);
+    if (status == MPACK_EOF) {
+      /* keep the partial header until more data arrives */
+      assert(*buflen < sizeof(tokbuf->pending));
+      memcpy(tokbuf->pending, *buf, *buflen);
+      tokbuf->plen = *buflen;
+      *buf += *buflen;
+      *buflen = 0;
+    }
+    if (status) return status;
+    *buf += used;
+    *buflen -= used;
+    return MPACK_OK;
+  }
+
+  do {
+    /* complete the header one byte at a time, it is at most 9 bytes */
+    assert(tokbuf->plen < sizeof(tokbuf->pending));
+    tokbuf->pending[tokbuf->plen++] = **buf;
+    (*buf)++;
+    (*buflen)--;
+    status = mpack_cbor_rtoken((const unsigned char *)tokbuf->pending,
+        tokbuf->plen, tok, &used);
+  } while (status == MPACK_EOF && *buflen);
+  if (status) return status;
+  tokbuf->plen = 0;
+  return MPACK_OK;
+}
+
+MPACK_API void mpack_cbor_init(mpack_cbor_t *cbor)
+{
+  mpack_tokbuf_init(&cbor->reader);
+  mpack_tokbuf_init(&cbor->writer);
+}
+
+/* Converts CBOR in `in` to msgpack in `out`. Returns MPACK_OK when all input
+ * was converted, MPACK_EOF when the output buffer was filled first and
+ * MPACK_ERROR for input that can't be represented. */
+MPACK_API int mpack_cbor_to_msgpack(mpack_cbor_t *cbor, const char **in,
+    size_t *inlen, char **out, size_t *outlen)
+{
+  return mpack_cbor_transcode(cbor, in, inlen, out, outlen, mpack_cbor_read,
+      mpack_write);
+}
+
+/* Converts msgpack in `in` to CBOR in `out`, see mpack_cbor_to_msgpack. */
+MPACK_API int mpack_cbor_from_msgpack(mpack_cbor_t *cbor, const char **in,
+    size_t *inlen, char **out, size_t *outlen)
+{
+  return mpack_cbor_transcode(cbor, in, inlen, out, outlen, mpack_read,
+      mpack_cbor_write);
+}
+
+/* Tokens go straight from the reader to the writer. String payloads are read
+ * in pieces no larger than the free output space, so chunks are copied
+ * immediately and never reference input the caller might discard. */
+static int mpack_cbor_transcode(mpack_cbor_t *cbor, const char **in,
+    size_t *inlen, char **out, size_t *outlen, mpack_cbor_read_cb read,
+    mpack_cbor_write_cb write)
+{
+  mpack_token_t tok;
+
+  while (*outlen) {
+    int status;
+
+    if (cbor->writer.plen) {
+      if (write(&cbor->writer, out, outlen, &tok)) return MPACK_EOF;
+      continue;
+    }
+
+    if (!*inlen) return MPACK_OK;
+
+    if (cbor->reader.passthrough) {
+      size_t n = *inlen < *outlen ? *inlen : *outlen, left = n;
+      status = read(&cbor->reader, in, &left, &tok);
+      *inlen -= n - left;
+    } else {
+      status = read(&cbor->reader, in, inlen, &tok);
+    }
+    if (status == MPACK_EOF) continue;
+    if (status) return MPACK_ERROR;
+
+    if (write(&cbor->writer, out, outlen, &tok) == MPACK_ERROR) {
+      return MPACK_ERROR;
+    }
+  }
+
+  return !*inlen && !cbor->writer.plen ? MPACK_OK : MPACK_EOF;
+}
+
+static int mpack_cbor_rtoken(const unsigned char *p, size_t n,
+    mpack_token_t *tok, size_t *used)
+{
+  int status;
+  mpack_value_t v;
+  unsigned ai;
+
+  if (!n) return MPACK_EOF;
+  ai = p[0] & 0x1f;
+
+  if (p[0] >> 5 == CBOR_SIMPLE) {
+    switch (ai) {
+      case 20:
+      case 21:
+        *tok = mpack_pack_boolean(ai == 21);
+        *used = 1;
+        return MPACK_OK;
+      case 22:
+      case 23:
+        *tok = mpack_pack_nil();
+        *used = 1;
+        return MPACK_OK;
+      case 25:
+      case 26:
+      case 27:
+        if ((status = mpack_cbor_rarg(p, n, &v, used))) return status;
+        tok->type = MPACK_TOKEN_FLOAT;
+        tok->length = ai == 27 ? 8 : 4;
+        tok->data.value = v;
+        if (ai == 25) tok->data.value.lo = mpack_cbor_half(v.lo);
+        return MPACK_OK;
+      default:
+        return MPACK_ERROR;
+    }
+  }
+
+  if ((status = mpack_cbor_rarg(p, n, &v, used))) return status;
+
+  switch (p[0] >> 5) {
+    case CBOR_UINT:
+      tok->type = MPACK_TOKEN_UINT;
+      tok->data.value = v;
+      tok->length = v.hi ? 8 : v.lo > 0xffff ? 4 : v.lo > 0xff ? 2 : 1;
+      return MPACK_OK;
+    case CBOR_NINT:
+      /* -1 - v, which is ~v in two's complement */
+      if (v.hi >> 31) return MPACK_ERROR;
+      tok->type = MPACK_TOKEN_SINT;
+      tok->data.value.hi = ~v.hi & 0xffffffff;
+      tok->data.value.lo = ~v.lo & 0xffffffff;
+      tok->length = v.hi || v.lo >> 31 ? 8 : v.lo >> 15 ? 4 : v.lo >> 7 ? 2
+        : 1;
+      return MPACK_OK;
+    case CBOR_BYTES:
+    case CBOR_TEXT:
+      *tok = (p[0] >> 5) == CBOR_TEXT ? mpack_pack_str(v.lo)
+        : mpack_pack_bin(v.lo);
+      /* lengths are limited to 32 bits like in msgpack */
+      return v.hi ? MPACK_ERROR : MPACK_OK;
+    case CBOR_ARRAY:
+    case CBOR_MAP:
+      *tok = (p[0] >> 5) == CBOR_MAP ? mpack_pack_map(v.lo)
+        : mpack_pack_array(v.lo);
+      return v.hi ? MPACK_ERROR : MPACK_OK;
+    default:
+      /* a tag, returned as an ext token without length to mpack_cbor_read,
+       * which applies it to the byte string that must follow */
+      if (v.hi || v.lo > 127) return MPACK_ERROR;
+      *tok = mpack_pack_ext((int)v.lo, 0);
+      return MPACK_OK;
+  }
+}
+
+/* Reads the argument of the item header at `p`. */
+static int mpack_cbor_rarg(const unsigned char *p, size_t n,
+    mpack_value_t *v, size_t *used)
+{
+  unsigned ai = p[0] & 0x1f;
+  size_t len, i;
+
+  v->hi = v->lo = 0;
+
+  if (ai < 24) {
+    v->lo = ai;
+    *used = 1;
+    return MPACK_OK;
+  }
+
+  /* 28-30 are reserved and 31 marks indefinite lengths */
+  if (ai > 27) return MPACK_ERROR;
+  len = (size_t)1 << (ai - 24);
+  if (n < 1 + len) return MPACK_EOF;
+
+  for (i = 1; i <= len; i++) {
+    v->hi = (v->hi << 8 | v->lo >> 24) & 0xffffffff;
+    v->lo = (v->lo << 8 | p[i]) & 0xffffffff;
+  }
+  *used = 1 + len;
+  return MPACK_OK;
+}
+
+/* Converts the bits of a half precision float to single precision, which
+ * represents every half precision value exactly. */
+static mpack_uint32_t mpack_cbor_half(mpack_uint32_t h)
+{
+  mpack_uint32_t sign = (h & 0x8000) << 16;
+  mpack_uint32_t exp = (h >> 10) & 0x1f;
+  mpack_uint32_t mant = h & 0x3ff;
+
+  if (exp == 0x1f) return sign | 0x7f800000 | mant << 13;
+
+  if (!exp) {
+    if (!mant) return sign;
+    /* normalize the subnormal */
+    exp = 127 - 14;
+    while (!(mant & 0x400)) {
+      mant <<= 1;
+      exp--;
+    }
+    return sign | exp << 23 | (mant & 0x3ff) << 13;
+  }
+
+  return sign | (exp - 15 + 127) << 23 | mant << 13;
+}
+
+/* Encodes `tok` to `p`, returning the encoded length or 0 if the token
+ * can't be represented. */
+static size_t mpack_cbor_wtoken(const mpack_token_t *tok, unsigned char *p)
+{
+  mpack_token_t t;
+  mpack_value_t v;
+  size_t n;
+
+  switch (tok->type) {
+    case MPACK_TOKEN_NIL:
+      p[0] = 0xf6;
+      return 1;
+    case MPACK_TOKEN_BOOLEAN:
+      p[0] = tok->data.value.lo ? 0xf5 : 0xf4;
+      return 1;
+    case MPACK_TOKEN_UINT:
+      return mpack_cbor_whead(p, CBOR_UINT, tok->data.value);
+    case MPACK_TOKEN_SINT:
+      t = mpack_sint_extend(*tok);
+      v.hi = ~t.data.value.hi & 0xffffffff;
+      v.lo = ~t.data.value.lo & 0xffffffff;
+      return mpack_cbor_whead(p, CBOR_NINT, v);
+    case MPACK_TOKEN_FLOAT:
+      if (tok->length == 4) {
+        p[0] = CBOR_SIMPLE << 5 | 26;
+        mpack_cbor_wbe(p + 1, tok->data.value.lo, 4);
+        return 5;
+      }
+      p[0] = CBOR_SIMPLE << 5 | 27;
+      mpack_cbor_wbe(p + 1, tok->data.value.hi, 4);
+      mpack_cbor_wbe(p + 5, tok->data.value.lo, 4);
+      return 9;
+    case MPACK_TOKEN_BIN:
+    case MPACK_TOKEN_STR:
+    case MPACK_TOKEN_ARRAY:
+    case MPACK_TOKEN_MAP:
+      v.hi = 0;
+      v.lo = tok->length;
+      return mpack_cbor_whead(p, tok->type == MPACK_TOKEN_BIN ? CBOR_BYTES
+          : tok->type == MPACK_TOKEN_STR ? CBOR_TEXT
+          : tok->type == MPACK_TOKEN_ARRAY ? CBOR_ARRAY : CBOR_MAP, v);
+    case MPACK_TOKEN_EXT:
+      /* the reader returns the type byte unsigned, 128-255 are the
+       * negative types */
+      v.hi = 0;
+      v.lo = (mpack_uint32_t)tok->data.ext_type & 0xff;
+      if (v.lo > 127) return 0;
+      n = mpack_cbor_whead(p, CBOR_TAG, v);
+      v.lo = tok->length;
+      return n + mpack_cbor_whead(p + n, CBOR_BYTES, v);
+    default:
+      return 0;
+  }
+}
+
+/* Writes an item header with the shortest argument encoding. */
+static size_t mpack_cbor_whead(unsigned char *p, int major,
+    mpack_value_t v)
+{
+  unsigned char m = (unsigned char)(major << 5);
+
+  if (v.hi) {
+    p[0] = m | 27;
+    mpack_cbor_wbe(p + 1, v.hi, 4);
+    mpack_cbor_wbe(p + 5, v.lo, 4);
+    return 9;
+  } else if (v.lo < 24) {
+    p[0] = (unsigned char)(m | v.lo);
+    return 1;
+  } else if (v.lo <= 0xff) {
+    p[0] = m | 24;
+    p[1] = (unsigned char)v.lo;
+    return 2;
+  } else if (v.lo <= 0xffff) {
+    p[0] = m | 25;
+    mpack_cbor_wbe(p + 1, v.lo, 2);
+    return 3;
+  }
+  p[0] = m | 26;
+  mpack_cbor_wbe(p + 1, v.lo, 4);
+  return 5;
+}
+
+static void mpack_cbor_wbe(unsigned char *p, mpack_uint32_t v, size_t n)
+{
+  while (n--) {
+    p[n] = (unsigned char)(v & 0xff);
+    v >>= 8;
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef MPACK_CBOR_H
+#define MPACK_CBOR_H
+
+#include "core.h"
+#include "conv.h"
+
+/* CBOR (RFC 8949) on the token layer. mpack_cbor_read and mpack_cbor_write
+ * have the same contract as mpack_read and mpack_write, so CBOR can be
+ * transcoded to and from msgpack one token at a time:
+ *
+ * - unsigned/negative ints, floats (16-bit floats are read as float 32),
+ *   text/byte strings, arrays and maps map to the same msgpack types
+ * - false, true, null and undefined map to boolean and nil
+ * - tags 0-127 applied to a byte string map to ext values of the same type,
+ *   other tags are an error (as are negative ext types when writing)
+ * - indefinite length items and other simple values are an error
+ *
+ * A tokbuf must only be used with one of the formats. */
+typedef struct mpack_cbor_s {
+  mpack_tokbuf_t reader, writer;
+} mpack_cbor_t;
+
+MPACK_API int mpack_cbor_read(mpack_tokbuf_t *tokbuf, const char **buf,
+    size_t *buflen, mpack_token_t *tok) FUNUSED FNONULL;
+MPACK_API int mpack_cbor_write(mpack_tokbuf_t *tokbuf, char **buf,
+    size_t *buflen, const mpack_token_t *tok) FUNUSED FNONULL;
+MPACK_API void mpack_cbor_init(mpack_cbor_t *cbor) FUNUSED FNONULL;
+MPACK_API int mpack_cbor_to_msgpack(mpack_cbor_t *cbor, const char **in,
+    size_t *inlen, char **out, size_t *outlen) FUNUSED FNONULL;
+MPACK_API int mpack_cbor_from_msgpack(mpack_cbor_t *cbor, const char **in,
+    size_t *inlen, char **out, size_t *outlen) FUNUSED FNONULL;
+
+#endif  /* MPACK_CBOR_H */
@@ -105,6 +105,43 @@ MPACK_API mpack_token_t mpack_pack_float_fast(double v)
   return rv;
 }
 
+/* Like mpack_pack_float, but always uses the 8 byte format */
+MPACK_API mpack_token_t mpack_pack_double(double v)
+{
+  mpack_token_t rv;
+  union {
+    double d;
+    mpack_value_t m;
+  } conv;
+  conv.d = v;
+  rv.type = MPACK_TOKEN_FLOAT;
+  rv.length = 8;
+  rv.data.value = conv.m;
+  if (mpack_is_be()) {
+    MPACK_SWAP_VALUE(rv.data.value);
+  }
+  return rv;
+}
+
+/* Sign extends a negative integer token to 64 bits, which is what mpack_write
+ * expects. mpack_read only sign extends to the encoded size and
+ * mpack_pack_sint to the size of mpack_uintmax_t. Since the value is negative,
+ * the highest set bit gives the size. */
+MPACK_API mpack_token_t mpack_sint_extend(mpack_token_t t)
+{
+  mpack_uint32_t lo = t.data.value.lo;
+
+  if (t.type != MPACK_TOKEN_SINT || (t.data.value.hi & 0x80000000)) return t;
+
+  if (!(lo & 0x80000000)) {
+    lo |= (lo & 0x8000) ? 0xffff0000 : 0xffffff00;
+  }
+  t.data.value.lo = lo;
+  t.data.value.hi = 0xffffffff;
+  t.length = 8;
+  return t;
+}
+
 MPACK_API mpack_token_t mpack_pack_number(double v)
 {
   mpack_token_t tok;
@@ -149,6 +186,15 @@ MPACK_API mpack_token_t mpack_pack_chunk(const char *p, mpack_uint32_t l)
   return rv;
 }
 
+MPACK_API mpack_token_t mpack_pack_raw(const char *p, mpack_uint32_t l)
+{
+  mpack_token_t rv;
+  rv.type = MPACK_TOKEN_RAW;
+  rv.data.chunk_ptr = p;
+  rv.length = l;
+  return rv;
+}
+
 MPACK_API mpack_token_t mpack_pack_str(mpack_uint32_t l)
 {
   mpack_token_t rv;
@@ -25,8 +25,12 @@ MPACK_API mpack_token_t mpack_pack_sint(mpack_sintmax_t v) FUNUSED FPURE;
 MPACK_API mpack_token_t mpack_pack_float_compat(double v) FUNUSED FPURE;
 MPACK_API mpack_token_t mpack_pack_float_fast(double v) FUNUSED FPURE;
 MPACK_API mpack_token_t mpack_pack_number(double v) FUNUSED FPURE;
+MPACK_API mpack_token_t mpack_pack_double(double v) FUNUSED FPURE;
+MPACK_API mpack_token_t mpack_sint_extend(mpack_token_t t) FUNUSED FPURE;
 MPACK_API mpack_token_t mpack_pack_chunk(const char *p, mpack_uint32_t l)
   FUNUSED FPURE FNONULL;
+MPACK_API mpack_token_t mpack_pack_raw(const char *p, mpack_uint32_t l)
+  FUNUSED FPURE FNONULL;
 MPACK_API mpack_token_t mpack_pack_str(mpack_uint32_t l) FUNUSED FPURE;
 MPACK_API mpack_token_t mpack_pack_bin(mpack_uint32_t l) FUNUSED FPURE;
 MPACK_API mpack_token_t mpack_pack_ext(int type, mpack_uint32_t l)
@@ -115,7 +115,7 @@ MPACK_API int mpack_write(mpack_tokbuf_t *tokbuf, char **buf, size_t *buflen,
   mpack_token_t tok = tokbuf->plen ? tokbuf->pending_tok : *t;
   assert(*buf && *buflen);
 
-  if (tok.type == MPACK_TOKEN_CHUNK) {
+  if (tok.type == MPACK_TOKEN_CHUNK || tok.type == MPACK_TOKEN_RAW) {
     size_t written, pending, count;
     if (!tokbuf->plen) tokbuf->ppos = 0;
     written = tokbuf->ppos;
@@ -167,6 +167,47 @@ MPACK_API int mpack_write(mpack_tokbuf_t *tokbuf, char **buf, size_t *buflen,
   return MPACK_OK;
 }
 
+MPACK_API int mpack_skip(mpack_tokbuf_t *tokbuf, const char **buf,
+    size_t *buflen, mpack_uint32_t *remaining)
+{
+  while (*remaining && *buflen) {
+    int status;
+    mpack_token_t tok;
+    mpack_uint32_t children = 0;
+
+    if ((status = mpack_read(tokbuf, buf, buflen, &tok))) return status;
+
+    if (tok.type == MPACK_TOKEN_ARRAY) {
+      children = tok.length;
+    } else if (tok.type == MPACK_TOKEN_MAP) {
+      if (tok.length > 0x7fffffff) return MPACK_ERROR;
+      children = tok.length * 2;
+    } else if (tok.type >= MPACK_TOKEN_CHUNK && tokbuf->passthrough) {
+      /* str/bin/ext payload not fully consumed, the value is still open */
+      continue;
+    }
+
+    /* replace the value just read by its children, if any. */
+    if (children > 0xffffffff - *remaining + 1) return MPACK_ERROR;
+    *remaining = *remaining - 1 + children;
+  }
+
+  return *remaining ? MPACK_EOF : MPACK_OK;
+}
+
+MPACK_API size_t mpack_token_size(const mpack_token_t *tok)
+{
+  char buf[MPACK_MAX_TOKEN_LEN], *ptr = buf;
+  size_t ptrlen = sizeof(buf);
+
+  if (tok->type == MPACK_TOKEN_CHUNK || tok->type == MPACK_TOKEN_RAW) {
+    return tok->length;
+  }
+
+  if (mpack_wtoken(tok, &ptr, &ptrlen)) return 0;
+  return sizeof(buf) - ptrlen;
+}
+
 static int mpack_rtoken(const char **buf, size_t *buflen,
     mpack_token_t *tok)
 {
@@ -405,11 +446,11 @@ static int mpack_wnint(char **buf, size_t *buflen, mpack_value_t val)
     return mpack_w1(buf, buflen, 0xd3) ||
            mpack_w4(buf, buflen, hi)   ||
            mpack_w4(buf, buflen, lo);
-  } else if (lo < 0xffff7fff) {
+  } else if (lo < 0xffff8000) {
     /* int 32 */
     return mpack_w1(buf, buflen, 0xd2) ||
            mpack_w4(buf, buflen, lo);
-  } else if (lo < 0xffffff7f) {
+  } else if (lo < 0xffffff80) {
     /* int 16 */
     return mpack_w1(buf, buflen, 0xd1) ||
            mpack_w2(buf, buflen, lo);
@@ -55,7 +55,10 @@ typedef enum {
   MPACK_TOKEN_MAP       = 8,
   MPACK_TOKEN_BIN       = 9,
   MPACK_TOKEN_STR       = 10,
-  MPACK_TOKEN_EXT       = 11
+  MPACK_TOKEN_EXT       = 11,
+  /* A complete pre-encoded value, written verbatim. Only accepted by
+   * mpack_write/mpack_unparse, the reader never produces it. */
+  MPACK_TOKEN_RAW       = 12
 } mpack_token_type_t;
 
 typedef struct mpack_token_s {
@@ -83,5 +86,11 @@ MPACK_API int mpack_read(mpack_tokbuf_t *tb, const char **b, size_t *bl,
     mpack_token_t *tok) FUNUSED FNONULL;
 MPACK_API int mpack_write(mpack_tokbuf_t *tb, char **b, size_t *bl,
     const mpack_token_t *tok) FUNUSED FNONULL;
+MPACK_API int mpack_skip(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    mpack_uint32_t *n) FUNUSED FNONULL;
+/* Number of bytes mpack_write writes for `tok`, 0 if it is not valid. For
+ * str/bin/ext tokens this is only the header: the payload is written by
+ * chunk tokens, which count `tok->length` bytes. */
+MPACK_API size_t mpack_token_size(const mpack_token_t *tok) FUNUSED FNONULL;
 
 #endif  /* MPACK_CORE_H */
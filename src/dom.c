@@ -0,0 +1,179 @@
+#include <string.h>
+
+#include "dom.h"
+
+static mpack_object_t *mpack_dom_object(mpack_dom_t *dom, mpack_node_t *node);
+static void mpack_dom_enter(mpack_parser_t *parser, mpack_node_t *node);
+static void mpack_dom_exit(mpack_parser_t *parser, mpack_node_t *node);
+static void mpack_dom_unparse_enter(mpack_parser_t *parser,
+    mpack_node_t *node);
+static void mpack_dom_unparse_exit(mpack_parser_t *parser,
+    mpack_node_t *node);
+
+MPACK_API void mpack_dom_init(mpack_dom_t *dom, mpack_arena_t *arena,
+    int copy)
+{
+  mpack_parser_init(&dom->parser, 0);
+  dom->parser.data.p = dom;
+  dom->arena = arena;
+  dom->root = NULL;
+  dom->copy = copy;
+  dom->seg = dom->end = NULL;
+  dom->segoff = 0;
+}
+
+MPACK_API int mpack_dom_parse(mpack_dom_t *dom, const char **buf,
+    size_t *buflen)
+{
+  int status;
+
+  if (*buf != dom->end) {
+    /* not a continuation of the previous input */
+    dom->seg = *buf;
+    dom->segoff = dom->parser.offset;
+  }
+
+  status = mpack_parse(&dom->parser, buf, buflen, mpack_dom_enter,
+      mpack_dom_exit);
+  dom->end = *buf;
+  /* the only exception thrown by the callbacks is an allocation failure */
+  return status == MPACK_EXCEPTION ? MPACK_NOMEM : status;
+}
+
+MPACK_API void mpack_dom_unparse_init(mpack_dom_t *dom, mpack_object_t *root)
+{
+  mpack_parser_init(&dom->parser, 0);
+  dom->parser.data.p = dom;
+  dom->root = root;
+}
+
+MPACK_API int mpack_dom_unparse(mpack_dom_t *dom, char **buf, size_t *buflen)
+{
+  return mpack_unparse(&dom->parser, buf, buflen, mpack_dom_unparse_enter,
+      mpack_dom_unparse_exit);
+}
+
+MPACK_API void mpack_object_touch(mpack_object_t *obj)
+{
+  for (; obj && obj->raw; obj = obj->parent) {
+    obj->raw = NULL;
+  }
+}
+
+static mpack_object_t *mpack_dom_object(mpack_dom_t *dom, mpack_node_t *node)
+{
+  mpack_node_t *parent = MPACK_PARENT_NODE(node);
+  mpack_object_t *p;
+
+  if (!parent) return dom->root;
+
+  p = parent->data[0].p;
+  if (parent->tok.type == MPACK_TOKEN_MAP) {
+    return p->v.items + parent->pos * 2 + (size_t)parent->key_visited;
+  }
+
+  return p->v.items + parent->pos;
+}
+
+static void mpack_dom_enter(mpack_parser_t *parser, mpack_node_t *node)
+{
+  mpack_dom_t *dom = parser->data.p;
+  mpack_node_t *parent = MPACK_PARENT_NODE(node);
+  mpack_object_t *obj;
+  size_t count;
+
+  if (node->tok.type == MPACK_TOKEN_CHUNK) {
+    obj = parent->data[0].p;
+    if (!dom->copy && !parent->pos && node->tok.length == obj->tok.length
+        && node->tok.data.chunk_ptr != parser->key) {
+      /* the whole payload is in the input buffer, reference it */
+      obj->v.data = node->tok.data.chunk_ptr;
+      return;
+    }
+    if (!parent->pos) {
+      if (!(obj->v.data = mpack_arena_alloc(dom->arena, obj->tok.length))) {
+        MPACK_THROW(parser);
+      }
+    }
+    memcpy((char *)obj->v.data + parent->pos, node->tok.data.chunk_ptr,
+        node->tok.length);
+    return;
+  }
+
+  if (!parent) {
+    if (!(dom->root = mpack_arena_alloc(dom->arena, sizeof(*dom->root)))) {
+      MPACK_THROW(parser);
+    }
+  }
+
+  obj = mpack_dom_object(dom, node);
+  /* negative integers are sign extended so they can be written back */
+  obj->tok = mpack_sint_extend(node->tok);
+  obj->v.items = NULL;
+  obj->parent = parent ? parent->data[0].p : NULL;
+  obj->raw = NULL;
+  node->data[0].p = obj;
+
+  if (node->tok.type == MPACK_TOKEN_ARRAY
+      || node->tok.type == MPACK_TOKEN_MAP) {
+    count = node->tok.length;
+    if (node->tok.type == MPACK_TOKEN_MAP) {
+      if (count > (size_t)-1 / 2) MPACK_THROW(parser);
+      count *= 2;
+    }
+    if (!count) return;
+    if (count > (size_t)-1 / sizeof(*obj)
+        || !(obj->v.items = mpack_arena_alloc(dom->arena,
+            count * sizeof(*obj)))) {
+      MPACK_THROW(parser);
+    }
+  } else if (node->tok.type > MPACK_TOKEN_MAP) {
+    obj->v.data = NULL;
+  }
+}
+
+static void mpack_dom_exit(mpack_parser_t *parser, mpack_node_t *node)
+{
+  mpack_dom_t *dom = parser->data.p;
+  mpack_object_t *obj = node->data[0].p;
+
+  /* raw spans reference the input, so they are only kept when it outlives the
+   * DOM. values that start before the current input may have been split
+   * across buffers that are not contiguous, and values that can't be written
+   * as a single chunk are always re-encoded. */
+  if (node->tok.type == MPACK_TOKEN_CHUNK || dom->copy
+      || node->start < dom->segoff || (node->end - node->start) >> 31 >> 1) {
+    return;
+  }
+
+  obj->raw = dom->seg + (node->start - dom->segoff);
+  obj->rawlen = node->end - node->start;
+}
+
+static void mpack_dom_unparse_enter(mpack_parser_t *parser,
+    mpack_node_t *node)
+{
+  mpack_dom_t *dom = parser->data.p;
+  mpack_node_t *parent = MPACK_PARENT_NODE(node);
+  mpack_object_t *obj;
+
+  if (parent && parent->tok.type > MPACK_TOKEN_MAP) {
+    /* str/bin/ext payloads are written as a single chunk */
+    obj = parent->data[0].p;
+    node->tok = mpack_pack_chunk(obj->v.data, obj->tok.length);
+    return;
+  }
+
+  obj = mpack_dom_object(dom, node);
+  node->data[0].p = obj;
+  /* unmodified objects are written with their original encoding */
+  node->tok = obj->raw ? mpack_pack_raw(obj->raw, (mpack_uint32_t)obj->rawlen)
+    : obj->tok;
+}
+
+static void mpack_dom_unparse_exit(mpack_parser_t *parser,
+    mpack_node_t *node)
+{
+  (void)parser;
+  (void)node;
+}
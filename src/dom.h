@@ -0,0 +1,54 @@
+#ifndef MPACK_DOM_H
+#define MPACK_DOM_H
+
+#include "core.h"
+#include "object.h"
+#include "arena.h"
+
+/* A decoded msgpack value. Scalars are kept in `tok`. For str/bin/ext,
+ * `tok.length` is the payload size and `v.data` points to the payload. Arrays
+ * have `tok.length` items in `v.items` and maps have `tok.length` key/value
+ * pairs stored as 2 * `tok.length` consecutive items.
+ *
+ * Objects can be modified in place, with new items/payloads allocated from the
+ * arena. `raw` is the original encoding of the object, which is written
+ * verbatim by mpack_dom_unparse, so call mpack_object_touch on an object
+ * before modifying it. Objects created by the user must have `raw` set to
+ * NULL. */
+typedef struct mpack_object_s {
+  mpack_token_t tok;
+  union {
+    struct mpack_object_s *items;
+    const char *data;
+  } v;
+  struct mpack_object_s *parent;
+  const char *raw;
+  size_t rawlen;
+} mpack_object_t;
+
+typedef struct mpack_dom_s {
+  mpack_parser_t parser;
+  mpack_arena_t *arena;
+  mpack_object_t *root;
+  /* copy str/bin/ext payloads to the arena. When zero, payloads that are
+   * contiguous in the input are referenced directly, so the input buffer must
+   * outlive the DOM. */
+  int copy;
+  /* start of the input being parsed and its offset in the stream. Raw spans
+   * are only recorded for values that start in it, which means they were
+   * read from contiguous memory. */
+  const char *seg, *end;
+  size_t segoff;
+} mpack_dom_t;
+
+MPACK_API void mpack_dom_init(mpack_dom_t *dom, mpack_arena_t *arena,
+    int copy) FUNUSED FNONULL;
+MPACK_API int mpack_dom_parse(mpack_dom_t *dom, const char **b, size_t *bl)
+  FUNUSED FNONULL;
+MPACK_API void mpack_dom_unparse_init(mpack_dom_t *dom, mpack_object_t *root)
+  FUNUSED FNONULL;
+MPACK_API int mpack_dom_unparse(mpack_dom_t *dom, char **b, size_t *bl)
+  FUNUSED FNONULL;
+MPACK_API void mpack_object_touch(mpack_object_t *obj) FUNUSED FNONULL;
+
+#endif  /* MPACK_DOM_H */
@@ -0,0 +1,144 @@
+#include <string.h>
+
+#include "index.h"
+
+#define FNV_OFFSET 0x811c9dc5
+#define FNV_PRIME 0x01000193
+
+static int mpack_index_value(const char **b, size_t *bl);
+static int mpack_index_insert(mpack_index_t *index, const char *buf,
+    mpack_index_slot_t slot);
+
+MPACK_API int mpack_index_init(mpack_index_t *index, mpack_index_slot_t *slots,
+    mpack_uint32_t capacity)
+{
+  /* capacity must be a power of two so probing can mask the hash */
+  if (!capacity || (capacity & (capacity - 1))) return MPACK_ERROR;
+
+  index->slots = slots;
+  index->mask = capacity - 1;
+  index->count = 0;
+  memset(slots, 0, sizeof(*slots) * capacity);
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_index_build(mpack_index_t *index, const char *buf,
+    size_t buflen)
+{
+  int status;
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  mpack_token_t tok;
+  mpack_uint32_t remaining;
+  const char *b = buf;
+  size_t bl = buflen;
+
+  /* offsets are 32-bit, written as two shifts to avoid a warning when size_t
+   * is 32-bit itself */
+  if (buflen >> 31 >> 1) return MPACK_ERROR;
+
+  if (!bl) return MPACK_EOF;
+  if ((status = mpack_read(&tb, &b, &bl, &tok))) return status;
+  if (tok.type != MPACK_TOKEN_MAP) return MPACK_ERROR;
+
+  for (remaining = tok.length; remaining; remaining--) {
+    mpack_index_slot_t slot;
+    const char *key = b;
+    size_t keybl = bl;
+
+    if (!bl) return MPACK_EOF;
+    if ((status = mpack_read(&tb, &b, &bl, &tok))) return status;
+
+    if (tok.type != MPACK_TOKEN_STR && tok.type != MPACK_TOKEN_BIN) {
+      /* other keys are skipped along with their values */
+      b = key;
+      bl = keybl;
+      mpack_tokbuf_init(&tb);
+      if ((status = mpack_index_value(&b, &bl))
+          || (status = mpack_index_value(&b, &bl))) {
+        return status;
+      }
+      continue;
+    }
+
+    slot.key = (mpack_uint32_t)(b - buf);
+    if (tok.length) {
+      /* the whole map is in the buffer, so the payload is a single chunk */
+      if (!bl) return MPACK_EOF;
+      mpack_read(&tb, &b, &bl, &tok);
+      if (tb.passthrough) return MPACK_EOF;
+    }
+
+    slot.value = (mpack_uint32_t)(b - buf);
+    if ((status = mpack_index_value(&b, &bl))) return status;
+    slot.end = (mpack_uint32_t)(b - buf);
+    slot.hash = mpack_index_hash(buf + slot.key, slot.value - slot.key);
+
+    if ((status = mpack_index_insert(index, buf, slot))) return status;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API const mpack_index_slot_t *mpack_index_find(
+    const mpack_index_t *index, const char *buf, const char *key,
+    mpack_uint32_t keylen)
+{
+  mpack_uint32_t hash = mpack_index_hash(key, keylen);
+  mpack_uint32_t i;
+
+  for (i = hash & index->mask; index->slots[i].value;
+      i = (i + 1) & index->mask) {
+    const mpack_index_slot_t *slot = index->slots + i;
+    if (slot->hash == hash && slot->value - slot->key == keylen
+        && !memcmp(buf + slot->key, key, keylen)) {
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+/* 32-bit FNV-1a */
+MPACK_API mpack_uint32_t mpack_index_hash(const char *key,
+    mpack_uint32_t keylen)
+{
+  mpack_uint32_t hash = FNV_OFFSET;
+
+  while (keylen--) {
+    hash ^= (unsigned char)*key++;
+    hash = (hash * FNV_PRIME) & 0xffffffff;
+  }
+
+  return hash;
+}
+
+static int mpack_index_value(const char **b, size_t *bl)
+{
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  mpack_uint32_t remaining = 1;
+  /* EOF here means the map is truncated */
+  return mpack_skip(&tb, b, bl, &remaining);
+}
+
+static int mpack_index_insert(mpack_index_t *index, const char *buf,
+    mpack_index_slot_t slot)
+{
+  mpack_uint32_t i;
+
+  for (i = slot.hash & index->mask; index->slots[i].value;
+      i = (i + 1) & index->mask) {
+    const mpack_index_slot_t *s = index->slots + i;
+    if (s->hash == slot.hash && s->value - s->key == slot.value - slot.key
+        && !memcmp(buf + s->key, buf + slot.key, slot.value - slot.key)) {
+      /* duplicate key, the first entry wins */
+      return MPACK_OK;
+    }
+  }
+
+  /* always leave an empty slot so lookups terminate */
+  if (index->count == index->mask) return MPACK_NOMEM;
+
+  index->slots[i] = slot;
+  index->count++;
+  return MPACK_OK;
+}
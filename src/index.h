@@ -0,0 +1,32 @@
+#ifndef MPACK_INDEX_H
+#define MPACK_INDEX_H
+
+#include "core.h"
+#include "object.h"
+
+/* Hash index over the str/bin keys of an encoded map. Offsets are relative to
+ * the start of the map, so the slot table can be stored alongside the buffer
+ * and reused without rebuilding. */
+typedef struct mpack_index_slot_s {
+  mpack_uint32_t hash;
+  /* offsets of the key payload, the value and the end of the value. The key
+   * payload ends where the value starts. A slot with `value == 0` is empty. */
+  mpack_uint32_t key, value, end;
+} mpack_index_slot_t;
+
+typedef struct mpack_index_s {
+  mpack_index_slot_t *slots;
+  mpack_uint32_t mask, count;
+} mpack_index_t;
+
+MPACK_API int mpack_index_init(mpack_index_t *index, mpack_index_slot_t *slots,
+    mpack_uint32_t capacity) FUNUSED FNONULL;
+MPACK_API int mpack_index_build(mpack_index_t *index, const char *buf,
+    size_t buflen) FUNUSED FNONULL;
+MPACK_API const mpack_index_slot_t *mpack_index_find(
+    const mpack_index_t *index, const char *buf, const char *key,
+    mpack_uint32_t keylen) FUNUSED FNONULL_ARG((1,2));
+MPACK_API mpack_uint32_t mpack_index_hash(const char *key,
+    mpack_uint32_t keylen) FUNUSED;
+
+#endif  /* MPACK_INDEX_H */
@@ -0,0 +1,959 @@
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+enum {
+  MPACK_JSON_VALUE = 0,
+  MPACK_JSON_STR,
+  MPACK_JSON_BASE64
+};
+
+static int mpack_json_token(mpack_json_t *json, mpack_token_t tok);
+static int mpack_json_str(mpack_json_t *json, const char **in, size_t *inlen,
+    char **out, size_t *outlen);
+static int mpack_json_base64(mpack_json_t *json, const char **in,
+    size_t *inlen, char **out, size_t *outlen);
+static void mpack_json_done(mpack_json_t *json);
+static void mpack_json_put(mpack_json_t *json, const char *s, size_t n);
+static int mpack_json_flush(mpack_json_t *json, char **out, size_t *outlen);
+static void mpack_json_uint(mpack_json_t *json, mpack_uint32_t hi,
+    mpack_uint32_t lo);
+static void mpack_json_float(mpack_json_t *json, mpack_token_t tok);
+static void mpack_json_quad(const unsigned char *group, mpack_uint32_t len,
+    char *dst);
+static size_t mpack_json_clean(const char *s, size_t n);
+static int mpack_json_rvalue(mpack_json_reader_t *reader, const char **in,
+    size_t *inlen, mpack_token_t *tok);
+static int mpack_json_rstr(mpack_json_reader_t *reader, const char **in,
+    size_t *inlen, char **out, size_t *outlen);
+static void mpack_json_rdone(mpack_json_reader_t *reader);
+static int mpack_json_count(mpack_json_reader_t *reader, const char *s,
+    size_t n);
+static int mpack_json_strlen(mpack_json_reader_t *reader, const char *s,
+    size_t n);
+static int mpack_json_escape(const char *s, size_t n, char *utf8,
+    size_t *len, size_t *used);
+static int mpack_json_hex4(const char *s, mpack_uint32_t *v);
+static int mpack_json_number(const char *s, size_t n, mpack_token_t *tok);
+static size_t mpack_json_significant(const char *s, size_t n, char *out,
+    size_t *kept, long *dropped, int *sticky);
+static size_t mpack_json_skip(const char *s, size_t n, int quoted);
+
+static const char mpack_json_b64[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const char mpack_json_digits[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536"
+  "37383940414243444546474849505152535455565758596061626364656667686970717273"
+  "7475767778798081828384858687888990919293949596979899";
+
+MPACK_API void mpack_json_init(mpack_json_t *json)
+{
+  mpack_tokbuf_init(&json->tokbuf);
+  json->size = 0;
+  json->state = MPACK_JSON_VALUE;
+  json->ext = 0;
+  json->grouplen = 0;
+  json->ppos = json->plen = 0;
+}
+
+/* Transcodes one msgpack value. Returns MPACK_OK once the JSON text of the
+ * value has been completely written, MPACK_EOF when more input or more
+ * output space is needed (whichever of `*inlen`/`*outlen` is 0) and
+ * MPACK_ERROR for values that can't be represented. */
+MPACK_API int mpack_json_transcode(mpack_json_t *json, const char **in,
+    size_t *inlen, char **out, size_t *outlen)
+{
+  int status;
+  mpack_token_t tok;
+
+  for (;;) {
+    if (!mpack_json_flush(json, out, outlen)) return MPACK_EOF;
+
+    if (json->state == MPACK_JSON_STR) {
+      if ((status = mpack_json_str(json, in, inlen, out, outlen))) {
+        return status;
+      }
+      continue;
+    }
+
+    if (json->state == MPACK_JSON_BASE64) {
+      if ((status = mpack_json_base64(json, in, inlen, out, outlen))) {
+        return status;
+      }
+      continue;
+    }
+
+    if (json->size == (mpack_uint32_t)-1) {
+      /* top level value complete */
+      json->size = 0;
+      return MPACK_OK;
+    }
+
+    if (!*inlen) return MPACK_EOF;
+    if ((status = mpack_read(&json->tokbuf, in, inlen, &tok))) return status;
+    if ((status = mpack_json_token(json, tok))) return status;
+  }
+}
+
+static int mpack_json_token(mpack_json_t *json, mpack_token_t tok)
+{
+  mpack_json_frame_t *frame = json->size ? json->frames + json->size - 1
+    : NULL;
+  int key = frame && frame->map && !(frame->pos % 2);
+
+  if (frame && frame->pos) {
+    mpack_json_put(json, frame->map && !key ? ":" : ",", 1);
+  }
+
+  if (key && (tok.type == MPACK_TOKEN_ARRAY || tok.type == MPACK_TOKEN_MAP
+        || tok.type == MPACK_TOKEN_EXT)) {
+    return MPACK_ERROR;
+  }
+
+  if (key && tok.type < MPACK_TOKEN_CHUNK) mpack_json_put(json, "\"", 1);
+
+  switch (tok.type) {
+    case MPACK_TOKEN_NIL:
+      mpack_json_put(json, "null", 4);
+      break;
+    case MPACK_TOKEN_BOOLEAN:
+      if (mpack_unpack_boolean(tok)) {
+        mpack_json_put(json, "true", 4);
+      } else {
+        mpack_json_put(json, "false", 5);
+      }
+      break;
+    case MPACK_TOKEN_UINT:
+      mpack_json_uint(json, tok.data.value.hi, tok.data.value.lo);
+      break;
+    case MPACK_TOKEN_SINT:
+      /* print the absolute value of the 64-bit two's complement */
+      tok = mpack_sint_extend(tok);
+      tok.data.value.lo = ~tok.data.value.lo + 1;
+      tok.data.value.hi = ~tok.data.value.hi + !tok.data.value.lo;
+      mpack_json_put(json, "-", 1);
+      mpack_json_uint(json, tok.data.value.hi, tok.data.value.lo);
+      break;
+    case MPACK_TOKEN_FLOAT:
+      mpack_json_float(json, tok);
+      break;
+    case MPACK_TOKEN_STR:
+      mpack_json_put(json, "\"", 1);
+      json->state = MPACK_JSON_STR;
+      return MPACK_OK;
+    case MPACK_TOKEN_BIN:
+    case MPACK_TOKEN_EXT:
+      json->ext = tok.type == MPACK_TOKEN_EXT;
+      if (json->ext) {
+        /* the reader returns the type byte unsigned, 128-255 are the
+         * negative types */
+        int type = (signed char)(tok.data.ext_type & 0xff);
+        mpack_json_put(json, "{\"type\":", 8);
+        if (type < 0) {
+          mpack_json_put(json, "-", 1);
+          mpack_json_uint(json, 0, (mpack_uint32_t)-type);
+        } else {
+          mpack_json_uint(json, 0, (mpack_uint32_t)type);
+        }
+        mpack_json_put(json, ",\"data\":", 8);
+      }
+      mpack_json_put(json, "\"", 1);
+      json->grouplen = 0;
+      json->state = MPACK_JSON_BASE64;
+      return MPACK_OK;
+    case MPACK_TOKEN_ARRAY:
+    case MPACK_TOKEN_MAP:
+      mpack_json_put(json, tok.type == MPACK_TOKEN_MAP ? "{" : "[", 1);
+      if (!tok.length) {
+        mpack_json_put(json, tok.type == MPACK_TOKEN_MAP ? "}" : "]", 1);
+        break;
+      }
+      if (json->size == MPACK_MAX_OBJECT_DEPTH) return MPACK_ERROR;
+      if (tok.type == MPACK_TOKEN_MAP && tok.length > 0x7fffffff) {
+        return MPACK_ERROR;
+      }
+      frame = json->frames + json->size++;
+      frame->map = tok.type == MPACK_TOKEN_MAP;
+      frame->length = frame->map ? tok.length * 2 : tok.length;
+      frame->pos = 0;
+      return MPACK_OK;
+    default:
+      return MPACK_ERROR;
+  }
+
+  if (key) mpack_json_put(json, "\"", 1);
+  mpack_json_done(json);
+  return MPACK_OK;
+}
+
+/* Copies string bytes straight to the output, reading only as much input as
+ * there is room for. Bytes that need escaping go through the pending text. */
+static int mpack_json_str(mpack_json_t *json, const char **in, size_t *inlen,
+    char **out, size_t *outlen)
+{
+  mpack_tokbuf_t *tb = &json->tokbuf;
+
+  while (tb->passthrough) {
+    size_t n, clean;
+    unsigned char c;
+
+    if (!*inlen || !*outlen) return MPACK_EOF;
+    n = tb->passthrough < *inlen ? tb->passthrough : *inlen;
+    if (n > *outlen) n = *outlen;
+    clean = mpack_json_clean(*in, n);
+    memcpy(*out, *in, clean);
+    *out += clean;
+    *outlen -= clean;
+    *in += clean;
+    *inlen -= clean;
+    tb->passthrough -= (mpack_uint32_t)clean;
+    if (clean == n) continue;
+
+    c = (unsigned char)**in;
+    (*in)++;
+    (*inlen)--;
+    tb->passthrough--;
+    switch (c) {
+      case '"': mpack_json_put(json, "\\\"", 2); break;
+      case '\\': mpack_json_put(json, "\\\\", 2); break;
+      case '\b': mpack_json_put(json, "\\b", 2); break;
+      case '\f': mpack_json_put(json, "\\f", 2); break;
+      case '\n': mpack_json_put(json, "\\n", 2); break;
+      case '\r': mpack_json_put(json, "\\r", 2); break;
+      case '\t': mpack_json_put(json, "\\t", 2); break;
+      default: {
+        char esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+        esc[4] = (char)('0' + (c >> 4));
+        esc[5] = "0123456789abcdef"[c & 0xf];
+        mpack_json_put(json, esc, sizeof(esc));
+      }
+    }
+    if (!mpack_json_flush(json, out, outlen)) return MPACK_EOF;
+  }
+
+  mpack_json_put(json, "\"", 1);
+  json->state = MPACK_JSON_VALUE;
+  mpack_json_done(json);
+  return MPACK_OK;
+}
+
+/* Encodes bin/ext payloads. Complete groups of 3 bytes are encoded straight
+ * to the output, partial groups are kept until the next buffer. */
+static int mpack_json_base64(mpack_json_t *json, const char **in,
+    size_t *inlen, char **out, size_t *outlen)
+{
+  mpack_tokbuf_t *tb = &json->tokbuf;
+
+  while (tb->passthrough) {
+    if (!*inlen) return MPACK_EOF;
+
+    if (!json->grouplen) {
+      /* whole groups that are in the input and fit in the output */
+      size_t groups = tb->passthrough < *inlen ? tb->passthrough : *inlen;
+      groups /= 3;
+      if (groups > *outlen / 4) groups = *outlen / 4;
+      if (groups) {
+        size_t i;
+        for (i = 0; i < groups; i++) {
+          mpack_json_quad((const unsigned char *)*in + i * 3, 3,
+              *out + i * 4);
+        }
+        *in += groups * 3;
+        *inlen -= groups * 3;
+        tb->passthrough -= (mpack_uint32_t)(groups * 3);
+        *out += groups * 4;
+        *outlen -= groups * 4;
+        continue;
+      }
+    }
+
+    json->group[json->grouplen++] = (unsigned char)**in;
+    (*in)++;
+    (*inlen)--;
+    tb->passthrough--;
+    if (json->grouplen == 3) {
+      char quad[4];
+      mpack_json_quad(json->group, 3, quad);
+      mpack_json_put(json, quad, 4);
+      json->grouplen = 0;
+      if (!mpack_json_flush(json, out, outlen)) return MPACK_EOF;
+    }
+  }
+
+  if (json->grouplen) {
+    char quad[4];
+    mpack_json_quad(json->group, json->grouplen, quad);
+    mpack_json_put(json, quad, 4);
+    json->grouplen = 0;
+  }
+  mpack_json_put(json, json->ext ? "\"}" : "\"", json->ext ? 2 : 1);
+  json->state = MPACK_JSON_VALUE;
+  mpack_json_done(json);
+  return MPACK_OK;
+}
+
+/* Called when a value is complete, closes the containers it completes. */
+static void mpack_json_done(mpack_json_t *json)
+{
+  while (json->size) {
+    mpack_json_frame_t *frame = json->frames + json->size - 1;
+    if (++frame->pos < frame->length) return;
+    mpack_json_put(json, frame->map ? "}" : "]", 1);
+    json->size--;
+  }
+  /* marks the top level value as complete */
+  json->size = (mpack_uint32_t)-1;
+}
+
+static void mpack_json_put(mpack_json_t *json, const char *s, size_t n)
+{
+  assert(json->plen + n <= sizeof(json->pending));
+  memcpy(json->pending + json->plen, s, n);
+  json->plen += n;
+}
+
+/* Writes pending text, returns 0 if it didn't fit */
+static int mpack_json_flush(mpack_json_t *json, char **out, size_t *outlen)
+{
+  size_t n = json->plen - json->ppos;
+  if (!n) return 1;
+  if (n > *outlen) n = *outlen;
+  memcpy(*out, json->pending + json->ppos, n);
+  *out += n;
+  *outlen -= n;
+  json->ppos += n;
+  if (json->ppos < json->plen) return 0;
+  json->ppos = json->plen = 0;
+  return 1;
+}
+
+/* Formats a 64-bit integer given as 32-bit halves, so it also works without
+ * 64-bit integer types. The digits are produced two at a time. */
+static void mpack_json_uint(mpack_json_t *json, mpack_uint32_t hi,
+    mpack_uint32_t lo)
+{
+  char buf[20];
+  char *p = buf + sizeof(buf);
+
+  while (hi) {
+    /* divide by 10000 in 16-bit limbs, the remainders fit in 32 bits */
+    mpack_uint32_t r, limbs[4], i, rem;
+    limbs[0] = hi >> 16;
+    limbs[1] = hi & 0xffff;
+    limbs[2] = lo >> 16;
+    limbs[3] = lo & 0xffff;
+    for (i = 0, r = 0; i < 4; i++) {
+      mpack_uint32_t cur = (r << 16) | limbs[i];
+      limbs[i] = cur / 10000;
+      r = cur % 10000;
+    }
+    hi = (limbs[0] << 16) | limbs[1];
+    lo = (limbs[2] << 16) | limbs[3];
+    rem = r;
+    p -= 4;
+    memcpy(p, mpack_json_digits + (rem / 100) * 2, 2);
+    memcpy(p + 2, mpack_json_digits + (rem % 100) * 2, 2);
+  }
+
+  while (lo >= 100) {
+    p -= 2;
+    memcpy(p, mpack_json_digits + (lo % 100) * 2, 2);
+    lo /= 100;
+  }
+  if (lo >= 10) {
+    p -= 2;
+    memcpy(p, mpack_json_digits + lo * 2, 2);
+  } else {
+    *--p = (char)('0' + lo);
+  }
+
+  mpack_json_put(json, p, (size_t)(buf + sizeof(buf) - p));
+}
+
+/* Shortest of 15 to 17 significant digits (6 to 9 for float 32) that reads
+ * back as the same value. Integers that %g would print in full are written
+ * directly, and the decimal point of the current locale is replaced by '.'. */
+static void mpack_json_float(mpack_json_t *json, mpack_token_t tok)
+{
+  char buf[48], *p;
+  const char *point;
+  double v = mpack_unpack_float(tok), vabs = v < 0 ? -v : v;
+  int prec = tok.length == 4 ? 6 : 15, max = tok.length == 4 ? 9 : 17;
+
+  if (v != v || v - v != 0) {
+    /* NaN or infinity */
+    mpack_json_put(json, "null", 4);
+    return;
+  }
+
+  if (vabs >= 1 && vabs < (tok.length == 4 ? 1e6 : 1e15)) {
+    mpack_uint32_t hi = (mpack_uint32_t)(vabs / 4294967296.0);
+    mpack_uint32_t lo = (mpack_uint32_t)(vabs - hi * 4294967296.0);
+    if (hi * 4294967296.0 + lo == vabs) {
+      if (v < 0) mpack_json_put(json, "-", 1);
+      mpack_json_uint(json, hi, lo);
+      return;
+    }
+  }
+
+  for (; prec < max; prec++) {
+    /* the mask only tells the compiler how long the output can be */
+    sprintf(buf, "%.*g", prec & 0x1f, v);
+    if (tok.length == 4 ? (float)strtod(buf, NULL) == (float)v
+        : strtod(buf, NULL) == v) {
+      break;
+    }
+  }
+  if (prec == max) sprintf(buf, "%.*g", prec & 0x1f, v);
+
+  point = localeconv()->decimal_point;
+  if (point[0] && (point[0] != '.' || point[1]) && (p = strstr(buf, point))) {
+    size_t n = strlen(point);
+    *p = '.';
+    memmove(p + 1, p + n, strlen(p + n) + 1);
+  }
+  mpack_json_put(json, buf, strlen(buf));
+}
+
+static void mpack_json_quad(const unsigned char *group, mpack_uint32_t len,
+    char *dst)
+{
+  mpack_uint32_t v = (mpack_uint32_t)group[0] << 16;
+  if (len > 1) v |= (mpack_uint32_t)group[1] << 8;
+  if (len > 2) v |= group[2];
+  dst[0] = mpack_json_b64[(v >> 18) & 0x3f];
+  dst[1] = mpack_json_b64[(v >> 12) & 0x3f];
+  dst[2] = len > 1 ? mpack_json_b64[(v >> 6) & 0x3f] : '=';
+  dst[3] = len > 2 ? mpack_json_b64[v & 0x3f] : '=';
+}
+
+#define MPACK_JSON_ONES 0x01010101
+#define MPACK_JSON_HIGHS 0x80808080
+/* nonzero if a byte of `x` is zero/below `n` (n <= 128) */
+#define MPACK_JSON_HAS_ZERO(x) \
+  (((x) - MPACK_JSON_ONES) & ~(x) & MPACK_JSON_HIGHS)
+#define MPACK_JSON_HAS_LESS(x, n) \
+  (((x) - MPACK_JSON_ONES * (n)) & ~(x) & MPACK_JSON_HIGHS)
+
+/* Length of the prefix of `s` that needs no escaping. Checks 4 bytes at a
+ * time for control characters, quotes and backslashes. */
+static size_t mpack_json_clean(const char *s, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    /* byte order doesn't matter, only whether any byte matches */
+    const unsigned char *b = (const unsigned char *)s + i;
+    mpack_uint32_t x = (mpack_uint32_t)b[0] | (mpack_uint32_t)b[1] << 8
+      | (mpack_uint32_t)b[2] << 16 | (mpack_uint32_t)b[3] << 24;
+    if (MPACK_JSON_HAS_LESS(x, 0x20)
+        || MPACK_JSON_HAS_ZERO(x ^ (MPACK_JSON_ONES * '"'))
+        || MPACK_JSON_HAS_ZERO(x ^ (MPACK_JSON_ONES * '\\'))) {
+      break;
+    }
+  }
+
+  for (; i < n; i++) {
+    unsigned char c = (unsigned char)s[i];
+    if (c < 0x20 || c == '"' || c == '\\') break;
+  }
+
+  return i;
+}
+
+MPACK_API void mpack_json_reader_init(mpack_json_reader_t *reader)
+{
+  mpack_tokbuf_init(&reader->tokbuf);
+  reader->size = 0;
+  reader->state = MPACK_JSON_VALUE;
+  reader->sep = 0;
+  reader->scanned = 0;
+  reader->count = reader->depth = 0;
+  reader->quoted = 0;
+  reader->upos = reader->ulen = 0;
+}
+
+/* Transcodes one JSON value. Returns MPACK_OK once the value has been
+ * completely written, MPACK_EOF when more input or output space is needed and
+ * MPACK_ERROR for invalid JSON. A number is only complete once the character
+ * following it has been seen, so numbers at the top level must be followed by
+ * whitespace. */
+MPACK_API int mpack_json_read(mpack_json_reader_t *reader, const char **in,
+    size_t *inlen, char **out, size_t *outlen)
+{
+  int status;
+  mpack_token_t tok;
+
+  for (;;) {
+    mpack_json_frame_t *frame;
+
+    if (reader->tokbuf.plen) {
+      if (!*outlen) return MPACK_EOF;
+      if (mpack_write(&reader->tokbuf, out, outlen, &tok)) return MPACK_EOF;
+    }
+
+    if (reader->upos < reader->ulen) {
+      size_t n = reader->ulen - reader->upos;
+      if (n > *outlen) n = *outlen;
+      memcpy(*out, reader->utf8 + reader->upos, n);
+      *out += n;
+      *outlen -= n;
+      reader->upos += n;
+      if (reader->upos < reader->ulen) return MPACK_EOF;
+      reader->upos = reader->ulen = 0;
+    }
+
+    if (reader->state == MPACK_JSON_STR) {
+      if ((status = mpack_json_rstr(reader, in, inlen, out, outlen))) {
+        return status;
+      }
+      continue;
+    }
+
+    if (reader->size == (mpack_uint32_t)-1) {
+      reader->size = 0;
+      return MPACK_OK;
+    }
+
+    while (*inlen && (**in == ' ' || **in == '\t' || **in == '\n'
+          || **in == '\r')) {
+      (*in)++;
+      (*inlen)--;
+    }
+    if (!*inlen) return MPACK_EOF;
+
+    frame = reader->size ? reader->frames + reader->size - 1 : NULL;
+
+    if (frame && frame->pos == frame->length) {
+      if (**in != (frame->map ? '}' : ']')) return MPACK_ERROR;
+      (*in)++;
+      (*inlen)--;
+      reader->size--;
+      mpack_json_rdone(reader);
+      continue;
+    }
+
+    if (frame && frame->pos && !reader->sep) {
+      if (**in != (frame->map && frame->pos % 2 ? ':' : ',')) {
+        return MPACK_ERROR;
+      }
+      (*in)++;
+      (*inlen)--;
+      reader->sep = 1;
+      continue;
+    }
+
+    if (!*outlen) return MPACK_EOF;
+    if ((status = mpack_json_rvalue(reader, in, inlen, &tok))) return status;
+    reader->sep = 0;
+    reader->scanned = 0;
+    reader->count = reader->depth = 0;
+    reader->quoted = 0;
+    mpack_write(&reader->tokbuf, out, outlen, &tok);
+  }
+}
+
+/* Reads the token for the value at the start of the input. Input is only
+ * consumed if MPACK_OK is returned. */
+static int mpack_json_rvalue(mpack_json_reader_t *reader, const char **in,
+    size_t *inlen, mpack_token_t *tok)
+{
+  static const char *const literals[] = { "null", "false", "true" };
+  mpack_json_frame_t *frame = reader->size ?
+    reader->frames + reader->size - 1 : NULL;
+  int key = frame && frame->map && !(frame->pos % 2), status;
+  const char *p = *in;
+  size_t n = *inlen, i;
+
+  if (key && *p != '"') return MPACK_ERROR;
+
+  switch (*p) {
+    case '[':
+    case '{':
+      if ((status = mpack_json_count(reader, p, n))) return status;
+      if (reader->size == MPACK_MAX_OBJECT_DEPTH) return MPACK_ERROR;
+      frame = reader->frames + reader->size++;
+      frame->map = *p == '{';
+      frame->length = frame->map ? reader->count * 2 : reader->count;
+      frame->pos = 0;
+      *tok = frame->map ? mpack_pack_map(reader->count)
+        : mpack_pack_array(reader->count);
+      i = 1;
+      break;
+    case '"':
+      if ((status = mpack_json_strlen(reader, p, n))) return status;
+      *tok = mpack_pack_str(reader->count);
+      reader->state = MPACK_JSON_STR;
+      i = 1;
+      break;
+    case 'n':
+    case 'f':
+    case 't': {
+      const char *lit = literals[*p == 'n' ? 0 : *p == 'f' ? 1 : 2];
+      i = strlen(lit);
+      if (memcmp(p, lit, n < i ? n : i)) return MPACK_ERROR;
+      if (n < i) return MPACK_EOF;
+      *tok = *p == 'n' ? mpack_pack_nil() : mpack_pack_boolean(*p == 't');
+      mpack_json_rdone(reader);
+      break;
+    }
+    default:
+      for (i = 0; i < n && p[i] && strchr("0123456789+-.eE", p[i]); i++);
+      if (!i) return MPACK_ERROR;
+      if (i == n) return MPACK_EOF;
+      if ((status = mpack_json_number(p, i, tok))) return status;
+      mpack_json_rdone(reader);
+  }
+
+  *in += i;
+  *inlen -= i;
+  return MPACK_OK;
+}
+
+/* Copies the payload of a string whose length has already been written. */
+static int mpack_json_rstr(mpack_json_reader_t *reader, const char **in,
+    size_t *inlen, char **out, size_t *outlen)
+{
+  for (;;) {
+    size_t n, clean, used;
+    int status;
+
+    if (!*inlen || !*outlen) return MPACK_EOF;
+    n = *inlen < *outlen ? *inlen : *outlen;
+    clean = mpack_json_clean(*in, n);
+    memcpy(*out, *in, clean);
+    *out += clean;
+    *outlen -= clean;
+    *in += clean;
+    *inlen -= clean;
+    if (clean == n) continue;
+
+    if (**in == '"') {
+      (*in)++;
+      (*inlen)--;
+      reader->state = MPACK_JSON_VALUE;
+      mpack_json_rdone(reader);
+      return MPACK_OK;
+    }
+
+    if ((status = mpack_json_escape(*in, *inlen, reader->utf8, &reader->ulen,
+            &used))) {
+      return status;
+    }
+    *in += used;
+    *inlen -= used;
+    return MPACK_OK;
+  }
+}
+
+/* Called when a value has been read, the enclosing container is closed when
+ * its closing bracket is read. */
+static void mpack_json_rdone(mpack_json_reader_t *reader)
+{
+  if (reader->size) {
+    reader->frames[reader->size - 1].pos++;
+  } else {
+    reader->size = (mpack_uint32_t)-1;
+  }
+}
+
+/* Counts the items of the array or map at the start of `s`. */
+static int mpack_json_count(mpack_json_reader_t *reader, const char *s,
+    size_t n)
+{
+  size_t i = reader->scanned;
+
+  if (!i) {
+    /* empty containers have no commas either */
+    for (i = 1; i < n && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n'
+          || s[i] == '\r'); i++);
+    if (i == n) return MPACK_EOF;
+    if (s[i] == (s[0] == '{' ? '}' : ']')) {
+      reader->count = 0;
+      return MPACK_OK;
+    }
+    reader->count = 1;
+    reader->depth = 1;
+  }
+
+  while (i < n) {
+    i += mpack_json_skip(s + i, n - i, reader->quoted);
+    if (i == n) break;
+
+    if (reader->quoted) {
+      if (s[i] == '\\') {
+        if (i + 1 == n) break;
+        i++;
+      } else {
+        reader->quoted = 0;
+      }
+    } else if (s[i] == '"') {
+      reader->quoted = 1;
+    } else if (s[i] == ',') {
+      if (reader->depth == 1) reader->count++;
+    } else if (s[i] == '[' || s[i] == '{') {
+      reader->depth++;
+    } else if (!--reader->depth) {
+      return MPACK_OK;
+    }
+    i++;
+  }
+
+  reader->scanned = i;
+  return MPACK_EOF;
+}
+
+/* Computes the payload length of the string at the start of `s`. */
+static int mpack_json_strlen(mpack_json_reader_t *reader, const char *s,
+    size_t n)
+{
+  size_t i = reader->scanned ? reader->scanned : 1;
+
+  while (i < n) {
+    size_t clean = mpack_json_clean(s + i, n - i), len, used;
+    char utf8[4];
+    int status;
+
+    reader->count += (mpack_uint32_t)clean;
+    i += clean;
+    if (i == n) break;
+    if (s[i] == '"') return MPACK_OK;
+    status = mpack_json_escape(s + i, n - i, utf8, &len, &used);
+    if (status == MPACK_EOF) break;
+    if (status) return status;
+    reader->count += (mpack_uint32_t)len;
+    i += used;
+  }
+
+  reader->scanned = i;
+  return MPACK_EOF;
+}
+
+/* Decodes the escape sequence (or unescaped control character) at the start
+ * of `s` into utf-8. */
+static int mpack_json_escape(const char *s, size_t n, char *utf8,
+    size_t *len, size_t *used)
+{
+  mpack_uint32_t cp, low;
+
+  if (s[0] != '\\') return MPACK_ERROR;
+  if (n < 2) return MPACK_EOF;
+  *len = 1;
+  *used = 2;
+
+  switch (s[1]) {
+    case '"': case '\\': case '/': utf8[0] = s[1]; return MPACK_OK;
+    case 'b': utf8[0] = '\b'; return MPACK_OK;
+    case 'f': utf8[0] = '\f'; return MPACK_OK;
+    case 'n': utf8[0] = '\n'; return MPACK_OK;
+    case 'r': utf8[0] = '\r'; return MPACK_OK;
+    case 't': utf8[0] = '\t'; return MPACK_OK;
+    case 'u': break;
+    default: return MPACK_ERROR;
+  }
+
+  if (n < 6) return MPACK_EOF;
+  if (!mpack_json_hex4(s + 2, &cp)) return MPACK_ERROR;
+  *used = 6;
+
+  if (cp >= 0xdc00 && cp <= 0xdfff) return MPACK_ERROR;
+  if (cp >= 0xd800 && cp <= 0xdbff) {
+    /* surrogate pair */
+    if (n < 12) return MPACK_EOF;
+    if (s[6] != '\\' || s[7] != 'u' || !mpack_json_hex4(s + 8, &low)
+        || low < 0xdc00 || low > 0xdfff) {
+      return MPACK_ERROR;
+    }
+    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+    *used = 12;
+  }
+
+  if (cp < 0x80) {
+    utf8[0] = (char)cp;
+  } else if (cp < 0x800) {
+    utf8[0] = (char)(0xc0 | (cp >> 6));
+    utf8[1] = (char)(0x80 | (cp & 0x3f));
+    *len = 2;
+  } else if (cp < 0x10000) {
+    utf8[0] = (char)(0xe0 | (cp >> 12));
+    utf8[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    utf8[2] = (char)(0x80 | (cp & 0x3f));
+    *len = 3;
+  } else {
+    utf8[0] = (char)(0xf0 | (cp >> 18));
+    utf8[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+    utf8[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    utf8[3] = (char)(0x80 | (cp & 0x3f));
+    *len = 4;
+  }
+
+  return MPACK_OK;
+}
+
+static int mpack_json_hex4(const char *s, mpack_uint32_t *v)
+{
+  int i;
+  *v = 0;
+  for (i = 0; i < 4; i++) {
+    char c = s[i];
+    *v <<= 4;
+    if (c >= '0' && c <= '9') *v |= (mpack_uint32_t)(c - '0');
+    else if (c >= 'a' && c <= 'f') *v |= (mpack_uint32_t)(c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F') *v |= (mpack_uint32_t)(c - 'A' + 10);
+    else return 0;
+  }
+  return 1;
+}
+
+/* Significant digits passed to strtod. A double halfway point has at most 767
+ * of them, so the first 800 digits followed by a nonzero digit (if any of the
+ * dropped ones is nonzero) round the same way as the whole number. */
+#define MPACK_JSON_MAX_DIGITS 800
+/* exponents are clamped here, the result is already 0 or infinity */
+#define MPACK_JSON_MAX_EXP 99999L
+
+/* Appends the digits of `s` to `out`, skipping leading zeros and counting the
+ * digits past MPACK_JSON_MAX_DIGITS in `dropped`. Returns the number of digits
+ * appended. */
+static size_t mpack_json_significant(const char *s, size_t n, char *out,
+    size_t *kept, long *dropped, int *sticky)
+{
+  size_t i, len = 0;
+
+  for (i = 0; i < n; i++) {
+    if (!*kept && !len && s[i] == '0') continue;
+    if (*kept + len < MPACK_JSON_MAX_DIGITS) {
+      out[len++] = s[i];
+    } else {
+      (*dropped)++;
+      *sticky |= s[i] != '0';
+    }
+  }
+
+  *kept += len;
+  return len;
+}
+
+/* Numbers must follow the JSON grammar. Integers that fit in 64 bits are
+ * packed exactly, everything else is converted to a double and packed like
+ * mpack_pack_number would. The number is passed to strtod as an integer with
+ * an exponent, without a decimal point, so the locale doesn't matter. */
+static int mpack_json_number(const char *s, size_t n, mpack_token_t *tok)
+{
+  char buf[MPACK_JSON_MAX_DIGITS + 16], *end;
+  mpack_uint32_t limbs[4] = { 0, 0, 0, 0 };
+  size_t i, first, intpos, intlen, fracpos = 0, fraclen = 0, len, kept = 0;
+  long exp = 0, dropped = 0;
+  int neg = s[0] == '-', overflow = 0, expneg = 0, sticky = 0;
+  double v;
+
+  /* -?(0|[1-9][0-9]*) */
+  for (i = intpos = (size_t)neg; i < n && s[i] >= '0' && s[i] <= '9'; i++) {
+    /* multiply by 10 and add the digit, in 16-bit limbs */
+    mpack_uint32_t carry = (mpack_uint32_t)(s[i] - '0');
+    int l;
+    for (l = 3; l >= 0; l--) {
+      mpack_uint32_t t = limbs[l] * 10 + carry;
+      limbs[l] = t & 0xffff;
+      carry = t >> 16;
+    }
+    overflow |= carry != 0;
+  }
+  intlen = i - intpos;
+  if (!intlen || (s[intpos] == '0' && intlen > 1)) return MPACK_ERROR;
+
+  if (i == n && !overflow) {
+    tok->data.value.hi = (limbs[0] << 16) | limbs[1];
+    tok->data.value.lo = (limbs[2] << 16) | limbs[3];
+    tok->type = MPACK_TOKEN_UINT;
+    if (neg && (tok->data.value.hi || tok->data.value.lo)) {
+      if (tok->data.value.hi > 0x80000000 || (tok->data.value.hi == 0x80000000
+            && tok->data.value.lo)) {
+        goto floating;
+      }
+      tok->type = MPACK_TOKEN_SINT;
+      tok->data.value.lo = ~tok->data.value.lo + 1;
+      tok->data.value.hi = ~tok->data.value.hi + !tok->data.value.lo;
+    }
+    return MPACK_OK;
+  }
+
+  /* (\.[0-9]+)?([eE][+-]?[0-9]+)? */
+  if (i < n && s[i] == '.') {
+    for (fracpos = ++i; i < n && s[i] >= '0' && s[i] <= '9'; i++);
+    fraclen = i - fracpos;
+    if (!fraclen) return MPACK_ERROR;
+  }
+  if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+    if (++i < n && (s[i] == '+' || s[i] == '-')) expneg = s[i++] == '-';
+    for (first = i; i < n && s[i] >= '0' && s[i] <= '9'; i++) {
+      if (exp < MPACK_JSON_MAX_EXP * 10) exp = exp * 10 + (s[i] - '0');
+    }
+    if (i == first) return MPACK_ERROR;
+  }
+  if (i != n) return MPACK_ERROR;
+
+floating:
+  /* significant digits of the integer and fraction parts as an integer,
+   * scaled by 10^exp */
+  len = (size_t)neg;
+  buf[0] = '-';
+  len += mpack_json_significant(s + intpos, intlen, buf + len, &kept, &dropped,
+      &sticky);
+  len += mpack_json_significant(s + fracpos, fraclen, buf + len, &kept,
+      &dropped, &sticky);
+  if (!kept) buf[len++] = '0';
+  if (sticky) {
+    buf[len++] = '1';
+    dropped--;
+  }
+  exp = (expneg ? -exp : exp) + dropped - (long)fraclen;
+  if (exp > MPACK_JSON_MAX_EXP) exp = MPACK_JSON_MAX_EXP;
+  if (exp < -MPACK_JSON_MAX_EXP) exp = -MPACK_JSON_MAX_EXP;
+  sprintf(buf + len, "e%ld", exp);
+
+  v = strtod(buf, &end);
+  if (*end) return MPACK_ERROR;
+  *tok = v <= 9007199254740991. && v >= -9007199254740991. ?
+    mpack_pack_number(v) : mpack_pack_float(v);
+  return MPACK_OK;
+}
+
+/* Length of the prefix of `s` without quotes, brackets, braces or commas, or
+ * without quotes and backslashes if `quoted`. Checks 4 bytes at a time. */
+static size_t mpack_json_skip(const char *s, size_t n, int quoted)
+{
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    const unsigned char *b = (const unsigned char *)s + i;
+    mpack_uint32_t x = (mpack_uint32_t)b[0] | (mpack_uint32_t)b[1] << 8
+      | (mpack_uint32_t)b[2] << 16 | (mpack_uint32_t)b[3] << 24;
+    if (MPACK_JSON_HAS_ZERO(x ^ (MPACK_JSON_ONES * '"'))) break;
+    if (quoted) {
+      if (MPACK_JSON_HAS_ZERO(x ^ (MPACK_JSON_ONES * '\\'))) break;
+    } else {
+      /* '[' and '{' differ only in bit 5, as do ']' and '}' */
+      mpack_uint32_t y = x | (MPACK_JSON_ONES * 0x20);
+      if (MPACK_JSON_HAS_ZERO(y ^ (MPACK_JSON_ONES * '{'))
+          || MPACK_JSON_HAS_ZERO(y ^ (MPACK_JSON_ONES * '}'))
+          || MPACK_JSON_HAS_ZERO(x ^ (MPACK_JSON_ONES * ','))) {
+        break;
+      }
+    }
+  }
+
+  for (; i < n; i++) {
+    char c = s[i];
+    if (c == '"' || (quoted ? c == '\\' : (c == '[' || c == ']' || c == '{'
+            || c == '}' || c == ','))) {
+      break;
+    }
+  }
+
+  return i;
+}
@@ -0,0 +1,67 @@
+#ifndef MPACK_JSON_H
+#define MPACK_JSON_H
+
+#include "core.h"
+#include "conv.h"
+#include "object.h"
+
+/* room for the longest piece of text produced from a single token: a
+ * separator, a quoted number key or the opening of an ext object, followed by
+ * the closing of every open container */
+#define MPACK_JSON_PENDING (48 + MPACK_MAX_OBJECT_DEPTH)
+
+typedef struct mpack_json_frame_s {
+  /* number of items (keys and values for maps) and items written so far */
+  mpack_uint32_t length, pos;
+  int map;
+} mpack_json_frame_t;
+
+/* Streaming msgpack to JSON transcoder. Strings are written as JSON strings
+ * (assumed to be UTF-8), bin as base64 strings and ext as
+ * `{"type":<type>,"data":"<base64>"}`. Map keys that are numbers, booleans or
+ * nil are quoted, container keys are an error. NaN and infinity become
+ * null. */
+typedef struct mpack_json_s {
+  mpack_tokbuf_t tokbuf;
+  mpack_json_frame_t frames[MPACK_MAX_OBJECT_DEPTH];
+  mpack_uint32_t size;
+  int state, ext;
+  /* bytes of an incomplete base64 group */
+  unsigned char group[3];
+  mpack_uint32_t grouplen;
+  /* text that didn't fit in the output buffer yet */
+  char pending[MPACK_JSON_PENDING];
+  size_t ppos, plen;
+} mpack_json_t;
+
+/* Streaming JSON to msgpack transcoder. msgpack needs the length of arrays,
+ * maps and strings before their contents, so these are counted ahead in the
+ * input before anything is consumed. The caller must pass unconsumed input
+ * again (followed by new data) on the next call, and the count-ahead scan
+ * continues where it stopped. Integers use the smallest msgpack int that
+ * holds them. Other numbers are packed like mpack_pack_number, so "1.0" is an
+ * int, and use float 32 if that is exact. */
+typedef struct mpack_json_reader_s {
+  mpack_tokbuf_t tokbuf;
+  mpack_json_frame_t frames[MPACK_MAX_OBJECT_DEPTH];
+  mpack_uint32_t size;
+  /* set while a string payload is written, or after a separator was read */
+  int state, sep;
+  /* progress of the count-ahead scan, relative to the unconsumed input */
+  size_t scanned;
+  mpack_uint32_t count, depth;
+  int quoted;
+  /* utf-8 of an escape sequence that didn't fit in the output buffer yet */
+  char utf8[4];
+  size_t upos, ulen;
+} mpack_json_reader_t;
+
+MPACK_API void mpack_json_init(mpack_json_t *json) FUNUSED FNONULL;
+MPACK_API int mpack_json_transcode(mpack_json_t *json, const char **in,
+    size_t *inlen, char **out, size_t *outlen) FUNUSED FNONULL;
+MPACK_API void mpack_json_reader_init(mpack_json_reader_t *reader)
+  FUNUSED FNONULL;
+MPACK_API int mpack_json_read(mpack_json_reader_t *reader, const char **in,
+    size_t *inlen, char **out, size_t *outlen) FUNUSED FNONULL;
+
+#endif  /* MPACK_JSON_H */
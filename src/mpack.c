@@ -2,3 +2,13 @@
 #include "conv.c"
 #include "object.c"
 #include "rpc.c"
+#include "schema.c"
+#include "index.c"
+#include "arena.c"
+#include "dom.c"
+#include "template.c"
+#include "typed.c"
+#include "json.c"
+#include "cbor.c"
+#include "batch.c"
+#include "ring.c"
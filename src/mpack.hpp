@@ -0,0 +1,205 @@
+#ifndef MPACK_HPP
+#define MPACK_HPP
+
+/* C++17 helpers for encoding constant values at compile time. Keys, method
+ * names and message prefixes can be encoded once into `constexpr` byte arrays
+ * and appended with a single memcpy. The encodings follow the same width rules
+ * as mpack_write, so the output is byte-identical to writing the equivalent
+ * tokens. */
+
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include "mpack.h"
+}
+/* conv.h defines `bool` as `unsigned` when it isn't a macro, which is how the
+ * C library is compiled, don't leak it to the rest of the translation unit */
+#undef bool
+
+/* floats need the bits of the value in a constant expression, which C++17
+ * only offers through a compiler builtin */
+#if defined(__has_builtin)
+# if __has_builtin(__builtin_bit_cast)
+#  define MPACK_HPP_FLOAT 1
+# endif
+#endif
+
+namespace mpack {
+
+template <std::size_t N>
+struct bytes {
+  char data[N];
+
+  static constexpr std::size_t size() { return N; }
+};
+
+namespace detail {
+
+constexpr std::size_t uint_size(std::uint64_t v)
+{
+  return v > 0xffffffff ? 9 : v > 0xffff ? 5 : v > 0xff ? 3 : v > 0x7f ? 2 : 1;
+}
+
+constexpr std::size_t sint_size(std::int64_t v)
+{
+  return v >= 0 ? uint_size(static_cast<std::uint64_t>(v))
+    : v < -0x80000000LL ? 9 : v < -0x8000 ? 5 : v < -0x80 ? 3 : v < -0x20 ? 2
+    : 1;
+}
+
+constexpr std::size_t str_header_size(std::size_t len)
+{
+  return len < 0x20 ? 1 : len < 0x100 ? 2 : len < 0x10000 ? 3 : 5;
+}
+
+constexpr std::size_t container_size(std::uint32_t len)
+{
+  return len < 0x10 ? 1 : len < 0x10000 ? 3 : 5;
+}
+
+/* writes `v` big-endian in `n` bytes after the type code */
+template <std::size_t N>
+constexpr bytes<N> with_value(unsigned char code, std::uint64_t v)
+{
+  bytes<N> rv{};
+  rv.data[0] = static_cast<char>(code);
+  for (std::size_t i = 1; i < N; i++) {
+    rv.data[i] = static_cast<char>((v >> ((N - 1 - i) * 8)) & 0xff);
+  }
+  return rv;
+}
+
+template <std::size_t N>
+constexpr bytes<N> container(unsigned char fix, unsigned char code16,
+    std::uint32_t len)
+{
+  if (N == 1) {
+    bytes<N> rv{};
+    rv.data[0] = static_cast<char>(fix | len);
+    return rv;
+  }
+  return with_value<N>(static_cast<unsigned char>(code16 + (N == 5)), len);
+}
+
+}  // namespace detail
+
+template <std::uint64_t V>
+constexpr auto pack_uint()
+{
+  constexpr std::size_t n = detail::uint_size(V);
+  constexpr unsigned char codes[] = { 0, 0, 0xcc, 0xcd, 0, 0xce, 0, 0, 0, 0xcf };
+  if constexpr (n == 1) {
+    bytes<1> rv{};
+    rv.data[0] = static_cast<char>(V);
+    return rv;
+  } else {
+    return detail::with_value<n>(codes[n], V);
+  }
+}
+
+template <std::int64_t V>
+constexpr auto pack_sint()
+{
+  if constexpr (V >= 0) {
+    return pack_uint<static_cast<std::uint64_t>(V)>();
+  } else {
+    constexpr std::size_t n = detail::sint_size(V);
+    constexpr unsigned char codes[] = { 0, 0, 0xd0, 0xd1, 0, 0xd2, 0, 0, 0, 0xd3 };
+    if constexpr (n == 1) {
+      bytes<1> rv{};
+      rv.data[0] = static_cast<char>(V & 0xff);
+      return rv;
+    } else {
+      return detail::with_value<n>(codes[n], static_cast<std::uint64_t>(V));
+    }
+  }
+}
+
+constexpr bytes<1> pack_nil()
+{
+  return bytes<1>{{ static_cast<char>(0xc0) }};
+}
+
+template <bool V>
+constexpr bytes<1> pack_boolean()
+{
+  return bytes<1>{{ static_cast<char>(V ? 0xc3 : 0xc2) }};
+}
+
+#ifdef MPACK_HPP_FLOAT
+/* float 32, what mpack_write produces for mpack_pack_float of a value that is
+ * exact as a float */
+constexpr bytes<5> pack_float(float v)
+{
+  return detail::with_value<5>(0xca, __builtin_bit_cast(std::uint32_t, v));
+}
+
+/* float 64, what mpack_write produces for mpack_pack_double */
+constexpr bytes<9> pack_double(double v)
+{
+  return detail::with_value<9>(0xcb, __builtin_bit_cast(std::uint64_t, v));
+}
+#endif
+
+template <std::uint32_t N>
+constexpr auto pack_array()
+{
+  return detail::container<detail::container_size(N)>(0x90, 0xdc, N);
+}
+
+template <std::uint32_t N>
+constexpr auto pack_map()
+{
+  return detail::container<detail::container_size(N)>(0x80, 0xde, N);
+}
+
+/* str header followed by the payload of a string literal, without the
+ * terminating NUL */
+template <std::size_t N>
+constexpr auto pack_str(const char (&s)[N])
+{
+  constexpr std::size_t len = N - 1;
+  constexpr std::size_t hlen = detail::str_header_size(len);
+  bytes<hlen + len> rv{};
+  if (hlen == 1) {
+    rv.data[0] = static_cast<char>(0xa0 | len);
+  } else {
+    unsigned char code = hlen == 2 ? 0xd9 : hlen == 3 ? 0xda : 0xdb;
+    bytes<hlen> h = detail::with_value<hlen>(code, len);
+    for (std::size_t i = 0; i < hlen; i++) rv.data[i] = h.data[i];
+  }
+  for (std::size_t i = 0; i < len; i++) rv.data[hlen + i] = s[i];
+  return rv;
+}
+
+template <std::size_t... N>
+constexpr auto concat(const bytes<N> &...parts)
+{
+  bytes<(N + ... + 0)> rv{};
+  std::size_t pos = 0;
+  ((void)[&] {
+    for (std::size_t i = 0; i < parts.size(); i++) rv.data[pos++] = parts.data[i];
+  }(), ...);
+  return rv;
+}
+
+/* Appends a constant at a token boundary (not while mpack_write has a pending
+ * token). Constants are written whole or not at all: MPACK_EOF means there
+ * wasn't enough space and nothing was written. */
+template <std::size_t N>
+inline int write(char **buf, std::size_t *buflen, const bytes<N> &b)
+{
+  if (*buflen < N) return MPACK_EOF;
+  std::memcpy(*buf, b.data, N);
+  *buf += N;
+  *buflen -= N;
+  return MPACK_OK;
+}
+
+}  // namespace mpack
+
+#endif  // MPACK_HPP
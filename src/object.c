@@ -5,6 +5,16 @@
 static int mpack_parser_full(mpack_parser_t *w);
 static mpack_node_t *mpack_parser_push(mpack_parser_t *w);
 static mpack_node_t *mpack_parser_pop(mpack_parser_t *w);
+static int mpack_parser_at_key(mpack_parser_t *w, mpack_token_t tok);
+static int mpack_parse_key(mpack_parser_t *w, mpack_token_t tok,
+    const char *buf, size_t buflen, mpack_walk_cb enter_cb,
+    mpack_walk_cb exit_cb);
+static int mpack_parse_tok_all(mpack_parser_t *w, mpack_token_t tok,
+    mpack_walk_cb enter_cb, mpack_walk_cb exit_cb);
+
+#define NO_KEY 0xff
+#define KEY_AT(keys, stride, i) \
+  (*(const char *const *)(const void *)((const char *)(keys) + (stride) * (i)))
 
 MPACK_API void mpack_parser_init(mpack_parser_t *parser,
     mpack_uint32_t capacity)
@@ -14,6 +24,12 @@ MPACK_API void mpack_parser_init(mpack_parser_t *parser,
   parser->capacity = capacity ? capacity : MPACK_MAX_OBJECT_DEPTH;
   parser->size = 0;
   parser->exiting = 0;
+  parser->offset = 0;
+  parser->start = 0;
+  parser->keyset = NULL;
+  parser->key_id = MPACK_KEY_UNKNOWN;
+  parser->keylen = 0;
+  parser->keypos = 0;
   memset(parser->items, 0, sizeof(mpack_node_t) * (parser->capacity + 1));
   parser->items[0].pos = (size_t)-1;
   parser->status = 0;
@@ -74,19 +90,29 @@ MPACK_API int mpack_parse(mpack_parser_t *parser, const char **buf,
     mpack_tokbuf_t *tb = &parser->tokbuf;
     const char *buf_save = *buf;
     size_t buflen_save = *buflen;
+    /* a token split across calls starts with the bytes already buffered */
+    size_t start = parser->offset - (tb->plen ? tb->ppos : 0);
 
-    if ((status = mpack_read(tb, buf, buflen, &tok)) == MPACK_EOF) continue;
+    status = mpack_read(tb, buf, buflen, &tok);
+    parser->offset += buflen_save - *buflen;
+    if (status == MPACK_EOF) continue;
     else if (status == MPACK_ERROR) goto rollback;
 
-    do {
-      status = mpack_parse_tok(parser, tok, enter_cb, exit_cb);
-      MPACK_EXCEPTION_CHECK(parser);
-    } while (parser->exiting);
+    parser->start = start;
+
+    if (parser->keyset
+        && (parser->keylen || mpack_parser_at_key(parser, tok))) {
+      status = mpack_parse_key(parser, tok, *buf, *buflen, enter_cb, exit_cb);
+    } else {
+      status = mpack_parse_tok_all(parser, tok, enter_cb, exit_cb);
+    }
+    MPACK_EXCEPTION_CHECK(parser);
 
     if (status != MPACK_NOMEM) continue;
 
 rollback:
     /* restore buf/buflen so the next call will try to read the same token */
+    parser->offset -= buflen_save - *buflen;
     *buf = buf_save;
     *buflen = buflen_save;
     break;
@@ -106,8 +132,10 @@ MPACK_API int mpack_unparse(mpack_parser_t *parser, char **buf, size_t *buflen,
     mpack_token_t tok;
     mpack_tokbuf_t *tb = &parser->tokbuf;
 
-    if (!tb->plen)
+    if (!tb->plen) {
+      parser->start = parser->offset;
       parser->status = mpack_unparse_tok(parser, &tok, enter_cb, exit_cb);
+    }
 
     MPACK_EXCEPTION_CHECK(parser);
 
@@ -117,7 +145,9 @@ MPACK_API int mpack_unparse(mpack_parser_t *parser, char **buf, size_t *buflen,
       break;
 
     if (parser->exiting) {
+      size_t buflen_save = *buflen;
       write_status = mpack_write(tb, buf, buflen, &tok);
+      parser->offset += buflen_save - *buflen;
       status = write_status ? write_status : status;
     }
   }
@@ -125,6 +155,64 @@ MPACK_API int mpack_unparse(mpack_parser_t *parser, char **buf, size_t *buflen,
   return status;
 }
 
+MPACK_API int mpack_keyindex_init(unsigned char *first, unsigned char *next,
+    const char *const *keys, size_t stride, mpack_uint32_t count)
+{
+  mpack_uint32_t i;
+
+  memset(first, NO_KEY, MPACK_KEYSET_MAX_KEY + 1);
+
+  /* insert in reverse so each chain is in declaration order */
+  for (i = count; i--;) {
+    const char *k = KEY_AT(keys, stride, i);
+    size_t len = strlen(k);
+
+    if (len > MPACK_KEYSET_MAX_KEY
+        || mpack_keyindex_find(first, next, keys, stride, k,
+          (mpack_uint32_t)len) != MPACK_KEY_UNKNOWN) {
+      return MPACK_ERROR;
+    }
+
+    next[i] = first[len];
+    first[len] = (unsigned char)i;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_keyindex_find(const unsigned char *first,
+    const unsigned char *next, const char *const *keys, size_t stride,
+    const char *key, mpack_uint32_t len)
+{
+  unsigned i;
+
+  if (len > MPACK_KEYSET_MAX_KEY) return MPACK_KEY_UNKNOWN;
+
+  for (i = first[len]; i != NO_KEY; i = next[i]) {
+    const char *k = KEY_AT(keys, stride, i);
+    if (!len || (k[0] == key[0] && !memcmp(k, key, len))) return (int)i;
+  }
+
+  return MPACK_KEY_UNKNOWN;
+}
+
+MPACK_API int mpack_keyset_init(mpack_keyset_t *ks, const char *const *keys,
+    mpack_uint32_t count)
+{
+  if (count > MPACK_KEYSET_MAX_KEYS) return MPACK_ERROR;
+
+  ks->keys = keys;
+  ks->count = count;
+  return mpack_keyindex_init(ks->first, ks->next, keys, sizeof(*keys), count);
+}
+
+MPACK_API int mpack_keyset_lookup(const mpack_keyset_t *ks, const char *key,
+    mpack_uint32_t len)
+{
+  return mpack_keyindex_find(ks->first, ks->next, ks->keys, sizeof(*ks->keys),
+      key, len);
+}
+
 MPACK_API void mpack_parser_copy(mpack_parser_t *dst, mpack_parser_t *src)
 {
   mpack_uint32_t i;
@@ -154,6 +242,9 @@ static mpack_node_t *mpack_parser_push(mpack_parser_t *parser)
   top->data[1].p = NULL;
   top->pos = 0;
   top->key_visited = 0;
+  top->key_id = parser->key_id;
+  top->start = parser->start;
+  top->end = parser->start;
   /* increase size and invoke callback, passing parent node if any */
   parser->size++;
   return top;
@@ -165,7 +256,8 @@ static mpack_node_t *mpack_parser_pop(mpack_parser_t *parser)
   assert(parser->size);
   top = parser->items + parser->size;
 
-  if (top->tok.type > MPACK_TOKEN_CHUNK && top->pos < top->tok.length) {
+  if (top->tok.type > MPACK_TOKEN_CHUNK && top->tok.type != MPACK_TOKEN_RAW
+      && top->pos < top->tok.length) {
     /* continue processing children */
     return NULL;
   }
@@ -189,7 +281,72 @@ static mpack_node_t *mpack_parser_pop(mpack_parser_t *parser)
     }
   }
 
+  top->end = parser->offset;
   parser->size--;
   return top;
 }
 
+
+static int mpack_parser_at_key(mpack_parser_t *parser, mpack_token_t tok)
+{
+  mpack_node_t *top = parser->items + parser->size;
+  return tok.type == MPACK_TOKEN_STR && parser->size
+    && top->tok.type == MPACK_TOKEN_MAP && !top->key_visited;
+}
+
+static int mpack_parse_key(mpack_parser_t *parser, mpack_token_t tok,
+    const char *buf, size_t buflen, mpack_walk_cb enter_cb,
+    mpack_walk_cb exit_cb)
+{
+  int status;
+
+  if (parser->keylen) {
+    /* collecting a key that was split across buffers, `tok` is a chunk */
+    memcpy(parser->key + parser->keypos, tok.data.chunk_ptr, tok.length);
+    parser->keypos += tok.length;
+    if (parser->keypos < parser->keylen) return MPACK_EOF;
+    tok = mpack_pack_str(parser->keylen);
+    parser->key_id = mpack_keyset_lookup(parser->keyset, parser->key,
+        parser->keylen);
+    parser->keylen = 0;
+    parser->start = parser->keystart;
+    status = mpack_parse_tok_all(parser, tok, enter_cb, exit_cb);
+    parser->key_id = MPACK_KEY_UNKNOWN;
+    if (status != MPACK_EOF) return status;
+    /* deliver the whole key as one chunk */
+    tok.type = MPACK_TOKEN_CHUNK;
+    tok.data.chunk_ptr = parser->key;
+    parser->start = parser->offset - tok.length;
+    return mpack_parse_tok_all(parser, tok, enter_cb, exit_cb);
+  }
+
+  if (tok.length <= buflen) {
+    /* the key is in the buffer, look it up before consuming it */
+    parser->key_id = mpack_keyset_lookup(parser->keyset, buf, tok.length);
+  } else if (tok.length <= MPACK_KEYSET_MAX_KEY) {
+    /* the key and its chunk are pushed together once collected, so make sure
+     * there's room for both now */
+    if (parser->capacity - parser->size < 2) return MPACK_NOMEM;
+    parser->keylen = tok.length;
+    parser->keypos = 0;
+    parser->keystart = parser->start;
+    return MPACK_EOF;
+  }
+
+  status = mpack_parse_tok_all(parser, tok, enter_cb, exit_cb);
+  parser->key_id = MPACK_KEY_UNKNOWN;
+  return status;
+}
+
+static int mpack_parse_tok_all(mpack_parser_t *parser, mpack_token_t tok,
+    mpack_walk_cb enter_cb, mpack_walk_cb exit_cb)
+{
+  int status;
+
+  do {
+    status = mpack_parse_tok(parser, tok, enter_cb, exit_cb);
+    MPACK_EXCEPTION_CHECK(parser);
+  } while (parser->exiting);
+
+  return status;
+}
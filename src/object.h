@@ -8,6 +8,17 @@
 # define MPACK_MAX_OBJECT_DEPTH 32
 #endif
 
+#ifndef MPACK_KEYSET_MAX_KEYS
+# define MPACK_KEYSET_MAX_KEYS 64
+#endif
+
+#if MPACK_KEYSET_MAX_KEYS > 0xff
+# error "MPACK_KEYSET_MAX_KEYS must fit in an unsigned char"
+#endif
+
+/* longest key that can be interned, longer keys are always unknown */
+#define MPACK_KEYSET_MAX_KEY 31
+
 #define MPACK_PARENT_NODE(n) (((n) - 1)->pos == (size_t)-1 ? NULL : (n) - 1)
 
 #define MPACK_THROW(parser)           \
@@ -21,6 +32,10 @@ enum {
   MPACK_NOMEM = MPACK_ERROR + 1
 };
 
+/* key id of map keys not found in the parser keyset, and of every node that is
+ * not a map key */
+#define MPACK_KEY_UNKNOWN (-1)
+
 /* Storing integer in pointers in undefined behavior according to the C
  * standard. Define a union type to accomodate arbitrary user data associated
  * with nodes(and with requests in rpc.h). */
@@ -36,20 +51,58 @@ typedef struct mpack_node_s {
   size_t pos;
   /* flag to determine if the key was visited when traversing a map */
   int key_visited;
+  /* index of the key in the parser keyset if this is an interned map key,
+   * MPACK_KEY_UNKNOWN otherwise */
+  int key_id;
+  /* offsets of the first byte and one past the last byte of the node in the
+   * stream: input for mpack_parse and output for mpack_unparse. `end` is only
+   * valid in exit_cb. */
+  size_t start, end;
   /* allow 2 instances mpack_data_t per node. the reason is that when
    * serializing, the user may need to keep track of traversal state besides the
    * parent node reference */
   mpack_data_t data[2];
 } mpack_node_t;
 
-#define MPACK_PARSER_STRUCT(c)      \
-  struct {                          \
-    mpack_data_t data;              \
-    mpack_uint32_t size, capacity;  \
-    int status;                     \
-    int exiting;                    \
-    mpack_tokbuf_t tokbuf;          \
-    mpack_node_t items[c + 1];      \
+/* Length-bucketed key index shared by mpack_keyset_t and mpack_schema_t.
+ * `first` (MPACK_KEYSET_MAX_KEY + 1 entries) has the first key with a given
+ * length and `next` chains the remaining keys of the same length, 0xff
+ * terminates a chain. Key `i` is read at `stride * i` bytes from `keys`, so
+ * the index works over an array of strings as well as over the key member of
+ * an array of structs. */
+MPACK_API int mpack_keyindex_init(unsigned char *first, unsigned char *next,
+    const char *const *keys, size_t stride, mpack_uint32_t count)
+  FUNUSED FNONULL;
+MPACK_API int mpack_keyindex_find(const unsigned char *first,
+    const unsigned char *next, const char *const *keys, size_t stride,
+    const char *key, mpack_uint32_t len) FUNUSED FNONULL_ARG((1,2,3));
+
+/* Set of known map keys. When `parser->keyset` is set (after
+ * mpack_parser_init), mpack_parse delivers map keys to enter_cb with `key_id`
+ * set and their contents in a single CHUNK, even if the key was split across
+ * input buffers. */
+typedef struct mpack_keyset_s {
+  const char *const *keys;
+  mpack_uint32_t count;
+  /* see mpack_keyindex_init */
+  unsigned char first[MPACK_KEYSET_MAX_KEY + 1];
+  unsigned char next[MPACK_KEYSET_MAX_KEYS];
+} mpack_keyset_t;
+
+#define MPACK_PARSER_STRUCT(c)                  \
+  struct {                                      \
+    mpack_data_t data;                          \
+    mpack_uint32_t size, capacity;              \
+    int status;                                 \
+    int exiting;                                \
+    mpack_tokbuf_t tokbuf;                      \
+    size_t offset, start;                       \
+    const mpack_keyset_t *keyset;               \
+    int key_id;                                 \
+    mpack_uint32_t keylen, keypos;              \
+    size_t keystart;                            \
+    char key[MPACK_KEYSET_MAX_KEY];             \
+    mpack_node_t items[c + 1];                  \
   }
 
 /* Some compilers warn against anonymous structs:
@@ -80,6 +133,11 @@ MPACK_API int mpack_unparse(mpack_parser_t *parser, char **b, size_t *bl,
     mpack_walk_cb enter_cb, mpack_walk_cb exit_cb)
   FUNUSED FNONULL_ARG((1,2,3,4,5));
 
+MPACK_API int mpack_keyset_init(mpack_keyset_t *ks, const char *const *keys,
+    mpack_uint32_t count) FUNUSED FNONULL;
+MPACK_API int mpack_keyset_lookup(const mpack_keyset_t *ks, const char *key,
+    mpack_uint32_t len) FUNUSED FNONULL_ARG((1));
+
 MPACK_API void mpack_parser_copy(mpack_parser_t *d, mpack_parser_t *s)
   FUNUSED FNONULL;
 
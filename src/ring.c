@@ -0,0 +1,197 @@
+#include <string.h>
+
+#include "ring.h"
+
+#if MPACK_RING_ATOMIC
+# define RING_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define RING_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+# define RING_CAS(p, e, v) __atomic_compare_exchange_n((p), (e), (v), 1, \
+    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+# define RING_INC(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+# define RING_DEC(p) __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#else
+# define RING_LOAD(p) (*(p))
+# define RING_STORE(p, v) (*(p) = (v))
+# define RING_CAS(p, e, v) (*(p) == *(e) ? (*(p) = (v), 1) : (*(e) = *(p), 0))
+# define RING_INC(p) (++*(p))
+# define RING_DEC(p) (--*(p))
+#endif
+
+/* A header is 0 until its region is published, after which it holds the
+ * region size shifted left by two and the flags below. Released regions are
+ * zeroed by the consumer, so a header never holds stale bytes. */
+#define RING_READY 1
+#define RING_PAD 2
+#define RING_SLOT(ring, pos) \
+  ((size_t *)(void *)((ring)->buf + ((pos) & ((ring)->capacity - 1))))
+#define RING_ALIGN(size) \
+  (((size) + MPACK_RING_HEADER - 1) & ~(MPACK_RING_HEADER - 1))
+
+MPACK_API void mpack_ring_init(mpack_ring_t *ring, void *buf, size_t capacity)
+{
+  assert(capacity >= 2 * MPACK_RING_HEADER);
+  assert(!(capacity & (capacity - 1)));
+  assert(!((size_t)buf % MPACK_RING_HEADER));
+  ring->buf = buf;
+  ring->capacity = capacity;
+  ring->head = ring->tail = 0;
+  memset(buf, 0, capacity);
+}
+
+/* Reserves `size` bytes for one message, returning them in `region`. The
+ * region is contiguous: when it doesn't fit before the end of the buffer, the
+ * rest of the buffer is skipped. Returns MPACK_EOF when the ring doesn't have
+ * room until the consumer releases more regions and MPACK_NOMEM when the
+ * message is too big for the ring. */
+MPACK_API int mpack_ring_reserve(mpack_ring_t *ring, size_t size,
+    char **region)
+{
+  size_t need = MPACK_RING_HEADER + RING_ALIGN(size), head;
+
+  if (need > ring->capacity || need < size) return MPACK_NOMEM;
+
+  head = RING_LOAD(&ring->head);
+  for (;;) {
+    size_t tail = RING_LOAD(&ring->tail);
+    size_t end = ring->capacity - (head & (ring->capacity - 1));
+    size_t len = end < need ? end : need;
+
+    if (head + len - tail > ring->capacity) return MPACK_EOF;
+    if (!RING_CAS(&ring->head, &head, head + len)) continue;
+    if (len == need) break;
+
+    /* The skipped bytes are reserved and published as a region of their
+     * own, so the message can start at the beginning of the buffer once the
+     * consumer has gone past them, even if it doesn't fit right now. */
+    RING_STORE(RING_SLOT(ring, head),
+        ((end - MPACK_RING_HEADER) << 2) | RING_PAD | RING_READY);
+    head += end;
+  }
+
+  *region = (char *)RING_SLOT(ring, head) + MPACK_RING_HEADER;
+  return MPACK_OK;
+}
+
+/* Makes a region returned by mpack_ring_reserve visible to the consumer.
+ * `size` must be the size it was reserved with. */
+MPACK_API void mpack_ring_publish(mpack_ring_t *ring, char *region,
+    size_t size)
+{
+  size_t *slot = (size_t *)(void *)(region - MPACK_RING_HEADER);
+  (void)ring;
+  RING_STORE(slot, (size << 2) | RING_READY);
+}
+
+/* Returns the oldest published message, MPACK_EOF if there is none or it
+ * is still being written. Called by the consumer only, the message must be
+ * released before peeking at the next one. */
+MPACK_API int mpack_ring_peek(mpack_ring_t *ring, const char **region,
+    size_t *size)
+{
+  for (;;) {
+    size_t *slot = RING_SLOT(ring, ring->tail);
+    size_t header = RING_LOAD(slot);
+
+    if (!(header & RING_READY)) return MPACK_EOF;
+
+    if (header & RING_PAD) {
+      mpack_ring_release(ring);
+      continue;
+    }
+
+    *region = (const char *)(slot + 1);
+    *size = header >> 2;
+    return MPACK_OK;
+  }
+}
+
+/* Gives the space of the message returned by mpack_ring_peek back to the
+ * producers. */
+MPACK_API void mpack_ring_release(mpack_ring_t *ring)
+{
+  size_t *slot = RING_SLOT(ring, ring->tail);
+  size_t len = MPACK_RING_HEADER + RING_ALIGN(*slot >> 2);
+
+  memset(slot, 0, len);
+  RING_STORE(&ring->tail, ring->tail + len);
+}
+
+MPACK_API void mpack_pipe_init(mpack_pipe_t *pipe,
+    mpack_pipe_batch_t *batches, size_t capacity)
+{
+  assert(capacity && !(capacity & (capacity - 1)));
+  pipe->batches = batches;
+  pipe->capacity = capacity;
+  pipe->head = pipe->tail = 0;
+}
+
+MPACK_API void mpack_pipe_block_init(mpack_pipe_block_t *block,
+    mpack_pipe_block_cb recycle, void *data)
+{
+  block->refs = 1;  /* held by the decoder */
+  block->recycle = recycle;
+  block->data = data;
+}
+
+MPACK_API void mpack_pipe_block_unref(mpack_pipe_block_t *block)
+{
+  if (!RING_DEC(&block->refs)) block->recycle(block);
+}
+
+/* Reads the tokens of `block` (whose unread bytes are `buf`) into batches
+ * and pushes them. The last batch of the block is pushed even if it is not
+ * full, and a token split across blocks is kept in `tokbuf` and pushed with
+ * the next block. Returns MPACK_OK when the block has been read, MPACK_EOF
+ * when the queue is full (call again once the consumer caught up) and
+ * MPACK_ERROR for invalid input. Called by the decoder only. */
+MPACK_API int mpack_pipe_decode(mpack_pipe_t *pipe, mpack_tokbuf_t *tokbuf,
+    mpack_pipe_block_t *block, const char **buf, size_t *buflen)
+{
+  while (*buflen) {
+    size_t head = pipe->head;
+    mpack_pipe_batch_t *batch;
+
+    if (head - RING_LOAD(&pipe->tail) == pipe->capacity) return MPACK_EOF;
+
+    batch = pipe->batches + (head & (pipe->capacity - 1));
+    batch->count = 0;
+    batch->block = block;
+    while (*buflen && batch->count < MPACK_PIPE_BATCH_SIZE) {
+      int status = mpack_read(tokbuf, buf, buflen,
+          batch->tokens + batch->count);
+      /* MPACK_EOF: the rest of the block was buffered by `tokbuf` */
+      if (status == MPACK_EOF) break;
+      if (status) return status;
+      batch->count++;
+    }
+
+    if (!batch->count) break;
+    RING_INC(&block->refs);
+    RING_STORE(&pipe->head, head + 1);
+  }
+
+  return MPACK_OK;
+}
+
+/* Returns the oldest batch pushed by the decoder, NULL if there is none.
+ * Called by the consumer only, the batch must be released before peeking at
+ * the next one. */
+MPACK_API mpack_pipe_batch_t *mpack_pipe_peek(mpack_pipe_t *pipe)
+{
+  size_t tail = pipe->tail;
+
+  if (tail == RING_LOAD(&pipe->head)) return NULL;
+  return pipe->batches + (tail & (pipe->capacity - 1));
+}
+
+/* Gives the batch returned by mpack_pipe_peek back to the decoder and drops
+ * its reference to the input block. */
+MPACK_API void mpack_pipe_release(mpack_pipe_t *pipe)
+{
+  size_t tail = pipe->tail;
+  mpack_pipe_block_t *block =
+    pipe->batches[tail & (pipe->capacity - 1)].block;
+
+  RING_STORE(&pipe->tail, tail + 1);
+  mpack_pipe_block_unref(block);
+}
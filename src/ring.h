@@ -0,0 +1,92 @@
+#ifndef MPACK_RING_H
+#define MPACK_RING_H
+
+#include "core.h"
+#include "object.h"
+
+/* Reservations are lock-free when the compiler has the __atomic builtins
+ * (gcc >= 4.7, clang). Otherwise the ring can only be used from one thread. */
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+# define MPACK_RING_ATOMIC 1
+#else
+# define MPACK_RING_ATOMIC 0
+#endif
+
+/* each region is preceded by a header of this size, and regions are padded
+ * to a multiple of it */
+#define MPACK_RING_HEADER sizeof(size_t)
+
+/* Output ring shared by many producers and drained by a single consumer.
+ * A producer reserves room for a whole message (see mpack_token_size),
+ * writes it with mpack_write and publishes it. Regions can be published in
+ * any order, but the consumer gets them in the order they were reserved, so
+ * messages are never interleaved. `head` and `tail` are byte counters that
+ * only grow, masked by `capacity - 1` to index the buffer. */
+typedef struct mpack_ring_s {
+  char *buf;
+  size_t capacity;
+  size_t head;  /* end of the last reservation */
+  size_t tail;  /* start of the oldest region not released by the consumer */
+} mpack_ring_t;
+
+/* `buf` must be aligned for size_t and `capacity` a power of two */
+MPACK_API void mpack_ring_init(mpack_ring_t *ring, void *buf,
+    size_t capacity) FUNUSED FNONULL;
+MPACK_API int mpack_ring_reserve(mpack_ring_t *ring, size_t size,
+    char **region) FUNUSED FNONULL;
+MPACK_API void mpack_ring_publish(mpack_ring_t *ring, char *region,
+    size_t size) FUNUSED FNONULL;
+MPACK_API int mpack_ring_peek(mpack_ring_t *ring, const char **region,
+    size_t *size) FUNUSED FNONULL;
+MPACK_API void mpack_ring_release(mpack_ring_t *ring) FUNUSED FNONULL;
+
+#ifndef MPACK_PIPE_BATCH_SIZE
+# define MPACK_PIPE_BATCH_SIZE 64
+#endif
+
+typedef struct mpack_pipe_block_s mpack_pipe_block_t;
+typedef void (*mpack_pipe_block_cb)(mpack_pipe_block_t *block);
+
+/* Input block whose bytes are referenced by the chunk tokens of the batches
+ * decoded from it. It is held by the decoder until it calls
+ * mpack_pipe_block_unref and by each batch until it is released, after
+ * which `recycle` is called from whichever thread dropped the last
+ * reference. */
+struct mpack_pipe_block_s {
+  size_t refs;
+  mpack_pipe_block_cb recycle;
+  void *data;  /* user data */
+};
+
+typedef struct mpack_pipe_batch_s {
+  mpack_token_t tokens[MPACK_PIPE_BATCH_SIZE];
+  mpack_uint32_t count;
+  mpack_pipe_block_t *block;
+} mpack_pipe_batch_t;
+
+/* Queue of token batches between one decoder thread and one consumer
+ * thread. Batches are filled in place, so tokens are copied once, and they
+ * never span two input blocks. `head` and `tail` count batches like the
+ * byte counters of mpack_ring_t. */
+typedef struct mpack_pipe_s {
+  mpack_pipe_batch_t *batches;
+  size_t capacity;
+  size_t head;  /* batches pushed by the decoder */
+  size_t tail;  /* batches released by the consumer */
+} mpack_pipe_t;
+
+/* `capacity` must be a power of two */
+MPACK_API void mpack_pipe_init(mpack_pipe_t *pipe,
+    mpack_pipe_batch_t *batches, size_t capacity) FUNUSED FNONULL;
+MPACK_API void mpack_pipe_block_init(mpack_pipe_block_t *block,
+    mpack_pipe_block_cb recycle, void *data) FUNUSED FNONULL_ARG((1,2));
+MPACK_API void mpack_pipe_block_unref(mpack_pipe_block_t *block)
+  FUNUSED FNONULL;
+MPACK_API int mpack_pipe_decode(mpack_pipe_t *pipe, mpack_tokbuf_t *tokbuf,
+    mpack_pipe_block_t *block, const char **buf, size_t *buflen)
+  FUNUSED FNONULL;
+MPACK_API mpack_pipe_batch_t *mpack_pipe_peek(mpack_pipe_t *pipe)
+  FUNUSED FNONULL;
+MPACK_API void mpack_pipe_release(mpack_pipe_t *pipe) FUNUSED FNONULL;
+
+#endif  /* MPACK_RING_H */
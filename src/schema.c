@@ -0,0 +1,476 @@
+#include <string.h>
+
+#include "schema.h"
+
+static int mpack_schema_key(mpack_schema_decoder_t *d, mpack_token_t tok);
+static int mpack_schema_value(mpack_schema_decoder_t *d, mpack_token_t tok);
+static int mpack_schema_push(mpack_schema_decoder_t *d,
+    const mpack_schema_t *s, char *base, mpack_uint32_t length);
+static int mpack_schema_next(mpack_schema_decoder_t *d);
+static int mpack_schema_sint(mpack_token_t tok, mpack_sintmax_t *out,
+    int narrow);
+static int mpack_schema_wpush(mpack_schema_encoder_t *e,
+    const mpack_schema_t *s, const char *base);
+static int mpack_schema_wnext(mpack_schema_encoder_t *e);
+static mpack_token_t mpack_schema_wvalue(const mpack_field_t *field,
+    const char *src, mpack_uint32_t *length);
+
+MPACK_API int mpack_schema_init(mpack_schema_t *schema,
+    const mpack_field_t *fields, mpack_uint32_t count)
+{
+  mpack_uint32_t i;
+
+  if (count > MPACK_SCHEMA_MAX_FIELDS) return MPACK_ERROR;
+
+  schema->fields = fields;
+  schema->count = count;
+
+  for (i = 0; i < count; i++) {
+    const mpack_field_t *field = fields + i;
+    if ((field->type == MPACK_FIELD_MAP && !field->schema)
+        || (field->type == MPACK_FIELD_STR && !field->size)) {
+      return MPACK_ERROR;
+    }
+    /* truncation is harmless, mpack_keyindex_init rejects long keys */
+    schema->keylen[i] = (unsigned char)strlen(field->key);
+  }
+
+  return mpack_keyindex_init(schema->first, schema->next, &fields->key,
+      sizeof(*fields), count);
+}
+
+MPACK_API const mpack_field_t *mpack_schema_lookup(
+    const mpack_schema_t *schema, const char *key, mpack_uint32_t len)
+{
+  int i = mpack_keyindex_find(schema->first, schema->next,
+      &schema->fields->key, sizeof(*schema->fields), key, len);
+  return i == MPACK_KEY_UNKNOWN ? NULL : schema->fields + i;
+}
+
+MPACK_API int mpack_schema_store(const mpack_field_t *field, void *base,
+    mpack_token_t tok)
+{
+  char *dst = (char *)base + field->offset;
+  mpack_sintmax_t sint;
+
+  if (tok.type == MPACK_TOKEN_NIL) return MPACK_OK;
+
+  switch (field->type) {
+    case MPACK_FIELD_BOOLEAN:
+      if (tok.type != MPACK_TOKEN_BOOLEAN) return MPACK_ERROR;
+      *(int *)dst = mpack_unpack_boolean(tok) ? 1 : 0;
+      break;
+    case MPACK_FIELD_UINT:
+      if (tok.type != MPACK_TOKEN_UINT
+          || (sizeof(mpack_uintmax_t) < 8 && tok.data.value.hi)) {
+        return MPACK_ERROR;
+      }
+      *(mpack_uintmax_t *)dst = mpack_unpack_uint(tok);
+      break;
+    case MPACK_FIELD_UINT32:
+      if (tok.type != MPACK_TOKEN_UINT || tok.data.value.hi) {
+        return MPACK_ERROR;
+      }
+      *(mpack_uint32_t *)dst = tok.data.value.lo;
+      break;
+    case MPACK_FIELD_SINT:
+      if (mpack_schema_sint(tok, &sint, 0)) return MPACK_ERROR;
+      *(mpack_sintmax_t *)dst = sint;
+      break;
+    case MPACK_FIELD_SINT32:
+      if (mpack_schema_sint(tok, &sint, 1)) return MPACK_ERROR;
+      *(mpack_sint32_t *)dst = (mpack_sint32_t)sint;
+      break;
+    case MPACK_FIELD_FLOAT:
+    case MPACK_FIELD_DOUBLE:
+      if (tok.type < MPACK_TOKEN_UINT || tok.type > MPACK_TOKEN_FLOAT) {
+        return MPACK_ERROR;
+      }
+      if (field->type == MPACK_FIELD_FLOAT) {
+        *(float *)dst = (float)mpack_unpack_number(tok);
+      } else {
+        *(double *)dst = mpack_unpack_number(tok);
+      }
+      break;
+    default:
+      /* strings and maps span multiple tokens */
+      return MPACK_ERROR;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API void mpack_schema_decoder_init(mpack_schema_decoder_t *decoder,
+    const mpack_schema_t *schema, void *out)
+{
+  mpack_tokbuf_init(&decoder->tokbuf);
+  decoder->frames[0].schema = schema;
+  decoder->frames[0].base = out;
+  decoder->frames[0].remaining = 0;
+  decoder->size = 0;
+  decoder->state = MPACK_SCHEMA_HEADER;
+  decoder->field = NULL;
+  decoder->pos = decoder->length = decoder->skip = 0;
+}
+
+MPACK_API int mpack_schema_decode(mpack_schema_decoder_t *decoder,
+    const char **buf, size_t *buflen)
+{
+  while (*buflen && decoder->state < MPACK_SCHEMA_DONE) {
+    int status;
+    mpack_token_t tok;
+
+    if (decoder->state == MPACK_SCHEMA_SKIP) {
+      status = mpack_skip(&decoder->tokbuf, buf, buflen, &decoder->skip);
+      if (status == MPACK_EOF) break;
+      if (status || mpack_schema_next(decoder)) goto fail;
+      continue;
+    }
+
+    if ((status = mpack_read(&decoder->tokbuf, buf, buflen, &tok))) {
+      if (status == MPACK_EOF) break;
+      goto fail;
+    }
+
+    switch (decoder->state) {
+      case MPACK_SCHEMA_HEADER:
+        if (tok.type != MPACK_TOKEN_MAP) goto fail;
+        status = mpack_schema_push(decoder, decoder->frames[0].schema,
+            decoder->frames[0].base, tok.length);
+        break;
+      case MPACK_SCHEMA_KEY:
+        status = mpack_schema_key(decoder, tok);
+        break;
+      case MPACK_SCHEMA_KEY_CHUNK: {
+        const mpack_schema_t *schema = decoder->frames[decoder->size - 1].schema;
+        const char *key = tok.data.chunk_ptr;
+        if (decoder->pos || tok.length < decoder->length) {
+          /* key was split across buffers, accumulate it */
+          memcpy(decoder->key + decoder->pos, tok.data.chunk_ptr, tok.length);
+          decoder->pos += tok.length;
+          if (decoder->pos < decoder->length) break;
+          key = decoder->key;
+        }
+        decoder->field = mpack_schema_lookup(schema, key, decoder->length);
+        if (decoder->field) {
+          decoder->state = MPACK_SCHEMA_VALUE;
+        } else {
+          decoder->skip = 1;
+          decoder->state = MPACK_SCHEMA_SKIP;
+        }
+        break;
+      }
+      case MPACK_SCHEMA_VALUE:
+        status = mpack_schema_value(decoder, tok);
+        break;
+      case MPACK_SCHEMA_STR_CHUNK: {
+        char *str = decoder->frames[decoder->size - 1].base +
+          decoder->field->offset;
+        memcpy(str + decoder->pos, tok.data.chunk_ptr, tok.length);
+        decoder->pos += tok.length;
+        if (decoder->pos == decoder->length) {
+          str[decoder->pos] = 0;
+          status = mpack_schema_next(decoder);
+        }
+        break;
+      }
+      default:
+        goto fail;
+    }
+
+    if (status) goto fail;
+  }
+
+  if (decoder->state == MPACK_SCHEMA_FAILED) return MPACK_ERROR;
+  return decoder->state == MPACK_SCHEMA_DONE ? MPACK_OK : MPACK_EOF;
+
+fail:
+  decoder->state = MPACK_SCHEMA_FAILED;
+  return MPACK_ERROR;
+}
+
+MPACK_API void mpack_schema_encoder_init(mpack_schema_encoder_t *encoder,
+    const mpack_schema_t *schema, const void *in)
+{
+  mpack_tokbuf_init(&encoder->tokbuf);
+  encoder->frames[0].schema = schema;
+  encoder->frames[0].base = in;
+  encoder->frames[0].remaining = 0;
+  encoder->size = 0;
+  encoder->state = MPACK_SCHEMA_HEADER;
+  encoder->length = 0;
+}
+
+MPACK_API int mpack_schema_encode(mpack_schema_encoder_t *encoder,
+    char **buf, size_t *buflen)
+{
+  while (*buflen && encoder->state < MPACK_SCHEMA_DONE) {
+    int status;
+    mpack_token_t tok;
+    const mpack_schema_t *schema = NULL;
+    const mpack_field_t *field = NULL;
+    const char *src = NULL;
+    mpack_uint32_t idx = 0;
+
+    if (encoder->size) {
+      schema = encoder->frames[encoder->size - 1].schema;
+      idx = schema->count - encoder->frames[encoder->size - 1].remaining;
+      field = schema->fields + idx;
+      src = encoder->frames[encoder->size - 1].base + field->offset;
+    }
+
+    if (!encoder->tokbuf.plen) {
+      switch (encoder->state) {
+        case MPACK_SCHEMA_HEADER:
+          tok = mpack_pack_map(encoder->frames[0].schema->count);
+          break;
+        case MPACK_SCHEMA_KEY:
+          if (*buflen > schema->keylen[idx]) {
+            /* enough room for the whole key, write it in place */
+            **buf = (char)(0xa0 | schema->keylen[idx]);
+            memcpy(*buf + 1, field->key, schema->keylen[idx]);
+            *buf += schema->keylen[idx] + 1;
+            *buflen -= (size_t)schema->keylen[idx] + 1;
+            encoder->state = MPACK_SCHEMA_VALUE;
+            continue;
+          }
+          tok = mpack_pack_str(schema->keylen[idx]);
+          break;
+        case MPACK_SCHEMA_KEY_CHUNK:
+          tok = mpack_pack_chunk(field->key, schema->keylen[idx]);
+          break;
+        case MPACK_SCHEMA_VALUE:
+          tok = mpack_schema_wvalue(field, src, &encoder->length);
+          break;
+        default:
+          assert(encoder->state == MPACK_SCHEMA_STR_CHUNK);
+          tok = mpack_pack_chunk(src, encoder->length);
+          break;
+      }
+    }
+
+    /* when a token is pending, mpack_write resumes it and ignores `tok` */
+    if ((status = mpack_write(&encoder->tokbuf, buf, buflen, &tok))) {
+      if (status == MPACK_EOF) break;
+      goto fail;
+    }
+
+    switch (encoder->state) {
+      case MPACK_SCHEMA_HEADER:
+        status = mpack_schema_wpush(encoder, encoder->frames[0].schema,
+            encoder->frames[0].base);
+        break;
+      case MPACK_SCHEMA_KEY:
+        encoder->state = schema->keylen[idx] ?
+          MPACK_SCHEMA_KEY_CHUNK : MPACK_SCHEMA_VALUE;
+        break;
+      case MPACK_SCHEMA_KEY_CHUNK:
+        encoder->state = MPACK_SCHEMA_VALUE;
+        break;
+      case MPACK_SCHEMA_VALUE:
+        if (field->type == MPACK_FIELD_MAP) {
+          status = mpack_schema_wpush(encoder, field->schema, src);
+        } else if (field->type == MPACK_FIELD_STR && encoder->length) {
+          encoder->state = MPACK_SCHEMA_STR_CHUNK;
+        } else {
+          status = mpack_schema_wnext(encoder);
+        }
+        break;
+      default:
+        status = mpack_schema_wnext(encoder);
+        break;
+    }
+
+    if (status) goto fail;
+  }
+
+  if (encoder->state == MPACK_SCHEMA_FAILED) return MPACK_ERROR;
+  return encoder->state == MPACK_SCHEMA_DONE ? MPACK_OK : MPACK_EOF;
+
+fail:
+  encoder->state = MPACK_SCHEMA_FAILED;
+  return MPACK_ERROR;
+}
+
+static int mpack_schema_key(mpack_schema_decoder_t *decoder,
+    mpack_token_t tok)
+{
+  if (tok.type == MPACK_TOKEN_STR && tok.length <= MPACK_SCHEMA_MAX_KEY) {
+    decoder->length = tok.length;
+    decoder->pos = 0;
+    decoder->state = MPACK_SCHEMA_KEY_CHUNK;
+
+    if (!tok.length) {
+      const mpack_schema_t *schema = decoder->frames[decoder->size - 1].schema;
+      decoder->field = mpack_schema_lookup(schema, decoder->key, 0);
+      if (decoder->field) {
+        decoder->state = MPACK_SCHEMA_VALUE;
+        return MPACK_OK;
+      }
+    } else {
+      return MPACK_OK;
+    }
+  }
+
+  /* the key can't match any field, skip the remainder of the key and the
+   * value associated with it */
+  if (tok.type == MPACK_TOKEN_ARRAY) {
+    decoder->skip = tok.length;
+  } else if (tok.type == MPACK_TOKEN_MAP) {
+    if (tok.length > 0x7fffffff) return MPACK_ERROR;
+    decoder->skip = tok.length * 2;
+  } else {
+    decoder->skip = tok.type > MPACK_TOKEN_MAP && tok.length ? 1 : 0;
+  }
+
+  if (decoder->skip == 0xffffffff) return MPACK_ERROR;
+  decoder->skip++;
+  decoder->state = MPACK_SCHEMA_SKIP;
+  return MPACK_OK;
+}
+
+static int mpack_schema_value(mpack_schema_decoder_t *decoder,
+    mpack_token_t tok)
+{
+  const mpack_field_t *field = decoder->field;
+  char *dst = decoder->frames[decoder->size - 1].base + field->offset;
+
+  if (tok.type == MPACK_TOKEN_NIL || field->type < MPACK_FIELD_STR) {
+    /* nil leaves the field untouched */
+    if (mpack_schema_store(field, decoder->frames[decoder->size - 1].base,
+          tok)) {
+      return MPACK_ERROR;
+    }
+  } else if (field->type == MPACK_FIELD_STR) {
+    /* the string must fit with the terminating NUL */
+    if (tok.type != MPACK_TOKEN_STR || tok.length >= field->size) {
+      return MPACK_ERROR;
+    }
+    if (tok.length) {
+      decoder->length = tok.length;
+      decoder->pos = 0;
+      decoder->state = MPACK_SCHEMA_STR_CHUNK;
+      return MPACK_OK;
+    }
+    dst[0] = 0;
+  } else {
+    if (tok.type != MPACK_TOKEN_MAP) return MPACK_ERROR;
+    return mpack_schema_push(decoder, field->schema, dst, tok.length);
+  }
+
+  return mpack_schema_next(decoder);
+}
+
+static int mpack_schema_push(mpack_schema_decoder_t *decoder,
+    const mpack_schema_t *schema, char *base, mpack_uint32_t length)
+{
+  mpack_schema_frame_t *frame;
+
+  if (decoder->size == MPACK_MAX_OBJECT_DEPTH) return MPACK_ERROR;
+
+  frame = decoder->frames + decoder->size++;
+  frame->schema = schema;
+  frame->base = base;
+  frame->remaining = length + 1;
+  /* nothing was consumed yet, mpack_schema_next will account for the extra
+   * pair added above */
+  return mpack_schema_next(decoder);
+}
+
+static int mpack_schema_next(mpack_schema_decoder_t *decoder)
+{
+  /* a value was completed: account for it in the enclosing map and pop every
+   * map that became complete as a result */
+  while (!--decoder->frames[decoder->size - 1].remaining) {
+    if (!--decoder->size) {
+      decoder->state = MPACK_SCHEMA_DONE;
+      return MPACK_OK;
+    }
+  }
+
+  decoder->state = MPACK_SCHEMA_KEY;
+  return MPACK_OK;
+}
+
+static int mpack_schema_sint(mpack_token_t tok, mpack_sintmax_t *out,
+    int narrow)
+{
+  mpack_uint32_t hi = tok.data.value.hi;
+  mpack_uint32_t lo = tok.data.value.lo;
+  int wide = !narrow && sizeof(mpack_sintmax_t) >= 8;
+
+  if (tok.type == MPACK_TOKEN_UINT) {
+    if (wide ? hi > 0x7fffffff : (hi || lo > 0x7fffffff)) return MPACK_ERROR;
+    *out = (mpack_sintmax_t)mpack_unpack_uint(tok);
+    return MPACK_OK;
+  }
+
+  if (tok.type != MPACK_TOKEN_SINT) return MPACK_ERROR;
+
+  if (tok.length == 8 && !wide) {
+    /* only accept int 64 values that are in the 32-bit range */
+    if (hi != 0xffffffff || lo < 0x80000000) return MPACK_ERROR;
+    tok.length = 4;
+    tok.data.value.hi = 0;
+  }
+
+  *out = mpack_unpack_sint(tok);
+  return MPACK_OK;
+}
+
+static int mpack_schema_wpush(mpack_schema_encoder_t *encoder,
+    const mpack_schema_t *schema, const char *base)
+{
+  if (encoder->size == MPACK_MAX_OBJECT_DEPTH) return MPACK_ERROR;
+
+  encoder->frames[encoder->size].schema = schema;
+  encoder->frames[encoder->size].base = base;
+  encoder->frames[encoder->size].remaining = schema->count + 1;
+  encoder->size++;
+  return mpack_schema_wnext(encoder);
+}
+
+static int mpack_schema_wnext(mpack_schema_encoder_t *encoder)
+{
+  while (!--encoder->frames[encoder->size - 1].remaining) {
+    if (!--encoder->size) {
+      encoder->state = MPACK_SCHEMA_DONE;
+      return MPACK_OK;
+    }
+  }
+
+  encoder->state = MPACK_SCHEMA_KEY;
+  return MPACK_OK;
+}
+
+static mpack_token_t mpack_schema_wvalue(const mpack_field_t *field,
+    const char *src, mpack_uint32_t *length)
+{
+  mpack_uint32_t len = 0;
+
+  switch (field->type) {
+    case MPACK_FIELD_BOOLEAN:
+      return mpack_pack_boolean(*(const int *)src ? 1 : 0);
+    case MPACK_FIELD_UINT:
+      return mpack_pack_uint(*(const mpack_uintmax_t *)src);
+    case MPACK_FIELD_SINT:
+      return mpack_pack_sint(*(const mpack_sintmax_t *)src);
+    case MPACK_FIELD_UINT32:
+      return mpack_pack_uint(*(const mpack_uint32_t *)src);
+    case MPACK_FIELD_SINT32:
+      return mpack_pack_sint(*(const mpack_sint32_t *)src);
+    case MPACK_FIELD_FLOAT:
+      return mpack_pack_float((double)*(const float *)src);
+    case MPACK_FIELD_DOUBLE:
+      return mpack_pack_float(*(const double *)src);
+    case MPACK_FIELD_STR:
+      /* a string that isn't NUL-terminated is cut to `size - 1` bytes, the
+       * most the decoder accepts for the field */
+      while (len + 1 < field->size && src[len]) len++;
+      *length = len;
+      return mpack_pack_str(len);
+    default:
+      assert(field->type == MPACK_FIELD_MAP);
+      return mpack_pack_map(field->schema->count);
+  }
+}
@@ -0,0 +1,118 @@
+#ifndef MPACK_SCHEMA_H
+#define MPACK_SCHEMA_H
+
+#include "core.h"
+#include "conv.h"
+#include "object.h"
+
+#ifndef MPACK_SCHEMA_MAX_FIELDS
+# define MPACK_SCHEMA_MAX_FIELDS 64
+#endif
+
+#if MPACK_SCHEMA_MAX_FIELDS > 0xff
+# error "MPACK_SCHEMA_MAX_FIELDS must fit in an unsigned char"
+#endif
+
+/* Keys are restricted to fixstr so they can be matched from a small buffer and
+ * encoded with a single header byte. */
+#define MPACK_SCHEMA_MAX_KEY MPACK_KEYSET_MAX_KEY
+
+/* C type stored at the field offset for each field type */
+typedef enum {
+  MPACK_FIELD_BOOLEAN   = 1,  /* int */
+  MPACK_FIELD_UINT      = 2,  /* mpack_uintmax_t */
+  MPACK_FIELD_SINT      = 3,  /* mpack_sintmax_t */
+  MPACK_FIELD_UINT32    = 4,  /* mpack_uint32_t */
+  MPACK_FIELD_SINT32    = 5,  /* mpack_sint32_t */
+  MPACK_FIELD_FLOAT     = 6,  /* float */
+  MPACK_FIELD_DOUBLE    = 7,  /* double */
+  MPACK_FIELD_STR       = 8,  /* char[size], always NUL-terminated */
+  MPACK_FIELD_MAP       = 9   /* nested struct described by `schema` */
+} mpack_field_type_t;
+
+struct mpack_schema_s;
+
+typedef struct mpack_field_s {
+  const char *key;
+  size_t offset, size;
+  mpack_field_type_t type;
+  const struct mpack_schema_s *schema;
+} mpack_field_t;
+
+#define MPACK_FIELD(s, m, key, type) \
+  { key, offsetof(s, m), sizeof(((s *)0)->m), type, NULL }
+#define MPACK_FIELD_NESTED(s, m, key, schema) \
+  { key, offsetof(s, m), sizeof(((s *)0)->m), MPACK_FIELD_MAP, schema }
+
+typedef struct mpack_schema_s {
+  const mpack_field_t *fields;
+  mpack_uint32_t count;
+  /* see mpack_keyindex_init */
+  unsigned char first[MPACK_SCHEMA_MAX_KEY + 1];
+  unsigned char next[MPACK_SCHEMA_MAX_FIELDS];
+  /* key lengths, the encoded key is the fixstr byte followed by the key */
+  unsigned char keylen[MPACK_SCHEMA_MAX_FIELDS];
+} mpack_schema_t;
+
+/* Decoder/encoder states. Only HEADER (nothing processed yet) and DONE are
+ * meaningful outside of schema.c, generated code uses them to pick a fast
+ * path. */
+enum {
+  MPACK_SCHEMA_HEADER = 0,
+  MPACK_SCHEMA_KEY,
+  MPACK_SCHEMA_KEY_CHUNK,
+  MPACK_SCHEMA_VALUE,
+  MPACK_SCHEMA_STR_CHUNK,
+  MPACK_SCHEMA_SKIP,
+  MPACK_SCHEMA_DONE,
+  MPACK_SCHEMA_FAILED
+};
+
+typedef struct mpack_schema_frame_s {
+  const mpack_schema_t *schema;
+  char *base;
+  mpack_uint32_t remaining;  /* key/value pairs left, including current */
+} mpack_schema_frame_t;
+
+typedef struct mpack_schema_decoder_s {
+  mpack_tokbuf_t tokbuf;
+  mpack_schema_frame_t frames[MPACK_MAX_OBJECT_DEPTH];
+  mpack_uint32_t size;
+  int state;
+  const mpack_field_t *field;
+  /* fill position of the current key/string, pending length or number of
+   * values left to skip */
+  mpack_uint32_t pos, length, skip;
+  char key[MPACK_SCHEMA_MAX_KEY];
+} mpack_schema_decoder_t;
+
+typedef struct mpack_schema_encoder_s {
+  mpack_tokbuf_t tokbuf;
+  struct {
+    const mpack_schema_t *schema;
+    const char *base;
+    mpack_uint32_t remaining;  /* fields left, including current */
+  } frames[MPACK_MAX_OBJECT_DEPTH];
+  mpack_uint32_t size;
+  int state;
+  mpack_uint32_t length;  /* length of the string being written */
+} mpack_schema_encoder_t;
+
+MPACK_API int mpack_schema_init(mpack_schema_t *s, const mpack_field_t *f,
+    mpack_uint32_t c) FUNUSED FNONULL;
+MPACK_API const mpack_field_t *mpack_schema_lookup(const mpack_schema_t *s,
+    const char *k, mpack_uint32_t l) FUNUSED FNONULL_ARG((1));
+MPACK_API int mpack_schema_store(const mpack_field_t *f, void *base,
+    mpack_token_t tok) FUNUSED FNONULL;
+
+MPACK_API void mpack_schema_decoder_init(mpack_schema_decoder_t *d,
+    const mpack_schema_t *s, void *out) FUNUSED FNONULL;
+MPACK_API int mpack_schema_decode(mpack_schema_decoder_t *d, const char **b,
+    size_t *bl) FUNUSED FNONULL;
+
+MPACK_API void mpack_schema_encoder_init(mpack_schema_encoder_t *e,
+    const mpack_schema_t *s, const void *in) FUNUSED FNONULL;
+MPACK_API int mpack_schema_encode(mpack_schema_encoder_t *e, char **b,
+    size_t *bl) FUNUSED FNONULL;
+
+#endif  /* MPACK_SCHEMA_H */
@@ -0,0 +1,191 @@
+#include <string.h>
+
+#include "template.h"
+
+static int mpack_template_value(mpack_slot_type_t type, mpack_token_t v,
+    mpack_value_t *out);
+static void mpack_template_be(char *p, mpack_uint32_t v);
+
+MPACK_API void mpack_template_init(mpack_template_t *t, char *buf,
+    size_t capacity)
+{
+  mpack_tokbuf_init(&t->tokbuf);
+  t->buf = buf;
+  t->size = 0;
+  t->capacity = capacity;
+  t->slot_count = 0;
+  t->str_count = 0;
+}
+
+/* Appends a constant token. The template is encoded in a single pass, so
+ * running out of space is MPACK_NOMEM rather than MPACK_EOF. */
+MPACK_API int mpack_template_write(mpack_template_t *t,
+    const mpack_token_t *tok)
+{
+  int status;
+  char *p = t->buf + t->size;
+  size_t pl = t->capacity - t->size;
+  size_t need = mpack_token_size(tok);
+
+  if (!need) {
+    /* empty chunks write nothing, other tokens always take a byte */
+    return tok->type == MPACK_TOKEN_CHUNK || tok->type == MPACK_TOKEN_RAW ?
+      MPACK_OK : MPACK_ERROR;
+  }
+  /* nothing is written unless the whole token fits, so the tokbuf never
+   * holds a partial token after a failure */
+  if (need > pl || (t->size + need) >> 31 >> 1) return MPACK_NOMEM;
+
+  status = mpack_write(&t->tokbuf, &p, &pl, tok);
+  t->size = (size_t)(p - t->buf);
+  return status;
+}
+
+/* Appends a slot, which will be filled by the value with the same index as
+ * the slot passed to mpack_template_fill. */
+MPACK_API int mpack_template_slot(mpack_template_t *t, mpack_slot_type_t type)
+{
+  mpack_slot_t *slot;
+  char code;
+
+  if (t->slot_count == MPACK_TEMPLATE_MAX_SLOTS) return MPACK_NOMEM;
+
+  slot = t->slots + t->slot_count;
+  slot->offset = (mpack_uint32_t)t->size;
+  slot->type = type;
+
+  switch (type) {
+    case MPACK_SLOT_UINT: code = (char)0xcf; break;
+    case MPACK_SLOT_SINT: code = (char)0xd3; break;
+    case MPACK_SLOT_DOUBLE: code = (char)0xcb; break;
+    case MPACK_SLOT_STR:
+      t->slot_count++;
+      t->str_count++;
+      return MPACK_OK;
+    default: return MPACK_ERROR;
+  }
+
+  /* nothing is written unless the whole placeholder fits */
+  if (t->capacity - t->size < 9) return MPACK_NOMEM;
+  /* the placeholder makes the template a valid message by itself */
+  t->buf[t->size] = code;
+  memset(t->buf + t->size + 1, 0, 8);
+  t->size += 9;
+  t->slot_count++;
+  return MPACK_OK;
+}
+
+/* Size of the message produced by mpack_template_fill. `values` is only read
+ * for string slots. */
+MPACK_API size_t mpack_template_size(const mpack_template_t *t,
+    const mpack_token_t *values)
+{
+  size_t rv = t->size;
+  mpack_uint32_t i;
+
+  if (!t->str_count) return rv;
+
+  for (i = 0; i < t->slot_count; i++) {
+    if (t->slots[i].type == MPACK_SLOT_STR) rv += 5 + values[i].length;
+  }
+
+  return rv;
+}
+
+/* Writes one instance of the template with `values[i]` in slot `i`. Numeric
+ * slots accept UINT/SINT/FLOAT tokens that fit the slot type, string slots
+ * accept a CHUNK token with the payload.
+ *
+ * The message is written whole or not at all: MPACK_EOF means it doesn't fit
+ * in `*buflen` bytes and nothing was written. On MPACK_ERROR (a value doesn't
+ * fit its slot) the output is unspecified. `buf`/`buflen` are only advanced on
+ * success. */
+MPACK_API int mpack_template_fill(const mpack_template_t *t,
+    const mpack_token_t *values, char **buf, size_t *buflen)
+{
+  char *out = *buf;
+  size_t size, pos, shift;
+  mpack_uint32_t i;
+  mpack_value_t v;
+
+  size = mpack_template_size(t, values);
+  if (*buflen < size) return MPACK_EOF;
+
+  /* copy the constant bytes between string slots, which are the only ones
+   * that shift the rest of the message. */
+  pos = 0;
+  shift = 0;
+  for (i = 0; t->str_count && i < t->slot_count; i++) {
+    const mpack_slot_t *slot = t->slots + i;
+    char *p;
+    if (slot->type != MPACK_SLOT_STR) continue;
+    if (values[i].type != MPACK_TOKEN_CHUNK) return MPACK_ERROR;
+    memcpy(out + pos + shift, t->buf + pos, slot->offset - pos);
+    pos = slot->offset;
+    p = out + pos + shift;
+    *p = (char)0xdb;
+    mpack_template_be(p + 1, values[i].length);
+    memcpy(p + 5, values[i].data.chunk_ptr, values[i].length);
+    shift += 5 + values[i].length;
+  }
+  memcpy(out + pos + shift, t->buf + pos, t->size - pos);
+
+  /* patch the numeric slots over their placeholders */
+  shift = 0;
+  for (i = 0; i < t->slot_count; i++) {
+    const mpack_slot_t *slot = t->slots + i;
+    char *p = out + slot->offset + shift;
+    if (slot->type == MPACK_SLOT_STR) {
+      shift += 5 + values[i].length;
+      continue;
+    }
+    if (mpack_template_value(slot->type, values[i], &v)) return MPACK_ERROR;
+    mpack_template_be(p + 1, v.hi);
+    mpack_template_be(p + 5, v.lo);
+  }
+
+  *buf += size;
+  *buflen -= size;
+  return MPACK_OK;
+}
+
+static int mpack_template_value(mpack_slot_type_t type, mpack_token_t v,
+    mpack_value_t *out)
+{
+  switch (type) {
+    case MPACK_SLOT_UINT:
+      if (v.type != MPACK_TOKEN_UINT) return MPACK_ERROR;
+      break;
+    case MPACK_SLOT_SINT:
+      if (v.type == MPACK_TOKEN_UINT) {
+        if (v.data.value.hi & 0x80000000) return MPACK_ERROR;
+      } else if (v.type == MPACK_TOKEN_SINT) {
+        v = mpack_sint_extend(v);
+      } else {
+        return MPACK_ERROR;
+      }
+      break;
+    case MPACK_SLOT_DOUBLE:
+      if (v.type != MPACK_TOKEN_UINT && v.type != MPACK_TOKEN_SINT
+          && v.type != MPACK_TOKEN_FLOAT) {
+        return MPACK_ERROR;
+      }
+      if (v.type != MPACK_TOKEN_FLOAT || v.length != 8) {
+        v = mpack_pack_double(mpack_unpack_number(v));
+      }
+      break;
+    default:
+      return MPACK_ERROR;
+  }
+
+  *out = v.data.value;
+  return MPACK_OK;
+}
+
+static void mpack_template_be(char *p, mpack_uint32_t v)
+{
+  p[0] = (char)((v >> 24) & 0xff);
+  p[1] = (char)((v >> 16) & 0xff);
+  p[2] = (char)((v >> 8) & 0xff);
+  p[3] = (char)(v & 0xff);
+}
@@ -0,0 +1,50 @@
+#ifndef MPACK_TEMPLATE_H
+#define MPACK_TEMPLATE_H
+
+#include "core.h"
+#include "conv.h"
+#include "object.h"
+
+#ifndef MPACK_TEMPLATE_MAX_SLOTS
+# define MPACK_TEMPLATE_MAX_SLOTS 16
+#endif
+
+/* Slots always use the widest encoding of their type, so a value can be
+ * patched in without moving the bytes that follow it. */
+typedef enum {
+  MPACK_SLOT_UINT   = 1,  /* uint 64 (0xcf) */
+  MPACK_SLOT_SINT   = 2,  /* int 64 (0xd3) */
+  MPACK_SLOT_DOUBLE = 3,  /* float 64 (0xcb) */
+  MPACK_SLOT_STR    = 4   /* str 32 (0xdb) followed by the payload */
+} mpack_slot_type_t;
+
+typedef struct mpack_slot_s {
+  /* offset of the slot in the template. Numeric slots have a placeholder
+   * there, string slots take no space since their size varies. */
+  mpack_uint32_t offset;
+  mpack_slot_type_t type;
+} mpack_slot_t;
+
+/* Prepared message: the constant part is encoded once and each instance is a
+ * copy of it with the slot values written in. */
+typedef struct mpack_template_s {
+  mpack_tokbuf_t tokbuf;
+  char *buf;
+  size_t size, capacity;
+  mpack_slot_t slots[MPACK_TEMPLATE_MAX_SLOTS];
+  mpack_uint32_t slot_count, str_count;
+} mpack_template_t;
+
+MPACK_API void mpack_template_init(mpack_template_t *t, char *buf,
+    size_t capacity) FUNUSED FNONULL;
+MPACK_API int mpack_template_write(mpack_template_t *t,
+    const mpack_token_t *tok) FUNUSED FNONULL;
+MPACK_API int mpack_template_slot(mpack_template_t *t,
+    mpack_slot_type_t type) FUNUSED FNONULL;
+MPACK_API size_t mpack_template_size(const mpack_template_t *t,
+    const mpack_token_t *values) FUNUSED FNONULL_ARG((1));
+MPACK_API int mpack_template_fill(const mpack_template_t *t,
+    const mpack_token_t *values, char **buf, size_t *buflen) FUNUSED
+  FNONULL_ARG((1,3,4));
+
+#endif  /* MPACK_TEMPLATE_H */
@@ -0,0 +1,909 @@
+#include <string.h>
+
+#include "typed.h"
+
+#define TYPE_BIT(t) (1u << (t))
+
+typedef struct mpack_typed_state_s {
+  const char *buf;
+  size_t buflen, ppos, plen;
+  mpack_uint32_t passthrough;
+} mpack_typed_state_t;
+
+static int mpack_typed_read(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    mpack_token_t *tok, unsigned types, mpack_typed_state_t *s);
+static int mpack_typed_unread(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    const mpack_typed_state_t *s);
+static void mpack_typed_save(const mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_typed_state_t *s);
+static int mpack_typed_sint(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    mpack_sintmax_t *v, mpack_sintmax_t min, mpack_sintmax_t max);
+static mpack_uint32_t mpack_typed_rbe(const unsigned char *p, unsigned n);
+static double mpack_typed_float(const unsigned char *p, mpack_uint32_t l);
+static int mpack_typed_host_be(void) FPURE;
+static void mpack_typed_swap(unsigned char *p, size_t size, size_t count);
+static int mpack_typed_write(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    mpack_token_t tok);
+static int mpack_typed_fixed(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const char *enc, size_t n);
+static char *mpack_typed_header(char *p, unsigned char code,
+    mpack_uint32_t v, unsigned n);
+static char *mpack_typed_be(char *p, mpack_uint32_t v, unsigned n);
+static int mpack_typed_advance(char **b, size_t *bl, char *p);
+
+/* runs are only decoded in place when no token is split across buffers */
+#define IDLE(tb) (!(tb)->plen && !(tb)->passthrough)
+
+/* values are written directly when nothing is pending and the longest
+ * encoding fits */
+#define DIRECT(tb, bl) (!(tb)->plen && (bl) >= MPACK_MAX_TOKEN_LEN)
+
+MPACK_API int mpack_read_nil(mpack_tokbuf_t *tb, const char **b, size_t *bl)
+{
+  mpack_typed_state_t s;
+  mpack_token_t tok;
+  return mpack_typed_read(tb, b, bl, &tok, TYPE_BIT(MPACK_TOKEN_NIL), &s);
+}
+
+MPACK_API int mpack_read_bool(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    int *v)
+{
+  int status;
+  mpack_typed_state_t s;
+  mpack_token_t tok;
+
+  status = mpack_typed_read(tb, b, bl, &tok, TYPE_BIT(MPACK_TOKEN_BOOLEAN),
+      &s);
+  if (status) return status;
+  *v = mpack_unpack_boolean(tok) != 0;
+  return MPACK_OK;
+}
+
+/* Accepts any integer encoding, the reader already returns non-negative
+ * values of the signed formats as MPACK_TOKEN_UINT. */
+MPACK_API int mpack_read_uint(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    mpack_uintmax_t *v)
+{
+  int status;
+  mpack_typed_state_t s;
+  mpack_token_t tok;
+
+  status = mpack_typed_read(tb, b, bl, &tok, TYPE_BIT(MPACK_TOKEN_UINT), &s);
+  if (status) return status;
+  if (sizeof(mpack_uintmax_t) < 8 && tok.data.value.hi) {
+    return mpack_typed_unread(tb, b, bl, &s);
+  }
+  *v = mpack_unpack_uint(tok);
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_read_sint(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    mpack_sintmax_t *v)
+{
+  int status;
+  mpack_typed_state_t s;
+  mpack_token_t tok;
+  mpack_uint32_t hi, lo;
+
+  status = mpack_typed_read(tb, b, bl, &tok,
+      TYPE_BIT(MPACK_TOKEN_UINT) | TYPE_BIT(MPACK_TOKEN_SINT), &s);
+  if (status) return status;
+
+  hi = tok.data.value.hi;
+  lo = tok.data.value.lo;
+  if (tok.type == MPACK_TOKEN_UINT) {
+    if (sizeof(mpack_sintmax_t) < 8 ? hi || lo >> 31 : hi >> 31) {
+      return mpack_typed_unread(tb, b, bl, &s);
+    }
+    *v = (mpack_sintmax_t)mpack_unpack_uint(tok);
+    return MPACK_OK;
+  }
+
+  if (sizeof(mpack_sintmax_t) < 8 && tok.length == 8) {
+    /* int 64 that may still fit in 32 bits */
+    if (hi != 0xffffffff || !(lo >> 31)) {
+      return mpack_typed_unread(tb, b, bl, &s);
+    }
+    tok.data.value.hi = 0;
+    tok.length = 4;
+  }
+  *v = mpack_unpack_sint(tok);
+  return MPACK_OK;
+}
+
+/* Accepts floats and integers, integers are converted like
+ * mpack_unpack_number does. */
+MPACK_API int mpack_read_double(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, double *v)
+{
+  int status;
+  mpack_typed_state_t s;
+  mpack_token_t tok;
+
+  status = mpack_typed_read(tb, b, bl, &tok, TYPE_BIT(MPACK_TOKEN_FLOAT)
+      | TYPE_BIT(MPACK_TOKEN_UINT) | TYPE_BIT(MPACK_TOKEN_SINT), &s);
+  if (status) return status;
+  *v = mpack_unpack_number(tok);
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_read_array_len(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_uint32_t *l)
+{
+  int status;
+  mpack_typed_state_t s;
+  mpack_token_t tok;
+
+  status = mpack_typed_read(tb, b, bl, &tok, TYPE_BIT(MPACK_TOKEN_ARRAY), &s);
+  if (status) return status;
+  *l = tok.length;
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_read_map_len(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_uint32_t *l)
+{
+  int status;
+  mpack_typed_state_t s;
+  mpack_token_t tok;
+
+  status = mpack_typed_read(tb, b, bl, &tok, TYPE_BIT(MPACK_TOKEN_MAP), &s);
+  if (status) return status;
+  *l = tok.length;
+  return MPACK_OK;
+}
+
+/* Returns the string payload without copying. If the payload is split across
+ * buffers, each call returns the part found in the current buffer with
+ * MPACK_EOF, and the last part with MPACK_OK. `*l` is 0 when a call returns
+ * no part. */
+MPACK_API int mpack_read_str_span(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, const char **p, mpack_uint32_t *l)
+{
+  int status;
+  mpack_typed_state_t s;
+  mpack_token_t tok;
+
+  *p = *b;
+  *l = 0;
+
+  if (!tb->passthrough) {
+    status = mpack_typed_read(tb, b, bl, &tok, TYPE_BIT(MPACK_TOKEN_STR), &s);
+    if (status) return status;
+    /* empty string */
+    if (!tb->passthrough) return MPACK_OK;
+    *p = *b;
+    if (!*bl) return MPACK_EOF;
+  } else if (!*bl) {
+    return MPACK_EOF;
+  }
+
+  mpack_read(tb, b, bl, &tok);
+  *p = tok.data.chunk_ptr;
+  *l = tok.length;
+  return tb->passthrough ? MPACK_EOF : MPACK_OK;
+}
+
+MPACK_API int mpack_read_array_f64(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, double *out, mpack_uint32_t count, mpack_uint32_t *pos)
+{
+  int status;
+  mpack_uint32_t i;
+
+  while (*pos < count) {
+    if (IDLE(tb)) {
+      const unsigned char *p = (const unsigned char *)*b;
+      size_t avail = *bl / 9;
+      for (i = *pos; i < count && avail && *p == 0xcb; i++, avail--, p += 9) {
+        out[i] = mpack_typed_float(p + 1, 8);
+      }
+      *bl -= (size_t)(i - *pos) * 9;
+      *b = (const char *)p;
+      if ((*pos = i) == count) break;
+    }
+    if ((status = mpack_read_double(tb, b, bl, out + *pos))) return status;
+    (*pos)++;
+  }
+
+  return MPACK_OK;
+}
+
+/* float 64 and integer elements are converted to float */
+MPACK_API int mpack_read_array_f32(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, float *out, mpack_uint32_t count, mpack_uint32_t *pos)
+{
+  int status;
+  mpack_uint32_t i;
+  double v;
+
+  while (*pos < count) {
+    if (IDLE(tb)) {
+      const unsigned char *p = (const unsigned char *)*b;
+      size_t avail = *bl / 5;
+      for (i = *pos; i < count && avail && *p == 0xca; i++, avail--, p += 5) {
+        out[i] = (float)mpack_typed_float(p + 1, 4);
+      }
+      *bl -= (size_t)(i - *pos) * 5;
+      *b = (const char *)p;
+      if ((*pos = i) == count) break;
+    }
+    if ((status = mpack_read_double(tb, b, bl, &v))) return status;
+    out[(*pos)++] = (float)v;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_read_array_sint(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_sintmax_t *out, mpack_uint32_t count,
+    mpack_uint32_t *pos)
+{
+  int status;
+  mpack_uint32_t i;
+
+  while (*pos < count) {
+    if (IDLE(tb)) {
+      const unsigned char *p = (const unsigned char *)*b;
+      size_t avail = *bl;
+      /* positive/negative fixint */
+      for (i = *pos; i < count && avail && (*p < 0x80 || *p >= 0xe0);
+          i++, avail--, p++) {
+        out[i] = *p < 0x80 ? *p : (mpack_sintmax_t)*p - 0x100;
+      }
+      *bl = avail;
+      *b = (const char *)p;
+      if ((*pos = i) == count) break;
+    }
+    if ((status = mpack_read_sint(tb, b, bl, out + *pos))) return status;
+    (*pos)++;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_read_array_i32(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_sint32_t *out, mpack_uint32_t count,
+    mpack_uint32_t *pos)
+{
+  int status;
+  mpack_uint32_t i;
+  mpack_sintmax_t v;
+
+  while (*pos < count) {
+    if (IDLE(tb)) {
+      const unsigned char *p = (const unsigned char *)*b;
+      size_t avail = *bl;
+      for (i = *pos; i < count && avail; i++) {
+        if (*p < 0x80 || *p >= 0xe0) {
+          out[i] = *p < 0x80 ? *p : (mpack_sint32_t)*p - 0x100;
+          p++;
+          avail--;
+        } else if (*p == 0xd2 && avail >= 5) {
+          mpack_uint32_t u = mpack_typed_rbe(p + 1, 4);
+          /* two's complement without relying on the conversion */
+          out[i] = u >> 31 ? -(mpack_sint32_t)(~u & 0x7fffffff) - 1
+            : (mpack_sint32_t)u;
+          p += 5;
+          avail -= 5;
+        } else {
+          break;
+        }
+      }
+      *bl = avail;
+      *b = (const char *)p;
+      if ((*pos = i) == count) break;
+    }
+    status = mpack_typed_sint(tb, b, bl, &v, -0x7fffffff - 1, 0x7fffffff);
+    if (status) return status;
+    out[(*pos)++] = (mpack_sint32_t)v;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_read_array_u8(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, unsigned char *out, mpack_uint32_t count,
+    mpack_uint32_t *pos)
+{
+  int status;
+  mpack_uint32_t i;
+  mpack_sintmax_t v;
+
+  while (*pos < count) {
+    if (IDLE(tb)) {
+      const unsigned char *p = (const unsigned char *)*b;
+      size_t avail = *bl;
+      for (i = *pos; i < count && avail; i++) {
+        if (*p < 0x80) {
+          out[i] = *p++;
+          avail--;
+        } else if (*p == 0xcc && avail >= 2) {
+          out[i] = p[1];
+          p += 2;
+          avail -= 2;
+        } else {
+          break;
+        }
+      }
+      *bl = avail;
+      *b = (const char *)p;
+      if ((*pos = i) == count) break;
+    }
+    if ((status = mpack_typed_sint(tb, b, bl, &v, 0, 0xff))) return status;
+    out[(*pos)++] = (unsigned char)v;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_write_nil(mpack_tokbuf_t *tb, char **b, size_t *bl)
+{
+  if (!DIRECT(tb, *bl)) return mpack_typed_write(tb, b, bl, mpack_pack_nil());
+  return mpack_typed_advance(b, bl, mpack_typed_header(*b, 0xc0, 0, 0));
+}
+
+MPACK_API int mpack_write_bool(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    int v)
+{
+  if (!DIRECT(tb, *bl)) {
+    return mpack_typed_write(tb, b, bl, mpack_pack_boolean(v != 0));
+  }
+  return mpack_typed_advance(b, bl,
+      mpack_typed_header(*b, v ? 0xc3 : 0xc2, 0, 0));
+}
+
+MPACK_API int mpack_write_uint(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    mpack_uintmax_t v)
+{
+  mpack_uint32_t hi = (mpack_uint32_t)((v >> 31) >> 1);
+  mpack_uint32_t lo = (mpack_uint32_t)(v & 0xffffffff);
+  char *p = *b;
+
+  if (!DIRECT(tb, *bl)) return mpack_typed_write(tb, b, bl, mpack_pack_uint(v));
+
+  if (hi) {
+    p = mpack_typed_be(mpack_typed_header(p, 0xcf, hi, 4), lo, 4);
+  } else if (lo > 0xffff) {
+    p = mpack_typed_header(p, 0xce, lo, 4);
+  } else if (lo > 0xff) {
+    p = mpack_typed_header(p, 0xcd, lo, 2);
+  } else if (lo > 0x7f) {
+    p = mpack_typed_header(p, 0xcc, lo, 1);
+  } else {
+    p = mpack_typed_header(p, (unsigned char)lo, 0, 0);
+  }
+
+  return mpack_typed_advance(b, bl, p);
+}
+
+MPACK_API int mpack_write_sint(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    mpack_sintmax_t v)
+{
+  /* conversion to unsigned gives the two's complement bits */
+  mpack_uintmax_t u = (mpack_uintmax_t)v;
+  mpack_uint32_t lo = (mpack_uint32_t)(u & 0xffffffff);
+  char *p = *b;
+
+  if (v >= 0) return mpack_write_uint(tb, b, bl, u);
+  if (!DIRECT(tb, *bl)) return mpack_typed_write(tb, b, bl, mpack_pack_sint(v));
+
+  if (v < -0x7fffffff - 1) {
+    p = mpack_typed_header(p, 0xd3, (mpack_uint32_t)((u >> 31) >> 1), 4);
+    p = mpack_typed_be(p, lo, 4);
+  } else if (v < -0x8000) {
+    p = mpack_typed_header(p, 0xd2, lo, 4);
+  } else if (v < -0x80) {
+    p = mpack_typed_header(p, 0xd1, lo, 2);
+  } else if (v < -0x20) {
+    p = mpack_typed_header(p, 0xd0, lo, 1);
+  } else {
+    p = mpack_typed_header(p, (unsigned char)(lo & 0xff), 0, 0);
+  }
+
+  return mpack_typed_advance(b, bl, p);
+}
+
+/* Uses the 4 byte format when it doesn't lose precision, like
+ * mpack_pack_float. */
+MPACK_API int mpack_write_double(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    double v)
+{
+  mpack_token_t tok = mpack_pack_float(v);
+  char *p = *b;
+
+  if (!DIRECT(tb, *bl)) return mpack_typed_write(tb, b, bl, tok);
+
+  if (tok.length == 4) {
+    p = mpack_typed_header(p, 0xca, tok.data.value.lo, 4);
+  } else {
+    p = mpack_typed_header(p, 0xcb, tok.data.value.hi, 4);
+    p = mpack_typed_be(p, tok.data.value.lo, 4);
+  }
+
+  return mpack_typed_advance(b, bl, p);
+}
+
+MPACK_API int mpack_write_array_len(mpack_tokbuf_t *tb, char **b,
+    size_t *bl, mpack_uint32_t l)
+{
+  char *p = *b;
+
+  if (!DIRECT(tb, *bl)) {
+    return mpack_typed_write(tb, b, bl, mpack_pack_array(l));
+  }
+
+  if (l < 0x10) {
+    p = mpack_typed_header(p, (unsigned char)(0x90 | l), 0, 0);
+  } else if (l < 0x10000) {
+    p = mpack_typed_header(p, 0xdc, l, 2);
+  } else {
+    p = mpack_typed_header(p, 0xdd, l, 4);
+  }
+
+  return mpack_typed_advance(b, bl, p);
+}
+
+MPACK_API int mpack_write_map_len(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    mpack_uint32_t l)
+{
+  char *p = *b;
+
+  if (!DIRECT(tb, *bl)) return mpack_typed_write(tb, b, bl, mpack_pack_map(l));
+
+  if (l < 0x10) {
+    p = mpack_typed_header(p, (unsigned char)(0x80 | l), 0, 0);
+  } else if (l < 0x10000) {
+    p = mpack_typed_header(p, 0xde, l, 2);
+  } else {
+    p = mpack_typed_header(p, 0xdf, l, 4);
+  }
+
+  return mpack_typed_advance(b, bl, p);
+}
+
+/* Writes the str header followed by the payload. */
+MPACK_API int mpack_write_str(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const char *p, mpack_uint32_t l)
+{
+  int status;
+  mpack_token_t chunk = mpack_pack_chunk(p, l);
+
+  if (tb->plen && tb->pending_tok.type == MPACK_TOKEN_CHUNK) {
+    /* resume the payload */
+    return mpack_typed_write(tb, b, bl, chunk);
+  }
+
+  if (!tb->plen && *bl >= (size_t)l + 5) {
+    char *w = *b;
+    if (l < 0x20) {
+      w = mpack_typed_header(w, (unsigned char)(0xa0 | l), 0, 0);
+    } else if (l < 0x100) {
+      w = mpack_typed_header(w, 0xd9, l, 1);
+    } else if (l < 0x10000) {
+      w = mpack_typed_header(w, 0xda, l, 2);
+    } else {
+      w = mpack_typed_header(w, 0xdb, l, 4);
+    }
+    if (l) memcpy(w, p, l);
+    return mpack_typed_advance(b, bl, w + l);
+  }
+
+  /* writes the header, or resumes it if pending */
+  if ((status = mpack_typed_write(tb, b, bl, mpack_pack_str(l)))) {
+    return status;
+  }
+
+  if (!l) return MPACK_OK;
+
+  if (!*bl) {
+    /* mpack_write needs a non-empty buffer, so leave the payload pending the
+     * way it would have done itself */
+    tb->pending_tok = chunk;
+    tb->plen = l;
+    tb->ppos = 0;
+    return MPACK_EOF;
+  }
+
+  return mpack_typed_write(tb, b, bl, chunk);
+}
+
+MPACK_API int mpack_write_array_f64(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const double *in, mpack_uint32_t count, mpack_uint32_t *pos, int fixed)
+{
+  int status;
+  char enc[MPACK_MAX_TOKEN_LEN], *e;
+  mpack_token_t tok;
+
+  for (; *pos <= count; (*pos)++) {
+    if (!*pos) {
+      status = mpack_write_array_len(tb, b, bl, count);
+    } else if (!fixed) {
+      status = mpack_write_double(tb, b, bl, in[*pos - 1]);
+    } else {
+      tok = mpack_pack_double(in[*pos - 1]);
+      e = mpack_typed_header(enc, 0xcb, tok.data.value.hi, 4);
+      e = mpack_typed_be(e, tok.data.value.lo, 4);
+      status = mpack_typed_fixed(tb, b, bl, enc, (size_t)(e - enc));
+    }
+    if (status) return status;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_write_array_f32(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const float *in, mpack_uint32_t count, mpack_uint32_t *pos, int fixed)
+{
+  int status;
+  char enc[MPACK_MAX_TOKEN_LEN], *e;
+  mpack_uint32_t bits;
+
+  for (; *pos <= count; (*pos)++) {
+    if (!*pos) {
+      status = mpack_write_array_len(tb, b, bl, count);
+    } else if (!fixed) {
+      status = mpack_write_double(tb, b, bl, in[*pos - 1]);
+    } else {
+      /* the float's own bits, mpack_pack_float widens NaN to 8 bytes */
+      memcpy(&bits, in + *pos - 1, sizeof(bits));
+      e = mpack_typed_header(enc, 0xca, bits, 4);
+      status = mpack_typed_fixed(tb, b, bl, enc, (size_t)(e - enc));
+    }
+    if (status) return status;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_write_array_sint(mpack_tokbuf_t *tb, char **b,
+    size_t *bl, const mpack_sintmax_t *in, mpack_uint32_t count,
+    mpack_uint32_t *pos, int fixed)
+{
+  int status;
+  char enc[MPACK_MAX_TOKEN_LEN], *e;
+  mpack_uintmax_t u;
+  mpack_uint32_t hi;
+
+  for (; *pos <= count; (*pos)++) {
+    if (!*pos) {
+      status = mpack_write_array_len(tb, b, bl, count);
+    } else if (!fixed) {
+      status = mpack_write_sint(tb, b, bl, in[*pos - 1]);
+    } else {
+      u = (mpack_uintmax_t)in[*pos - 1];
+      hi = (mpack_uint32_t)((u >> 31) >> 1);
+      if (sizeof(u) < 8 && in[*pos - 1] < 0) hi = 0xffffffff;
+      e = mpack_typed_header(enc, 0xd3, hi, 4);
+      e = mpack_typed_be(e, (mpack_uint32_t)(u & 0xffffffff), 4);
+      status = mpack_typed_fixed(tb, b, bl, enc, (size_t)(e - enc));
+    }
+    if (status) return status;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_write_array_i32(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const mpack_sint32_t *in, mpack_uint32_t count, mpack_uint32_t *pos,
+    int fixed)
+{
+  int status;
+  char enc[MPACK_MAX_TOKEN_LEN], *e;
+
+  for (; *pos <= count; (*pos)++) {
+    if (!*pos) {
+      status = mpack_write_array_len(tb, b, bl, count);
+    } else if (!fixed) {
+      status = mpack_write_sint(tb, b, bl, in[*pos - 1]);
+    } else {
+      e = mpack_typed_header(enc, 0xd2, (mpack_uint32_t)in[*pos - 1], 4);
+      status = mpack_typed_fixed(tb, b, bl, enc, (size_t)(e - enc));
+    }
+    if (status) return status;
+  }
+
+  return MPACK_OK;
+}
+
+MPACK_API int mpack_write_array_u8(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const unsigned char *in, mpack_uint32_t count, mpack_uint32_t *pos,
+    int fixed)
+{
+  int status;
+  char enc[MPACK_MAX_TOKEN_LEN], *e;
+
+  for (; *pos <= count; (*pos)++) {
+    if (!*pos) {
+      status = mpack_write_array_len(tb, b, bl, count);
+    } else if (!fixed) {
+      status = mpack_write_uint(tb, b, bl, in[*pos - 1]);
+    } else {
+      e = mpack_typed_header(enc, 0xcc, in[*pos - 1], 1);
+      status = mpack_typed_fixed(tb, b, bl, enc, (size_t)(e - enc));
+    }
+    if (status) return status;
+  }
+
+  return MPACK_OK;
+}
+
+/* Element size of each mpack_array_kind_t */
+static const unsigned char mpack_typed_sizes[] = {
+  0, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8
+};
+
+enum {
+  MPACK_TYPED_ARRAY_EXT = 0,
+  MPACK_TYPED_ARRAY_LAYOUT,
+  MPACK_TYPED_ARRAY_DATA
+};
+
+/* Byte size of the elements */
+MPACK_API size_t mpack_typed_array_size(const mpack_typed_array_t *a)
+{
+  if (a->kind < MPACK_ARRAY_U8 || a->kind > MPACK_ARRAY_F64) return 0;
+  return (size_t)a->count * mpack_typed_sizes[a->kind];
+}
+
+/* Reads a typed array. When the elements are complete in the buffer, in the
+ * host byte order and aligned for the element type, `a->data` points into the
+ * buffer. Otherwise they are copied to `storage`, which must have room for
+ * mpack_typed_array_size bytes, and swapped if needed. If `storage` is NULL
+ * in that case the call returns MPACK_NOMEM without consuming the elements,
+ * so it can be repeated with storage once `a->kind` and `a->count` are
+ * known. */
+MPACK_API int mpack_read_typed_array(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_typed_array_t *a, void *storage)
+{
+  int status;
+  mpack_typed_state_t s;
+  mpack_token_t tok;
+  size_t size, elsize;
+
+  if (a->state == MPACK_TYPED_ARRAY_EXT) {
+    status = mpack_typed_read(tb, b, bl, &tok, TYPE_BIT(MPACK_TOKEN_EXT), &s);
+    if (status) return status;
+    if (tok.data.ext_type != MPACK_EXT_TYPED_ARRAY
+        || tok.length < MPACK_TYPED_ARRAY_HEADER) {
+      return mpack_typed_unread(tb, b, bl, &s);
+    }
+    a->state = MPACK_TYPED_ARRAY_LAYOUT;
+    a->pos = 0;
+  }
+
+  while (a->state == MPACK_TYPED_ARRAY_LAYOUT) {
+    /* only read the layout header, the elements are read separately */
+    mpack_uint32_t rest = tb->passthrough - MPACK_TYPED_ARRAY_HEADER + a->pos;
+    if (!*bl) return MPACK_EOF;
+    tb->passthrough = MPACK_TYPED_ARRAY_HEADER - a->pos;
+    mpack_read(tb, b, bl, &tok);
+    tb->passthrough += rest;
+    memcpy(a->header + a->pos, tok.data.chunk_ptr, tok.length);
+    a->pos += tok.length;
+    if (a->pos < MPACK_TYPED_ARRAY_HEADER) continue;
+
+    a->kind = (mpack_array_kind_t)a->header[0];
+    a->big_endian = a->header[1];
+    a->count = mpack_typed_rbe(a->header + 2, 4);
+    /* the elements must fill the rest of the ext payload */
+    if (a->kind < MPACK_ARRAY_U8 || a->kind > MPACK_ARRAY_F64
+        || a->header[1] > 1 || mpack_typed_array_size(a) != tb->passthrough) {
+      return MPACK_ERROR;
+    }
+    a->state = MPACK_TYPED_ARRAY_DATA;
+    a->pos = 0;
+  }
+
+  elsize = mpack_typed_sizes[a->kind];
+  size = mpack_typed_array_size(a);
+
+  if (!size) {
+    a->data = storage;
+  } else if (!a->pos && *bl >= size && a->big_endian == mpack_typed_host_be()
+      && !((size_t)*b % elsize)) {
+    /* zero copy */
+    mpack_read(tb, b, bl, &tok);
+    a->data = tok.data.chunk_ptr;
+  } else if (!storage) {
+    return MPACK_NOMEM;
+  } else {
+    while (a->pos < size) {
+      if (!*bl) return MPACK_EOF;
+      mpack_read(tb, b, bl, &tok);
+      memcpy((char *)storage + a->pos, tok.data.chunk_ptr, tok.length);
+      a->pos += tok.length;
+    }
+    if (a->big_endian != mpack_typed_host_be()) {
+      mpack_typed_swap(storage, elsize, a->count);
+    }
+    a->data = storage;
+  }
+
+  a->state = MPACK_TYPED_ARRAY_EXT;
+  return MPACK_OK;
+}
+
+/* Writes a typed array with the elements in host byte order, `a->big_endian`
+ * is ignored. Like the bulk writers, `*pos` counts the steps (ext header,
+ * layout header and elements) and is 3 when the array is complete. */
+MPACK_API int mpack_write_typed_array(mpack_tokbuf_t *tb, char **b,
+    size_t *bl, const mpack_typed_array_t *a, mpack_uint32_t *pos)
+{
+  int status = MPACK_OK;
+  size_t size = mpack_typed_array_size(a);
+  char layout[MPACK_TYPED_ARRAY_HEADER];
+
+  if (!size && a->count) return MPACK_ERROR;
+  if ((size + MPACK_TYPED_ARRAY_HEADER) >> 31 >> 1) return MPACK_ERROR;
+
+  for (; *pos < 3; (*pos)++) {
+    if (*pos == 0) {
+      status = mpack_typed_write(tb, b, bl, mpack_pack_ext(
+            MPACK_EXT_TYPED_ARRAY,
+            (mpack_uint32_t)size + MPACK_TYPED_ARRAY_HEADER));
+    } else if (*pos == 1) {
+      layout[0] = (char)a->kind;
+      layout[1] = (char)mpack_typed_host_be();
+      mpack_typed_be(layout + 2, a->count, 4);
+      status = mpack_typed_fixed(tb, b, bl, layout, sizeof(layout));
+    } else if (size) {
+      status = mpack_typed_write(tb, b, bl, mpack_pack_chunk(a->data,
+            (mpack_uint32_t)size));
+    }
+    if (status) return status;
+  }
+
+  return MPACK_OK;
+}
+
+/* Reads the next token, putting it back if its type is not in `types`. `s`
+ * saves the state needed to put it back after further checks. */
+static int mpack_typed_read(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    mpack_token_t *tok, unsigned types, mpack_typed_state_t *s)
+{
+  int status;
+
+  if (!*bl) return MPACK_EOF;
+
+  mpack_typed_save(tb, b, bl, s);
+  if ((status = mpack_read(tb, b, bl, tok))) return status;
+  if (!(types & TYPE_BIT(tok->type))) return mpack_typed_unread(tb, b, bl, s);
+  return MPACK_OK;
+}
+
+static void mpack_typed_save(const mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_typed_state_t *s)
+{
+  s->buf = *b;
+  s->buflen = *bl;
+  s->ppos = tb->ppos;
+  s->plen = tb->plen;
+  s->passthrough = tb->passthrough;
+}
+
+/* mpack_read_sint restricted to [min, max], values outside are put back */
+static int mpack_typed_sint(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    mpack_sintmax_t *v, mpack_sintmax_t min, mpack_sintmax_t max)
+{
+  int status;
+  mpack_typed_state_t s;
+
+  mpack_typed_save(tb, b, bl, &s);
+  if ((status = mpack_read_sint(tb, b, bl, v))) return status;
+  if (*v < min || *v > max) return mpack_typed_unread(tb, b, bl, &s);
+  return MPACK_OK;
+}
+
+static mpack_uint32_t mpack_typed_rbe(const unsigned char *p, unsigned n)
+{
+  mpack_uint32_t rv = 0;
+  while (n--) {
+    rv = (rv << 8) | *p++;
+  }
+  return rv;
+}
+
+/* decodes the payload of a float 32/64 */
+static double mpack_typed_float(const unsigned char *p, mpack_uint32_t l)
+{
+  mpack_token_t tok;
+  tok.type = MPACK_TOKEN_FLOAT;
+  tok.length = l;
+  if (l == 4) {
+    tok.data.value.hi = 0;
+    tok.data.value.lo = mpack_typed_rbe(p, 4);
+  } else {
+    tok.data.value.hi = mpack_typed_rbe(p, 4);
+    tok.data.value.lo = mpack_typed_rbe(p + 4, 4);
+  }
+  return mpack_unpack_float(tok);
+}
+
+/* The pending bytes of a split token are kept by restoring ppos, since the
+ * bytes appended after it are read again. */
+static int mpack_typed_unread(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    const mpack_typed_state_t *s)
+{
+  *b = s->buf;
+  *bl = s->buflen;
+  tb->ppos = s->ppos;
+  tb->plen = s->plen;
+  tb->passthrough = s->passthrough;
+  return MPACK_ERROR;
+}
+
+static int mpack_typed_host_be(void)
+{
+  union {
+    mpack_uint32_t i;
+    char c[sizeof(mpack_uint32_t)];
+  } test;
+  test.i = 1;
+  return test.c[0] == 0;
+}
+
+static void mpack_typed_swap(unsigned char *p, size_t size, size_t count)
+{
+  size_t i, j;
+  for (i = 0; i < count; i++, p += size) {
+    for (j = 0; j < size / 2; j++) {
+      unsigned char t = p[j];
+      p[j] = p[size - 1 - j];
+      p[size - 1 - j] = t;
+    }
+  }
+}
+
+static int mpack_typed_write(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    mpack_token_t tok)
+{
+  if (!*bl) return MPACK_EOF;
+  return mpack_write(tb, b, bl, &tok);
+}
+
+/* Writes an encoded value that mpack_write wouldn't produce (a wider format
+ * than needed). When it doesn't fit, the rest is left in the tokbuf pending
+ * bytes, which mpack_write resumes like its own. */
+static int mpack_typed_fixed(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const char *enc, size_t n)
+{
+  size_t count;
+
+  if (tb->plen) return mpack_typed_write(tb, b, bl, mpack_pack_nil());
+  if (!*bl) return MPACK_EOF;
+
+  count = n < *bl ? n : *bl;
+  memcpy(*b, enc, count);
+  *b += count;
+  *bl -= count;
+  if (count == n) return MPACK_OK;
+
+  memcpy(tb->pending, enc, n);
+  tb->plen = n;
+  tb->ppos = count;
+  tb->pending_tok = mpack_pack_nil();
+  return MPACK_EOF;
+}
+
+static char *mpack_typed_header(char *p, unsigned char code,
+    mpack_uint32_t v, unsigned n)
+{
+  *p++ = (char)code;
+  return mpack_typed_be(p, v, n);
+}
+
+/* Writes the `n` low bytes of `v` in big-endian order */
+static char *mpack_typed_be(char *p, mpack_uint32_t v, unsigned n)
+{
+  while (n--) {
+    *p++ = (char)((v >> (n * 8)) & 0xff);
+  }
+  return p;
+}
+
+static int mpack_typed_advance(char **b, size_t *bl, char *p)
+{
+  *bl -= (size_t)(p - *b);
+  *b = p;
+  return MPACK_OK;
+}
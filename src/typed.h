@@ -0,0 +1,141 @@
+#ifndef MPACK_TYPED_H
+#define MPACK_TYPED_H
+
+#include "core.h"
+#include "conv.h"
+#include "object.h"
+
+/* ext type used for typed arrays */
+#ifndef MPACK_EXT_TYPED_ARRAY
+# define MPACK_EXT_TYPED_ARRAY 0x10
+#endif
+
+/* Typed arrays are packed native arrays sent as an ext value. The ext payload
+ * starts with a 6 byte layout header: element kind, byte order (0 little, 1
+ * big endian) and element count (uint32, big endian), followed by the
+ * elements. Writers send their host byte order, so on matching hosts the
+ * elements can be used without copying. */
+typedef enum {
+  MPACK_ARRAY_U8  = 1,
+  MPACK_ARRAY_I8  = 2,
+  MPACK_ARRAY_U16 = 3,
+  MPACK_ARRAY_I16 = 4,
+  MPACK_ARRAY_U32 = 5,
+  MPACK_ARRAY_I32 = 6,
+  MPACK_ARRAY_U64 = 7,
+  MPACK_ARRAY_I64 = 8,
+  MPACK_ARRAY_F32 = 9,
+  MPACK_ARRAY_F64 = 10
+} mpack_array_kind_t;
+
+#define MPACK_TYPED_ARRAY_HEADER 6
+
+typedef struct mpack_typed_array_s {
+  mpack_array_kind_t kind;
+  int big_endian;  /* byte order of the encoded elements */
+  mpack_uint32_t count;
+  const void *data;  /* elements, always in host byte order */
+  /* reader state, must be zeroed before the first mpack_read_typed_array */
+  int state;
+  mpack_uint32_t pos;
+  unsigned char header[MPACK_TYPED_ARRAY_HEADER];
+} mpack_typed_array_t;
+
+/* Readers for values of a known type, built on mpack_read. Each one reads a
+ * single value, checks its type and range and converts it. MPACK_EOF means
+ * more input is needed and the call must be repeated with the same tokbuf.
+ * MPACK_ERROR means the value doesn't have the expected type or doesn't fit,
+ * and nothing is consumed, so another reader can be tried. */
+MPACK_API int mpack_read_nil(mpack_tokbuf_t *tb, const char **b, size_t *bl)
+  FUNUSED FNONULL;
+MPACK_API int mpack_read_bool(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    int *v) FUNUSED FNONULL;
+MPACK_API int mpack_read_uint(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    mpack_uintmax_t *v) FUNUSED FNONULL;
+MPACK_API int mpack_read_sint(mpack_tokbuf_t *tb, const char **b, size_t *bl,
+    mpack_sintmax_t *v) FUNUSED FNONULL;
+MPACK_API int mpack_read_double(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, double *v) FUNUSED FNONULL;
+MPACK_API int mpack_read_array_len(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_uint32_t *l) FUNUSED FNONULL;
+MPACK_API int mpack_read_map_len(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_uint32_t *l) FUNUSED FNONULL;
+MPACK_API int mpack_read_str_span(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, const char **p, mpack_uint32_t *l) FUNUSED FNONULL;
+
+/* Bulk readers for arrays with elements of a single type, called after the
+ * array header was read with mpack_read_array_len. They fill `out[*pos]` up
+ * to `out[count - 1]`, advancing `*pos`, so a call that returns MPACK_EOF is
+ * resumed with more input. On MPACK_ERROR `*pos` is the index of the element
+ * that was rejected, and that element is left in the input.
+ *
+ * Runs of elements with the same encoding that are complete in the buffer
+ * are decoded in place, other elements go through the scalar readers. */
+MPACK_API int mpack_read_array_f64(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, double *out, mpack_uint32_t count, mpack_uint32_t *pos)
+  FUNUSED FNONULL;
+MPACK_API int mpack_read_array_f32(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, float *out, mpack_uint32_t count, mpack_uint32_t *pos)
+  FUNUSED FNONULL;
+MPACK_API int mpack_read_array_sint(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_sintmax_t *out, mpack_uint32_t count,
+    mpack_uint32_t *pos) FUNUSED FNONULL;
+MPACK_API int mpack_read_array_i32(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_sint32_t *out, mpack_uint32_t count,
+    mpack_uint32_t *pos) FUNUSED FNONULL;
+MPACK_API int mpack_read_array_u8(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, unsigned char *out, mpack_uint32_t count,
+    mpack_uint32_t *pos) FUNUSED FNONULL;
+
+/* Writers for values of a known type. When there's room for the whole value
+ * they encode it directly into the buffer, otherwise they go through
+ * mpack_write and MPACK_EOF means the call must be repeated with the same
+ * arguments once more space is available. */
+MPACK_API int mpack_write_nil(mpack_tokbuf_t *tb, char **b, size_t *bl)
+  FUNUSED FNONULL;
+MPACK_API int mpack_write_bool(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    int v) FUNUSED FNONULL;
+MPACK_API int mpack_write_uint(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    mpack_uintmax_t v) FUNUSED FNONULL;
+MPACK_API int mpack_write_sint(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    mpack_sintmax_t v) FUNUSED FNONULL;
+MPACK_API int mpack_write_double(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    double v) FUNUSED FNONULL;
+MPACK_API int mpack_write_array_len(mpack_tokbuf_t *tb, char **b,
+    size_t *bl, mpack_uint32_t l) FUNUSED FNONULL;
+MPACK_API int mpack_write_map_len(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    mpack_uint32_t l) FUNUSED FNONULL;
+MPACK_API int mpack_write_str(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const char *p, mpack_uint32_t l) FUNUSED FNONULL_ARG((1,2,3));
+
+/* Bulk writers for arrays of native values. They write the array header
+ * followed by the elements, `*pos` counts the header as step 0, so the array
+ * is complete when `*pos == count + 1`. Elements use the smallest encoding
+ * that represents them exactly, or the widest encoding of the element type
+ * if `fixed` is set, which gives every element the same size. */
+MPACK_API int mpack_write_array_f64(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const double *in, mpack_uint32_t count, mpack_uint32_t *pos, int fixed)
+  FUNUSED FNONULL;
+MPACK_API int mpack_write_array_f32(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const float *in, mpack_uint32_t count, mpack_uint32_t *pos, int fixed)
+  FUNUSED FNONULL;
+MPACK_API int mpack_write_array_sint(mpack_tokbuf_t *tb, char **b,
+    size_t *bl, const mpack_sintmax_t *in, mpack_uint32_t count,
+    mpack_uint32_t *pos, int fixed) FUNUSED FNONULL;
+MPACK_API int mpack_write_array_i32(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const mpack_sint32_t *in, mpack_uint32_t count, mpack_uint32_t *pos,
+    int fixed) FUNUSED FNONULL;
+MPACK_API int mpack_write_array_u8(mpack_tokbuf_t *tb, char **b, size_t *bl,
+    const unsigned char *in, mpack_uint32_t count, mpack_uint32_t *pos,
+    int fixed) FUNUSED FNONULL;
+
+MPACK_API size_t mpack_typed_array_size(const mpack_typed_array_t *a)
+  FUNUSED FNONULL;
+MPACK_API int mpack_read_typed_array(mpack_tokbuf_t *tb, const char **b,
+    size_t *bl, mpack_typed_array_t *a, void *storage) FUNUSED
+  FNONULL_ARG((1,2,3,4));
+MPACK_API int mpack_write_typed_array(mpack_tokbuf_t *tb, char **b,
+    size_t *bl, const mpack_typed_array_t *a, mpack_uint32_t *pos) FUNUSED
+  FNONULL;
+
+#endif  /* MPACK_TYPED_H */
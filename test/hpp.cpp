@@ -0,0 +1,147 @@
+// Checks the constexpr encodings of mpack.hpp against mpack_write.
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+
+#include "mpack.hpp"
+#include "tap.h"
+
+// encoded at compile time, so a mismatch fails the build
+static_assert(mpack::pack_uint<0x100>().size() == 3
+    && mpack::pack_uint<0x100>().data[0] == static_cast<char>(0xcd)
+    && mpack::pack_uint<0x100>().data[1] == 1
+    && mpack::pack_uint<0x100>().data[2] == 0,
+    "uint 16 is encoded at compile time");
+static_assert(mpack::concat(mpack::pack_array<2>(), mpack::pack_nil(),
+      mpack::pack_sint<-33>()).size() == 4, "concat adds up the sizes");
+
+// true if writing `tokens` with mpack_write produces exactly `b`
+template <std::size_t N>
+static bool same(const mpack::bytes<N> &b,
+    std::initializer_list<mpack_token_t> tokens)
+{
+  static char buf[0x400];
+  char *p = buf;
+  std::size_t pl = sizeof(buf);
+  mpack_tokbuf_t tb;
+  mpack_tokbuf_init(&tb);
+  for (const mpack_token_t &tok : tokens) {
+    if (mpack_write(&tb, &p, &pl, &tok) != MPACK_OK) return false;
+  }
+  return static_cast<std::size_t>(p - buf) == N
+    && !std::memcmp(buf, b.data, N);
+}
+
+template <std::uint64_t V>
+static void check_uint()
+{
+  ok(same(mpack::pack_uint<V>(), {mpack_pack_uint(V)}),
+      "pack_uint<%llu> matches mpack_write", (unsigned long long)V);
+}
+
+template <std::int64_t V>
+static void check_sint()
+{
+  ok(same(mpack::pack_sint<V>(), {mpack_pack_sint(V)}),
+      "pack_sint<%lld> matches mpack_write", (long long)V);
+}
+
+template <std::uint32_t N>
+static void check_containers()
+{
+  ok(same(mpack::pack_array<N>(), {mpack_pack_array(N)})
+      && same(mpack::pack_map<N>(), {mpack_pack_map(N)}),
+      "pack_array<%u> and pack_map<%u> match mpack_write", (unsigned)N,
+      (unsigned)N);
+}
+
+template <std::size_t N>
+static void check_str(const char (&s)[N])
+{
+  mpack_uint32_t len = static_cast<mpack_uint32_t>(N - 1);
+  ok(same(mpack::pack_str(s), {mpack_pack_str(len), mpack_pack_chunk(s, len)}),
+      "pack_str of %u bytes matches mpack_write", (unsigned)len);
+}
+
+int main()
+{
+  ok(same(mpack::pack_nil(), {mpack_pack_nil()}),
+      "pack_nil matches mpack_write");
+  ok(same(mpack::pack_boolean<true>(), {mpack_pack_boolean(1)})
+      && same(mpack::pack_boolean<false>(), {mpack_pack_boolean(0)}),
+      "pack_boolean matches mpack_write");
+
+  check_uint<0>();
+  check_uint<0x7f>();
+  check_uint<0x80>();
+  check_uint<0xff>();
+  check_uint<0x100>();
+  check_uint<0xffff>();
+  check_uint<0x10000>();
+  check_uint<0xffffffff>();
+  check_uint<0x100000000>();
+  check_uint<std::numeric_limits<std::uint64_t>::max()>();
+
+  check_sint<1>();
+  check_sint<-1>();
+  check_sint<-32>();
+  check_sint<-33>();
+  check_sint<-128>();
+  check_sint<-129>();
+  check_sint<-32768>();
+  check_sint<-32769>();
+  check_sint<-2147483647 - 1>();
+  check_sint<-2147483647LL - 2>();
+  check_sint<std::numeric_limits<std::int64_t>::min()>();
+
+#ifdef MPACK_HPP_FLOAT
+  static_assert(mpack::pack_float(1.5f).data[1] == 0x3f
+      && mpack::pack_float(1.5f).data[2] == static_cast<char>(0xc0),
+      "float 32 is encoded at compile time");
+  const float floats[] = {
+    0.0f, -0.0f, 1.5f, -1e-30f, std::numeric_limits<float>::infinity()
+  };
+  for (float f : floats) {
+    ok(same(mpack::pack_float(f), {mpack_pack_float(f)}),
+        "pack_float(%g) matches mpack_write", static_cast<double>(f));
+  }
+  const double doubles[] = {
+    0.0, -0.0, 0.1, -2.5e300, -std::numeric_limits<double>::infinity(),
+    std::nan("")
+  };
+  for (double d : doubles) {
+    ok(same(mpack::pack_double(d), {mpack_pack_double(d)}),
+        "pack_double(%g) matches mpack_write", d);
+  }
+#endif
+
+  check_str("");
+  check_str("abc");
+  check_str("0123456789012345678901234567890");
+  check_str("01234567890123456789012345678901");
+  static char str16[0x101];
+  std::memset(str16, 'x', sizeof(str16) - 1);
+  check_str(str16);
+
+  check_containers<0>();
+  check_containers<15>();
+  check_containers<16>();
+  check_containers<0xffff>();
+  check_containers<0x10000>();
+
+  constexpr auto msg = mpack::concat(mpack::pack_array<3>(),
+      mpack::pack_uint<0>(), mpack::pack_str("add"), mpack::pack_nil());
+  ok(same(msg, {mpack_pack_array(3), mpack_pack_uint(0), mpack_pack_str(3),
+        mpack_pack_chunk("add", 3), mpack_pack_nil()}),
+      "concat matches writing the tokens in order");
+
+  char out[8], *w = out;
+  std::size_t wl = sizeof(out);
+  ok(mpack::write(&w, &wl, msg) == MPACK_OK && wl == sizeof(out) - msg.size()
+      && mpack::write(&w, &wl, msg) == MPACK_EOF
+      && wl == sizeof(out) - msg.size(),
+      "write appends whole constants only");
+
+  done_testing();
+}
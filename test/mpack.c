@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <locale.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -29,6 +30,12 @@
 #else
 # include "../build/mpack.h"
 #endif
+#if MPACK_RING_ATOMIC
+# include <pthread.h>
+# include <sched.h>
+#endif
+/* generated by mpack-gen from test/schema.idl */
+#include "schema_gen.c"
 
 static char buf[0xffffff];
 static size_t bufpos;
@@ -241,6 +248,7 @@ static void parse_enter(mpack_parser_t *parser, mpack_node_t *node)
       w("["); break;
     case MPACK_TOKEN_MAP:
       w("{"); break;
+    default: break;
   }
   return;
 
@@ -371,6 +379,65 @@ static void signed_positive_packs_with_unsigned_format(void)
       "signed positive packs with unsigned format");
 }
 
+static void negative_boundaries_pack_with_smallest_format(void)
+{
+  mpack_sintmax_t values[] = {-32, -33, -128, -129, -32768, -32769};
+  char mpackbuf[32];
+  char *buf = mpackbuf;
+  size_t buflen = sizeof(mpackbuf);
+  mpack_tokbuf_t writer = MPACK_TOKBUF_INITIAL_VALUE;
+  for (size_t i = 0; i < ARRAY_SIZE(values); i++) {
+    mpack_token_t tok = mpack_pack_sint(values[i]);
+    mpack_write(&writer, &buf, &buflen, &tok);
+  }
+  uint8_t expected[] = {
+    0xe0,
+    0xd0, 0xdf,
+    0xd0, 0x80,
+    0xd1, 0xff, 0x7f,
+    0xd1, 0x80, 0x00,
+    0xd2, 0xff, 0xff, 0x7f, 0xff
+  };
+  ok((size_t)(buf - mpackbuf) == sizeof(expected));
+  cmp_mem(expected, mpackbuf, sizeof(expected),
+      "negative boundaries pack with the smallest format");
+}
+
+static void negative_boundaries_roundtrip(void)
+{
+  /* the last value of each format and the first one needing the next */
+  mpack_sintmax_t values[] = {
+    -32, -33, -128, -129, -32768, -32769,
+#ifndef FORCE_32BIT_INTS
+    -(mpack_sintmax_t)2147483647 - 1, -(mpack_sintmax_t)2147483647 - 2
+#endif
+  };
+  uint8_t formats[] = {
+    0xe0, 0xd0, 0xd0, 0xd1, 0xd1, 0xd2,
+#ifndef FORCE_32BIT_INTS
+    0xd2, 0xd3
+#endif
+  };
+  bool formats_ok = true, values_ok = true;
+  for (size_t i = 0; i < ARRAY_SIZE(values); i++) {
+    char mpackbuf[9];
+    char *buf = mpackbuf;
+    size_t buflen = sizeof(mpackbuf);
+    const char *rbuf = mpackbuf;
+    size_t rbuflen;
+    mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+    mpack_token_t tok = mpack_pack_sint(values[i]);
+    mpack_write(&tb, &buf, &buflen, &tok);
+    formats_ok = formats_ok && (uint8_t)mpackbuf[0] == formats[i];
+    rbuflen = sizeof(mpackbuf) - buflen;
+    mpack_tokbuf_init(&tb);
+    values_ok = values_ok && !mpack_read(&tb, &rbuf, &rbuflen, &tok)
+      && !rbuflen && mpack_unpack_sint(tok) == values[i];
+  }
+  ok(formats_ok, "negative boundaries switch format at the right value");
+  ok(values_ok, "negative boundaries read back unchanged");
+}
+
 static void positive_signed_format_unpacks_as_unsigned(void)
 {
   mpack_tokbuf_t reader;
@@ -479,6 +546,122 @@ static void unparsing_very_deep_objects_returns_enomem(void)
   cmp_mem(e3, buf, 3);
 }
 
+static size_t spans[16][2];
+static size_t span_count;
+
+static void span_enter(mpack_parser_t *parser, mpack_node_t *node)
+{
+  (void)parser;
+  (void)node;
+}
+
+static void span_exit(mpack_parser_t *parser, mpack_node_t *node)
+{
+  (void)parser;
+  /* chunks depend on how the input is split */
+  if (node->tok.type == MPACK_TOKEN_CHUNK) return;
+  spans[span_count][0] = node->start;
+  spans[span_count++][1] = node->end;
+}
+
+static void span_unparse_exit(mpack_parser_t *parser, mpack_node_t *node)
+{
+  unparse_exit(parser, node);
+  span_exit(parser, node);
+}
+
+static void parse_reports_spans(void)
+{
+  /* [1, "ab", {"k": null}] */
+  const uint8_t input[] = {
+    0x93, 0x01, 0xa2, 'a', 'b', 0x81, 0xa1, 'k', 0xc0
+  };
+  /* in exit order */
+  const size_t expected[][2] = {
+    {1, 2}, {2, 5}, {6, 8}, {8, 9}, {5, 9}, {0, 9}
+  };
+  static const char *const keys[] = {"k"};
+  mpack_keyset_t ks;
+  mpack_keyset_init(&ks, keys, 1);
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes) * 2; i++) {
+    mpack_parser_t parser;
+    size_t cs = chunksizes[i / 2];
+    const char *b = (const char *)input;
+    int s;
+    span_count = 0;
+    mpack_parser_init(&parser, 0);
+    /* a keyset delivers the key in one chunk, the spans must not change */
+    parser.keyset = i % 2 ? &ks : NULL;
+    /* offsets are relative to the first call */
+    do {
+      size_t bl = MIN(cs, sizeof(input) - (size_t)((const uint8_t *)b - input));
+      s = mpack_parse(&parser, &b, &bl, span_enter, span_exit);
+    } while (s == MPACK_EOF);
+    ok(s == MPACK_OK && span_count == ARRAY_SIZE(expected)
+        && !memcmp(spans, expected, sizeof(expected))
+        && parser.offset == sizeof(input),
+        "parse reports spans in steps of %zu%s", cs,
+        i % 2 ? " with a keyset" : "");
+  }
+
+  mpack_parser_t parser;
+  char out[16];
+  char *b = out;
+  size_t bl = sizeof(out);
+  mpack_parser_init(&parser, 0);
+  parser.data.p = "[1, \"s:ab\", {\"k\": null}]";
+  span_count = 0;
+  ok(mpack_unparse(&parser, &b, &bl, unparse_enter, span_unparse_exit)
+      == MPACK_OK
+      && span_count == ARRAY_SIZE(expected)
+      && !memcmp(spans, expected, sizeof(expected)),
+      "unparse reports spans of the output");
+}
+
+static const uint8_t raw_fragment[] = {
+  0x82, 0xa1, 'a', 0x92, 0x01, 0x02, 0xa1, 'b', 0xc4, 0x02, 0xff, 0x00
+};
+
+static void raw_unparse_enter(mpack_parser_t *parser, mpack_node_t *node)
+{
+  mpack_node_t *parent = MPACK_PARENT_NODE(node);
+  (void)parser;
+  if (!parent) {
+    node->tok = mpack_pack_array(3);
+  } else if (parent->pos == 1) {
+    node->tok = mpack_pack_raw((const char *)raw_fragment,
+        sizeof(raw_fragment));
+  } else {
+    node->tok = mpack_pack_uint(parent->pos);
+  }
+}
+
+static void unparse_writes_raw_values(void)
+{
+  uint8_t expected[3 + sizeof(raw_fragment)] = {0x93, 0x00};
+  memcpy(expected + 2, raw_fragment, sizeof(raw_fragment));
+  expected[sizeof(expected) - 1] = 0x02;
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    mpack_parser_t parser;
+    char out[32];
+    char *b = out;
+    size_t cs = chunksizes[i];
+    int s;
+    span_count = 0;
+    mpack_parser_init(&parser, 0);
+    do {
+      size_t bl = MIN(cs, sizeof(out) - (size_t)(b - out));
+      s = mpack_unparse(&parser, &b, &bl, raw_unparse_enter, span_exit);
+    } while (s == MPACK_EOF);
+    ok(s == MPACK_OK && (size_t)(b - out) == sizeof(expected)
+        && !memcmp(out, expected, sizeof(expected)) && span_count == 4
+        && spans[1][0] == 2 && spans[1][1] == 2 + sizeof(raw_fragment),
+        "unparse writes raw values in steps of %zu", cs);
+  }
+}
+
 static void parse_throw(void)
 {
   bufpos = 0;
@@ -604,137 +787,2581 @@ static void rpc_request_id_wrap(void)
   ok(session.slots[1].used && session.slots[1].msg.id == 1);
 }
 
-static int reqdata;
-static void rpc_check_outgoing(mpack_rpc_session_t *session,
-    struct rpc_message *m, size_t cs, bool invert)
-{
-  uint8_t buf[MSGPACK_BUFLEN];
-  uint8_t *b = buf;
-  uint8_t rbuf[MSGPACK_BUFLEN];
-  char *ptr = (char *)rbuf;
-  to_msgpack(m->payload + 2, &b);
+static int key_ids[8], key_chunks;
+static size_t key_count;
 
-  int status = MPACK_EOF;
-  while (status == MPACK_EOF) {
-    size_t bl = cs;
-    if (m->type == MPACK_RPC_REQUEST || m->payload[3] == '0') {
-      status = mpack_rpc_request(session, &ptr, &bl, d(&reqdata));
-    } else if (m->type == MPACK_RPC_RESPONSE || m->payload[3] == '1') {
-      status = mpack_rpc_reply(session, &ptr, &bl, m->id);
-    } else if (m->type == MPACK_RPC_NOTIFICATION || m->payload[3] == '2') {
-      status = mpack_rpc_notify(session, &ptr, &bl);
-    } else return; /* inverted error checking, return */
+static void keyset_parse_enter(mpack_parser_t *parser, mpack_node_t *node)
+{
+  mpack_node_t *parent = MPACK_PARENT_NODE(node);
+  if (node->tok.type == MPACK_TOKEN_STR && parent
+      && parent->tok.type == MPACK_TOKEN_MAP && !parent->key_visited) {
+    key_ids[key_count++] = node->key_id;
+  } else if (node->tok.type == MPACK_TOKEN_CHUNK && parent->key_id
+      != MPACK_KEY_UNKNOWN) {
+    key_chunks++;
+  } else if (node->key_id != MPACK_KEY_UNKNOWN) {
+    key_ids[key_count++] = 100;  /* only map keys have ids */
   }
-  if (m->type == MPACK_RPC_REQUEST) {
-    to_msgpack(m->method, (uint8_t **)&ptr);
-    to_msgpack(m->args, (uint8_t **)&ptr);
-  } else if (m->type == MPACK_RPC_RESPONSE) {
-    to_msgpack(m->error, (uint8_t **)&ptr);
-    to_msgpack(m->result, (uint8_t **)&ptr);
-  } else if (m->type == MPACK_RPC_NOTIFICATION) {
-    to_msgpack(m->method, (uint8_t **)&ptr);
-    to_msgpack(m->args, (uint8_t **)&ptr);
-  } else {
-    if (!invert)
-      ok(status == m->type, "%s: expected error matched", m->payload);
-    return;
+  parse_enter(parser, node);
+}
+
+static void parse_interns_keys(void)
+{
+  static const char *const keys[] = {"id", "name", "a_rather_long_key", ""};
+  mpack_keyset_t ks, dup;
+  const char *dupkeys[] = {"x", "x"};
+  const char *json = "{\"id\":1,\"name\":{\"id\":\"s:name\","
+    "\"a_rather_long_key\":[\"s:id\"],\"\":2,"
+    "\"this_key_is_longer_than_thirty_one_bytes\":3},\"nam\":4}";
+  const int expected[] = {0, 1, 0, 2, 3, MPACK_KEY_UNKNOWN, MPACK_KEY_UNKNOWN};
+  uint8_t msgpack[MSGPACK_BUFLEN];
+  uint8_t *end = msgpack;
+
+  ok(mpack_keyset_init(&ks, keys, ARRAY_SIZE(keys)) == MPACK_OK);
+  ok(mpack_keyset_init(&dup, dupkeys, ARRAY_SIZE(dupkeys)) == MPACK_ERROR,
+      "keyset with duplicate keys is rejected");
+  ok((mpack_keyset_lookup(&ks, "name", 4) == 1
+      && mpack_keyset_lookup(&ks, "nama", 4) == MPACK_KEY_UNKNOWN),
+      "keyset lookup");
+  to_msgpack(json, &end);
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    mpack_parser_t parser;
+    const char *b = (const char *)msgpack;
+    size_t cs = chunksizes[i];
+    int s;
+    bufpos = 0;
+    key_count = 0;
+    key_chunks = 0;
+    mpack_parser_init(&parser, 0);
+    parser.keyset = &ks;
+    do {
+      size_t bl = MIN(cs, (size_t)(end - (uint8_t *)b));
+      s = mpack_parse(&parser, &b, &bl, keyset_parse_enter, parse_exit);
+    } while (s == MPACK_EOF);
+    is(buf, json, "parse with a keyset in steps of %zu", cs);
+    ok(key_count == ARRAY_SIZE(expected)
+        && !memcmp(key_ids, expected, sizeof(expected)) && key_chunks == 4,
+        "keys are interned in steps of %zu", cs);
   }
-  cmp_mem(buf, rbuf, (size_t)((uint8_t *)ptr - rbuf),
-      cs == SIZE_MAX ? "%s: outgoing message matches in a single step" :
-      "%s: outgoing message matches in steps of %zu%s", m->payload, cs,
-      invert ? " (inverted)" : "");
 }
 
-static const char *get_error_string(int type)
+struct point {
+  mpack_sint32_t x, y;
+};
+
+struct shape {
+  char label[8];
+  int visible;
+  mpack_uintmax_t id;
+  mpack_sintmax_t delta;
+  double area;
+  float ratio;
+  struct point origin;
+};
+
+static mpack_schema_t point_schema, shape_schema;
+
+static const mpack_field_t point_fields[] = {
+  MPACK_FIELD(struct point, x, "x", MPACK_FIELD_SINT32),
+  MPACK_FIELD(struct point, y, "y", MPACK_FIELD_SINT32)
+};
+
+static const mpack_field_t shape_fields[] = {
+  MPACK_FIELD(struct shape, label, "label", MPACK_FIELD_STR),
+  MPACK_FIELD(struct shape, visible, "visible", MPACK_FIELD_BOOLEAN),
+  MPACK_FIELD(struct shape, id, "id", MPACK_FIELD_UINT),
+  MPACK_FIELD(struct shape, delta, "delta", MPACK_FIELD_SINT),
+  MPACK_FIELD(struct shape, area, "area", MPACK_FIELD_DOUBLE),
+  MPACK_FIELD(struct shape, ratio, "ratio", MPACK_FIELD_FLOAT),
+  MPACK_FIELD_NESTED(struct shape, origin, "origin", &point_schema)
+};
+
+static void schema_init(void)
 {
-  if (type == MPACK_RPC_EARRAY) return "invalid array";
-  if (type == MPACK_RPC_EARRAYL) return "invalid array length";
-  else if (type == MPACK_RPC_ETYPE) return "invalid message type"; 
-  else if (type == MPACK_RPC_EMSGID) return "invalid message id"; 
-  else if (type == MPACK_RPC_ERESPID) return "unmatched response id"; else abort();
+  mpack_schema_t s;
+  const mpack_field_t dup[] = {
+    MPACK_FIELD(struct point, x, "x", MPACK_FIELD_SINT32),
+    MPACK_FIELD(struct point, y, "x", MPACK_FIELD_SINT32)
+  };
+  ok(mpack_schema_init(&point_schema, point_fields,
+        ARRAY_SIZE(point_fields)) == MPACK_OK);
+  ok(mpack_schema_init(&shape_schema, shape_fields,
+        ARRAY_SIZE(shape_fields)) == MPACK_OK);
+  ok(mpack_schema_init(&s, dup, ARRAY_SIZE(dup)) == MPACK_ERROR,
+      "schema with duplicate keys is rejected");
+  ok((mpack_schema_lookup(&shape_schema, "origin", 6) == shape_fields + 6
+      && mpack_schema_lookup(&shape_schema, "ratio", 5) == shape_fields + 5
+      && !mpack_schema_lookup(&shape_schema, "ratios", 6)
+      && !mpack_schema_lookup(&shape_schema, "", 0)),
+      "schema lookup");
 }
 
-static void rpc_check_incoming(mpack_rpc_session_t *session,
-    struct rpc_message *m, size_t cs, bool invert)
+static int schema_decode_raw(uint8_t *msgpack, uint8_t *end,
+    struct shape *out, size_t cs, size_t *trailing)
 {
-  uint8_t buf[MSGPACK_BUFLEN];
-  uint8_t *b = buf;
-  uint8_t dbuf[MSGPACK_BUFLEN];
-  uint8_t *db = dbuf;
-  const char *ptr = (const char *)buf;
-  to_msgpack(m->payload + 2, &b);
-  mpack_rpc_message_t msg;
-  int type = MPACK_EOF;
-  while (type == MPACK_EOF) {
-    size_t bl = cs;
-    type = mpack_rpc_receive(session, &ptr, &bl, &msg);
+  mpack_schema_decoder_t decoder;
+  const char *b = (const char *)msgpack;
+  int status;
+  memset(out, 0, sizeof(*out));
+  mpack_schema_decoder_init(&decoder, &shape_schema, out);
+  do {
+    size_t bl = MIN(cs, (size_t)(end - (uint8_t *)b));
+    status = mpack_schema_decode(&decoder, &b, &bl);
+  } while (status == MPACK_EOF && b < (const char *)end);
+  *trailing = (size_t)(end - (uint8_t *)b);
+  return status;
+}
+
+static int schema_decode(const char *json, struct shape *out, size_t cs,
+    size_t *trailing)
+{
+  uint8_t msgpack[MSGPACK_BUFLEN];
+  uint8_t *end = msgpack;
+  to_msgpack(json, &end);
+  /* trailing data must not be consumed */
+  *end++ = 0xc0;
+  return schema_decode_raw(msgpack, end, out, cs, trailing);
+}
+
+static void schema_decodes_structs(void)
+{
+  const char *json = "{\"id\": 7, \"unknown\": [1, {\"a\": [2, 3]}], "
+    "\"label\": \"hello\", \"visible\": true, \"delta\": -300, "
+    "\"area\": 2.5, \"ratio\": 0.5, "
+    "\"long_key_that_is_more_than_thirty_one\": {\"x\": 1}, "
+    "\"origin\": {\"y\": -1, \"x\": 70000, \"z\": null}, \"label\": null}";
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    struct shape s;
+    size_t trailing;
+    int status = schema_decode(json, &s, chunksizes[i], &trailing);
+    ok(status == MPACK_OK && trailing == 1 && !strcmp(s.label, "hello")
+        && s.visible == 1 && s.id == 7 && s.delta == -300 && s.area == 2.5
+        && s.ratio == 0.5f && s.origin.x == 70000 && s.origin.y == -1,
+        "schema decode in steps of %zu", chunksizes[i]);
   }
-  bool result;
-  if (m->type == MPACK_RPC_REQUEST) {
-    result = msg.id == m->id;
-    to_msgpack(m->method, &db);
-    to_msgpack(m->args, &db);
-  } else if (m->type == MPACK_RPC_RESPONSE) {
-    to_msgpack(m->error, &db);
-    to_msgpack(m->result, &db);
-    result = msg.id == m->id;
-    result = msg.data.p == &reqdata;
-  } else if (m->type == MPACK_RPC_NOTIFICATION) {
-    result = true;
-    to_msgpack(m->method, &db);
-    to_msgpack(m->args, &db);
-  } else {
-    if (!invert)
-      ok(type == m->type, "%s: expected error matched(%s)", m->payload,
-          get_error_string(type));
-    return;
+}
+
+static void schema_decode_rejects_mismatches(void)
+{
+  struct shape s;
+  size_t trailing;
+  ok(schema_decode("{\"label\": 5}", &s, SIZE_MAX, &trailing)
+      == MPACK_ERROR, "schema decode rejects type mismatches");
+  ok(schema_decode("{\"label\": \"too long!\"}", &s, SIZE_MAX, &trailing)
+      == MPACK_ERROR, "schema decode rejects strings that don't fit");
+  uint8_t range[] = {
+    0x81, 0xa6, 'o', 'r', 'i', 'g', 'i', 'n',
+    0x81, 0xa1, 'x', 0xce, 0x80, 0x00, 0x00, 0x00
+  };
+  ok(schema_decode_raw(range, range + sizeof(range), &s, SIZE_MAX, &trailing)
+      == MPACK_ERROR, "schema decode checks integer ranges");
+  ok(schema_decode("{\"id\": -1}", &s, SIZE_MAX, &trailing) == MPACK_ERROR,
+      "schema decode rejects negative unsigned fields");
+  ok(schema_decode("[1]", &s, SIZE_MAX, &trailing) == MPACK_ERROR,
+      "schema decode requires a map");
+}
+
+static void schema_encodes_structs(void)
+{
+  uint8_t expected[MSGPACK_BUFLEN];
+  uint8_t *e = expected;
+  struct shape s, decoded;
+  size_t trailing;
+  memset(&s, 0, sizeof(s));
+  strcpy(s.label, "hello");
+  s.visible = 1;
+  s.id = 7;
+  s.delta = -300;
+  s.area = 2.5;
+  s.ratio = 0.5f;
+  s.origin.x = 70000;
+  s.origin.y = -1;
+  to_msgpack("{\"label\": \"hello\", \"visible\": true, \"id\": 7, "
+      "\"delta\": -300, \"area\": 2.5, \"ratio\": 0.5, "
+      "\"origin\": {\"x\": 70000, \"y\": -1}}", &e);
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    mpack_schema_encoder_t encoder;
+    uint8_t out[MSGPACK_BUFLEN];
+    char *b = (char *)out;
+    size_t cs = chunksizes[i];
+    int status;
+    mpack_schema_encoder_init(&encoder, &shape_schema, &s);
+    do {
+      size_t bl = MIN(cs, sizeof(out) - (size_t)((uint8_t *)b - out));
+      status = mpack_schema_encode(&encoder, &b, &bl);
+    } while (status == MPACK_EOF);
+    ok(status == MPACK_OK
+        && (size_t)((uint8_t *)b - out) == (size_t)(e - expected)
+        && !memcmp(out, expected, (size_t)(e - expected)),
+        "schema encode in steps of %zu", cs);
+    ok(schema_decode_raw(out, (uint8_t *)b, &decoded, SIZE_MAX, &trailing)
+        == MPACK_OK && !memcmp(&decoded, &s, sizeof(s)),
+        "schema encode roundtrip in steps of %zu", cs);
   }
 
-  result = result && type == m->type;
-  ok(result && !memcmp(dbuf, ptr, (size_t)(db - dbuf)),
-      cs == SIZE_MAX ? "%s: incoming message matches in a single step" :
-      "%s: incoming message matches in steps of %zu%s", m->payload, cs,
-      invert ? " (inverted)" : "");
+  /* a label without NUL is cut to what the decoder accepts */
+  uint8_t out[MSGPACK_BUFLEN];
+  char *b = (char *)out;
+  size_t bl = sizeof(out);
+  mpack_schema_encoder_t encoder;
+  memset(s.label, 'x', sizeof(s.label));
+  mpack_schema_encoder_init(&encoder, &shape_schema, &s);
+  ok(mpack_schema_encode(&encoder, &b, &bl) == MPACK_OK
+      && schema_decode_raw(out, (uint8_t *)b, &decoded, SIZE_MAX, &trailing)
+      == MPACK_OK && strlen(decoded.label) == sizeof(s.label) - 1,
+      "schema encode cuts strings that aren't NUL-terminated");
 }
 
-static void rpc_fixture_test(int fixture_idx)
+static void schema_gen_matches_runtime(void)
 {
-  const struct rpc_fixture *fixture = rpc_fixtures + fixture_idx;
+  mpack_schema_t s;
+  ok((mpack_schema_init(&s, sprite_fields, ARRAY_SIZE(sprite_fields))
+      == MPACK_OK && s.count == sprite_schema.count
+      && !memcmp(s.first, sprite_schema.first, sizeof(s.first))
+      && !memcmp(s.next, sprite_schema.next, s.count)
+      && !memcmp(s.keylen, sprite_schema.keylen, s.count)),
+      "generated schema tables match mpack_schema_init");
+}
+
+static void schema_gen_encodes_structs(void)
+{
+  uint8_t expected[MSGPACK_BUFLEN], packed[SPRITE_MAX_SIZE];
+  char *b = (char *)expected;
+  size_t bl = sizeof(expected);
+  mpack_schema_encoder_t encoder;
+  struct sprite s;
+  memset(&s, 0, sizeof(s));
+  strcpy(s.label, "hello");
+  s.visible = 1;
+  s.id = 7;
+  s.delta = -300;
+  s.area = 2.5;
+  s.ratio = 0.5f;
+  s.origin.x = 70000;
+  s.origin.y = -1;
+  s.frame = 0xffffffff;
+  mpack_schema_encoder_init(&encoder, &sprite_schema, &s);
+  ok(mpack_schema_encode(&encoder, &b, &bl) == MPACK_OK);
+  size_t len = (size_t)((uint8_t *)b - expected);
+  ok((sprite_pack(&s, (char *)packed) == len
+      && !memcmp(packed, expected, len)),
+      "generated pack matches the schema encoder");
 
   for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
-    for (size_t j = 0; j < 2; j++) { /* test the library from both endpoints */ 
-      mpack_rpc_session_t session;
-      mpack_rpc_session_init(&session, fixture->capacity);
-      for (size_t k = 0; k < fixture->count; k++) {
-        size_t cs = chunksizes[i];
-        struct rpc_message *msg = fixture->messages + k;
-        if (msg->payload[0] == '<') {
-          if (j) rpc_check_outgoing(&session, msg, cs, j);
-          else rpc_check_incoming(&session, msg, cs, j);
-        } else if (msg->payload[1] == '>') {
-          if (j) rpc_check_incoming(&session, msg, cs, j);
-          else rpc_check_outgoing(&session, msg, cs, j);
-        }
-      }
+    uint8_t out[MSGPACK_BUFLEN];
+    size_t cs = chunksizes[i];
+    int status;
+    b = (char *)out;
+    sprite_encoder_init(&encoder, &s);
+    do {
+      bl = MIN(cs, sizeof(out) - (size_t)((uint8_t *)b - out));
+      status = sprite_encode(&encoder, &b, &bl);
+    } while (status == MPACK_EOF);
+    ok(status == MPACK_OK && (size_t)((uint8_t *)b - out) == len
+        && !memcmp(out, expected, len),
+        "generated encode in steps of %zu", cs);
+  }
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    mpack_schema_decoder_t decoder;
+    struct sprite decoded;
+    const char *rb = (const char *)expected;
+    const char *end = rb + len;
+    size_t cs = chunksizes[i];
+    int status;
+    memset(&decoded, 0, sizeof(decoded));
+    sprite_decoder_init(&decoder, &decoded);
+    do {
+      bl = MIN(cs, (size_t)(end - rb));
+      status = sprite_decode(&decoder, &rb, &bl);
+    } while (status == MPACK_EOF && rb < end);
+    ok(status == MPACK_OK && rb == end
+        && !memcmp(&decoded, &s, sizeof(s)),
+        "generated decode in steps of %zu", cs);
+  }
+
+  /* the largest message, with a label that isn't NUL-terminated */
+  memset(s.label, 'x', sizeof(s.label));
+  s.id = (mpack_uintmax_t)-1;
+  s.delta = -(mpack_sintmax_t)(s.id >> 1) - 1;
+  s.area = 0.1;
+  s.origin.x = INT32_MIN;
+  s.origin.y = INT32_MIN;
+  b = (char *)expected;
+  bl = sizeof(expected);
+  mpack_schema_encoder_init(&encoder, &sprite_schema, &s);
+  ok(mpack_schema_encode(&encoder, &b, &bl) == MPACK_OK);
+  len = (size_t)((uint8_t *)b - expected);
+  ok(len <= SPRITE_MAX_SIZE && sprite_pack(&s, (char *)packed) == len
+      && !memcmp(packed, expected, len),
+      "generated pack stays within the maximum size");
+  /* schema_gen.c is included above, so the fast path can be called alone */
+  struct sprite decoded;
+  const char *rb = (const char *)packed;
+  ok(sprite_unpack(&decoded, &rb, rb + len) && rb == (char *)packed + len
+      && !strcmp(decoded.label, "xxxxxxx")
+      && decoded.id == s.id && decoded.delta == s.delta
+      && decoded.area == s.area && decoded.origin.x == INT32_MIN
+      && decoded.origin.y == INT32_MIN && decoded.frame == s.frame,
+      "generated decode reads the widest values");
+}
+
+static void schema_gen_decodes_out_of_order(void)
+{
+  uint8_t msgpack[MSGPACK_BUFLEN];
+  uint8_t *end = msgpack;
+  mpack_schema_decoder_t decoder;
+  struct sprite s;
+  to_msgpack("{\"origin\": {\"y\": 2, \"x\": 1}, \"frame-index\": 9, "
+      "\"extra\": [1, 2], \"label\": \"abc\", \"id\": 3}", &end);
+  const char *b = (const char *)msgpack;
+  size_t bl = (size_t)(end - msgpack);
+  memset(&s, 0, sizeof(s));
+  sprite_decoder_init(&decoder, &s);
+  ok(sprite_decode(&decoder, &b, &bl) == MPACK_OK && !bl
+      && s.origin.x == 1 && s.origin.y == 2 && s.frame == 9
+      && !strcmp(s.label, "abc") && s.id == 3 && !s.visible,
+      "generated decode falls back for out of order keys");
+  uint8_t mismatch[] = {0x81, 0xa2, 'i', 'd', 0xa1, 'x'};
+  b = (const char *)mismatch;
+  bl = sizeof(mismatch);
+  sprite_decoder_init(&decoder, &s);
+  ok(sprite_decode(&decoder, &b, &bl) == MPACK_ERROR,
+      "generated decode reports type mismatches");
+}
+
+static void index_finds_map_values(void)
+{
+  static char buf[32768];
+  static mpack_index_slot_t slots[2048];
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  mpack_index_t index;
+  char *b = buf;
+  size_t bl = sizeof(buf);
+  char key[16];
+  mpack_token_t tok = mpack_pack_map(1002);
+  mpack_write(&tb, &b, &bl, &tok);
+  for (int i = 0; i < 1000; i++) {
+    int len = snprintf(key, sizeof(key), "k%d", i);
+    tok = mpack_pack_str((mpack_uint32_t)len);
+    mpack_write(&tb, &b, &bl, &tok);
+    memcpy(b, key, (size_t)len);
+    b += len;
+    bl -= (size_t)len;
+    tok = i % 2 ? mpack_pack_array(1) : mpack_pack_uint((mpack_uintmax_t)i);
+    mpack_write(&tb, &b, &bl, &tok);
+    if (i % 2) {
+      tok = mpack_pack_sint(-i);
+      mpack_write(&tb, &b, &bl, &tok);
+    }
+  }
+  /* non-string keys are not indexed, duplicate keys keep the first value */
+  const uint8_t tail[] = {0x01, 0xc0, 0xa2, 'k', '0', 0xc3};
+  memcpy(b, tail, sizeof(tail));
+  b += sizeof(tail);
+  size_t len = (size_t)(b - buf);
+
+  ok(mpack_index_init(&index, slots, 1000) == MPACK_ERROR,
+      "index capacity must be a power of two");
+  ok(mpack_index_init(&index, slots, 1024) == MPACK_OK);
+  ok(mpack_index_build(&index, buf, len) == MPACK_OK && index.count == 1000,
+      "index build");
+  bool found = true;
+  for (int i = 0; i < 1000; i++) {
+    int kl = snprintf(key, sizeof(key), "k%d", i);
+    const mpack_index_slot_t *slot = mpack_index_find(&index, buf, key,
+        (mpack_uint32_t)kl);
+    mpack_tokbuf_t vtb = MPACK_TOKBUF_INITIAL_VALUE;
+    const char *v = slot ? buf + slot->value : buf;
+    size_t vl = slot ? slot->end - slot->value : 0;
+    if (!slot || mpack_read(&vtb, &v, &vl, &tok)) {
+      found = false;
+      break;
+    }
+    if (i % 2) {
+      found = found && tok.type == MPACK_TOKEN_ARRAY && !mpack_read(&vtb, &v,
+          &vl, &tok) && mpack_unpack_sint(tok) == -i && !vl;
+    } else {
+      found = found && mpack_unpack_uint(tok) == (mpack_uintmax_t)i && !vl;
     }
   }
+  ok(found, "index finds every value");
+  ok((!mpack_index_find(&index, buf, "k1000", 5)
+      && !mpack_index_find(&index, buf, "", 0)),
+      "index lookup of missing keys");
+
+  ok(mpack_index_init(&index, slots, 2048) == MPACK_OK
+      && mpack_index_build(&index, buf, len - 1) == MPACK_EOF,
+      "index build of a truncated map");
+  ok(mpack_index_build(&index, buf, 0) == MPACK_EOF,
+      "index build of an empty buffer");
+  ok(mpack_index_init(&index, slots, 512) == MPACK_OK
+      && mpack_index_build(&index, buf, len) == MPACK_NOMEM,
+      "index build with too few slots");
 }
 
-int main(void)
+static int arena_blocks;
+
+static void *arena_malloc(void *ctx, size_t size)
 {
-  for (int i = 0; i < fixture_count; i++) {
-    fixture_test(fixtures, i);
+  (void)ctx;
+  arena_blocks++;
+  return malloc(size);
+}
+
+static void arena_free(void *ctx, void *ptr)
+{
+  (void)ctx;
+  arena_blocks--;
+  free(ptr);
+}
+
+static const char *arena_strs[8];
+static size_t arena_str_count;
+
+static void arena_enter(mpack_parser_t *parser, mpack_node_t *node)
+{
+  if (mpack_arena_chunk(MPACK_ARENA(parser), node)) MPACK_THROW(parser);
+}
+
+static void arena_exit(mpack_parser_t *parser, mpack_node_t *node)
+{
+  (void)parser;
+  if (node->tok.type == MPACK_TOKEN_STR || node->tok.type == MPACK_TOKEN_BIN) {
+    arena_strs[arena_str_count++] = node->data[0].p;
   }
-  signed_positive_packs_with_unsigned_format();
-  positive_signed_format_unpacks_as_unsigned();
-  unpacking_c1_returns_eread();
-  parsing_very_deep_objects_returns_enomem();
-  unparsing_very_deep_objects_returns_enomem();
-  parse_throw();
-  unparse_throw();
-  does_not_write_invalid_tokens();
-  rpc_copy_session_maintains_state();
-  rpc_request_id_wrap();
+}
+
+static void arena_collects_chunks(void)
+{
+  mpack_arena_t arena;
+  uint8_t msgpack[MSGPACK_BUFLEN];
+  uint8_t *end = msgpack;
+  to_msgpack("{\"a fairly long key\": [\"s:hello world\", \"b:bin\"], "
+      "\"\": \"s:\"}", &end);
+  mpack_arena_init(&arena, arena_malloc, arena_free, NULL, 64);
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    mpack_parser_t parser;
+    const char *b = (const char *)msgpack;
+    size_t cs = chunksizes[i];
+    int s;
+    arena_str_count = 0;
+    mpack_arena_reset(&arena);
+    mpack_parser_init(&parser, 0);
+    parser.data.p = &arena;
+    do {
+      size_t bl = MIN(cs, (size_t)(end - (uint8_t *)b));
+      s = mpack_parse(&parser, &b, &bl, arena_enter, arena_exit);
+    } while (s == MPACK_EOF);
+    ok(s == MPACK_OK && arena_str_count == 5
+        && !strcmp(arena_strs[0], "a fairly long key")
+        && !strcmp(arena_strs[1], "hello world")
+        && !strcmp(arena_strs[2], "bin") && !strcmp(arena_strs[3], "")
+        && !strcmp(arena_strs[4], "") && arena_blocks == 1,
+        "arena collects chunks in steps of %zu", cs);
+  }
+
+  mpack_arena_reset(&arena);
+  char *small = mpack_arena_alloc(&arena, 3);
+  char *big = mpack_arena_alloc(&arena, 1000);
+  char *next = mpack_arena_alloc(&arena, 3);
+  memset(big, 'x', 1000);
+  ok((big && small && arena_blocks == 2
+      && next == small + MPACK_ARENA_ALIGN),
+      "arena gives large allocations their own block");
+  mpack_arena_reset(&arena);
+  ok(arena_blocks == 1, "arena reset frees large blocks and keeps the rest");
+  ok((mpack_arena_alloc(&arena, 8) && arena_blocks == 1),
+      "arena recycles blocks after a reset");
+  mpack_arena_destroy(&arena);
+  ok(arena_blocks == 0, "arena destroy releases every block");
+}
+
+static char dom_out[0xffffff];
+
+static void dom_fixture_test(int fixture_idx)
+{
+  const struct fixture *f = fixtures + fixture_idx;
+  char *fjson;
+  uint8_t *fmsgpack;
+  size_t fmsgpacklen;
+  mpack_arena_t arena;
+  if (f->generator) {
+    f->generator(&fjson, &fmsgpack, &fmsgpacklen, f->generator_size);
+  } else {
+    fjson = f->json;
+    fmsgpack = f->msgpack;
+    fmsgpacklen = f->msgpacklen;
+  }
+  mpack_arena_init(&arena, arena_malloc, arena_free, NULL, 0);
+
+  char repr[32];
+  snprintf(repr, sizeof(repr), "%s", fjson);
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    mpack_dom_t dom;
+    size_t cs = chunksizes[i];
+    const char *b = (const char *)fmsgpack;
+    const char *end = b + fmsgpacklen;
+    int s;
+    mpack_arena_reset(&arena);
+    mpack_dom_init(&dom, &arena, i % 2);
+    do {
+      size_t bl = MIN(cs, (size_t)(end - b));
+      s = mpack_dom_parse(&dom, &b, &bl);
+    } while (s == MPACK_EOF);
+    ok(s == MPACK_OK && b == end, "dom parse '%s' in steps of %zu", repr, cs);
+
+    /* fixtures aren't always in the shortest encoding, so compare the
+     * output by parsing it again */
+    char *w = dom_out;
+    mpack_dom_unparse_init(&dom, dom.root);
+    do {
+      size_t bl = MIN(cs, sizeof(dom_out) - (size_t)(w - dom_out));
+      s = mpack_dom_unparse(&dom, &w, &bl);
+    } while (s == MPACK_EOF);
+    mpack_parser_t parser;
+    const char *r = dom_out;
+    size_t rl = (size_t)(w - dom_out);
+    bufpos = 0;
+    mpack_parser_init(&parser, 0);
+    ok(s == MPACK_OK && mpack_parse(&parser, &r, &rl, parse_enter,
+          parse_exit) == MPACK_OK && !rl,
+        "dom unparse '%s' in steps of %zu", repr, cs);
+    is(buf, fjson);
+    if (!dom.copy) {
+      cmp_mem(dom_out, fmsgpack, fmsgpacklen,
+          "dom writes the original encoding of '%s'", repr);
+    }
+  }
+
+  mpack_arena_destroy(&arena);
+}
+
+static void dom_references_and_mutates(void)
+{
+  mpack_arena_t arena;
+  mpack_dom_t dom;
+  uint8_t msgpack[MSGPACK_BUFLEN], expected[MSGPACK_BUFLEN];
+  uint8_t *end = msgpack, *e = expected;
+  char out[MSGPACK_BUFLEN];
+  to_msgpack("{\"key\": [1, \"s:value\"]}", &end);
+  to_msgpack("{\"key\": [1, \"s:other\", null]}", &e);
+  mpack_arena_init(&arena, arena_malloc, arena_free, NULL, 0);
+
+  const char *b = (const char *)msgpack;
+  size_t bl = (size_t)(end - msgpack);
+  mpack_dom_init(&dom, &arena, 0);
+  ok(mpack_dom_parse(&dom, &b, &bl) == MPACK_OK);
+  mpack_object_t *root = dom.root, *arr = root->v.items + 1;
+  ok((root->tok.type == MPACK_TOKEN_MAP && root->tok.length == 1
+      && root->v.items[0].v.data == (const char *)msgpack + 2
+      && arr->tok.type == MPACK_TOKEN_ARRAY && arr->tok.length == 2
+      && mpack_unpack_uint(arr->v.items[0].tok) == 1
+      && arr->v.items[1].v.data == (const char *)msgpack + 8),
+      "dom references strings in the input buffer");
+
+  b = (const char *)msgpack;
+  bl = (size_t)(end - msgpack);
+  mpack_arena_reset(&arena);
+  mpack_dom_init(&dom, &arena, 1);
+  ok(mpack_dom_parse(&dom, &b, &bl) == MPACK_OK);
+  root = dom.root;
+  arr = root->v.items + 1;
+  ok((!memcmp(arr->v.items[1].v.data, "value", 5)
+      && arr->v.items[1].v.data != (const char *)msgpack + 8),
+      "dom copies strings when asked to");
+
+  /* replace the array with a longer one */
+  mpack_object_t *items = mpack_arena_alloc(&arena, 3 * sizeof(*items));
+  items[0] = arr->v.items[0];
+  items[1].tok = mpack_pack_str(5);
+  items[1].v.data = "other";
+  items[2].tok = mpack_pack_nil();
+  items[1].raw = items[2].raw = NULL;
+  mpack_object_touch(arr);
+  arr->tok = mpack_pack_array(3);
+  arr->v.items = items;
+  char *w = out;
+  bl = sizeof(out);
+  mpack_dom_unparse_init(&dom, root);
+  ok(mpack_dom_unparse(&dom, &w, &bl) == MPACK_OK
+      && (size_t)(w - out) == (size_t)(e - expected)
+      && !memcmp(out, expected, (size_t)(e - expected)),
+      "dom serializes modified objects");
+  mpack_arena_destroy(&arena);
+}
+
+static void dom_reuses_clean_subtrees(void)
+{
+  /* {"a": [1, "x"], "b": [2]} with integers in a longer format */
+  const uint8_t input[] = {
+    0x82, 0xa1, 'a', 0x92, 0xcd, 0x00, 0x01, 0xa1, 'x',
+    0xa1, 'b', 0x91, 0xcd, 0x00, 0x02
+  };
+  const uint8_t expected[] = {
+    0x82, 0xa1, 'a', 0x92, 0xcd, 0x00, 0x01, 0xa1, 'x',
+    0xa1, 'b', 0x91, 0x03
+  };
+  const uint8_t canonical[] = {
+    0x82, 0xa1, 'a', 0x92, 0x01, 0xa1, 'x', 0xa1, 'b', 0x91, 0x03
+  };
+  char spaced[sizeof(input) * 2];
+  mpack_arena_t arena;
+  mpack_arena_init(&arena, arena_malloc, arena_free, NULL, 0);
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    mpack_dom_t dom;
+    const char *b = (const char *)input;
+    size_t cs = chunksizes[i];
+    char out[32];
+    char *w = out;
+    size_t bl;
+    int s;
+    mpack_arena_reset(&arena);
+    mpack_dom_init(&dom, &arena, 0);
+    do {
+      bl = MIN(cs, sizeof(input) - (size_t)((const uint8_t *)b - input));
+      s = mpack_dom_parse(&dom, &b, &bl);
+    } while (s == MPACK_EOF);
+    mpack_object_t *v = dom.root->v.items[3].v.items;
+    mpack_object_touch(v);
+    v->tok = mpack_pack_uint(3);
+    bl = sizeof(out);
+    mpack_dom_unparse_init(&dom, dom.root);
+    ok(s == MPACK_OK && mpack_dom_unparse(&dom, &w, &bl) == MPACK_OK
+        && (size_t)(w - out) == sizeof(expected)
+        && !memcmp(out, expected, sizeof(expected)),
+        "dom reuses clean subtrees in steps of %zu", cs);
+  }
+
+  /* each byte in a separate buffer, no spans can be recorded */
+  mpack_dom_t dom;
+  int s = MPACK_EOF;
+  mpack_arena_reset(&arena);
+  mpack_dom_init(&dom, &arena, 0);
+  for (size_t i = 0; i < sizeof(input) && s == MPACK_EOF; i++) {
+    const char *b = spaced + i * 2;
+    size_t bl = 1;
+    spaced[i * 2] = (char)input[i];
+    s = mpack_dom_parse(&dom, &b, &bl);
+  }
+  dom.root->v.items[3].v.items->tok = mpack_pack_uint(3);
+  char out[32];
+  char *w = out;
+  size_t bl = sizeof(out);
+  mpack_dom_unparse_init(&dom, dom.root);
+  ok(s == MPACK_OK && mpack_dom_unparse(&dom, &w, &bl) == MPACK_OK
+      && (size_t)(w - out) == sizeof(canonical)
+      && !memcmp(out, canonical, sizeof(canonical)),
+      "dom re-encodes values split across separate buffers");
+  mpack_arena_destroy(&arena);
+}
+
+static void template_fills_slots(void)
+{
+  /* [0, msgid, "add", [sint, double, str]] */
+  char tbuf[64];
+  mpack_template_t t;
+  mpack_template_init(&t, tbuf, sizeof(tbuf));
+  mpack_token_t constant[] = {
+    mpack_pack_array(4), mpack_pack_uint(0)
+  };
+  mpack_token_t method[] = {
+    mpack_pack_str(3), mpack_pack_chunk("add", 3), mpack_pack_array(3)
+  };
+  int s = MPACK_OK;
+  for (size_t i = 0; i < ARRAY_SIZE(constant); i++) {
+    s |= mpack_template_write(&t, constant + i);
+  }
+  s |= mpack_template_slot(&t, MPACK_SLOT_UINT);
+  for (size_t i = 0; i < ARRAY_SIZE(method); i++) {
+    s |= mpack_template_write(&t, method + i);
+  }
+  s |= mpack_template_slot(&t, MPACK_SLOT_SINT);
+  s |= mpack_template_slot(&t, MPACK_SLOT_DOUBLE);
+  s |= mpack_template_slot(&t, MPACK_SLOT_STR);
+  ok(s == MPACK_OK && t.size == 34 && t.slot_count == 4,
+      "template records constant bytes and slots");
+
+  const uint8_t expected[] = {
+    0x94, 0x00, 0xcf, 0, 0, 0, 0, 0, 0, 0x01, 0x02,
+    0xa3, 'a', 'd', 'd', 0x93,
+    0xd3, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe,
+    0xcb, 0x3f, 0xf8, 0, 0, 0, 0, 0, 0,
+    0xdb, 0, 0, 0, 2, 'h', 'i'
+  };
+  mpack_token_t values[] = {
+    mpack_pack_uint(0x102), mpack_pack_sint(-2), mpack_pack_float(1.5),
+    mpack_pack_chunk("hi", 2)
+  };
+  char out[64];
+  char *w = out;
+  size_t bl = sizeof(expected) - 1;
+  ok(mpack_template_size(&t, values) == sizeof(expected)
+      && mpack_template_fill(&t, values, &w, &bl) == MPACK_EOF
+      && w == out && bl == sizeof(expected) - 1,
+      "template is not filled into a buffer that is too small");
+  bl = sizeof(out);
+  ok(mpack_template_fill(&t, values, &w, &bl) == MPACK_OK
+      && (size_t)(w - out) == sizeof(expected)
+      && bl == sizeof(out) - sizeof(expected)
+      && !memcmp(out, expected, sizeof(expected)),
+      "template is filled with fixed width values");
+
+  /* the instance is a regular message */
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  const char *r = out;
+  size_t rl = sizeof(expected);
+  mpack_token_t tok;
+  int count = 0;
+  double d = 0, sv = 0;
+  while (rl && mpack_read(&tb, &r, &rl, &tok) == MPACK_OK) {
+    if (tok.type == MPACK_TOKEN_SINT) sv = mpack_unpack_number(tok);
+    if (tok.type == MPACK_TOKEN_FLOAT) d = mpack_unpack_float(tok);
+    count++;
+  }
+  ok(!rl && count == 10 && sv == -2 && d == 1.5,
+      "template instance parses back");
+
+  /* short encodings from the reader are widened, numbers are converted */
+  const char sint8[] = { (char)0xd0, (char)0xfe };
+  r = sint8;
+  rl = sizeof(sint8);
+  mpack_tokbuf_init(&tb);
+  mpack_read(&tb, &r, &rl, values + 1);
+  values[2] = mpack_pack_uint(3);
+  w = out;
+  bl = sizeof(out);
+  ok(mpack_template_fill(&t, values, &w, &bl) == MPACK_OK
+      && !memcmp(out + 16, expected + 16, 9)
+      && (uint8_t)out[26] == 0x40 && (uint8_t)out[27] == 0x08,
+      "template widens short integers and converts numbers");
+
+  /* values that don't fit their slots */
+  mpack_token_t bad[][4] = {
+    { mpack_pack_sint(-1), mpack_pack_sint(-2), mpack_pack_float(1.5),
+      mpack_pack_chunk("hi", 2) },
+    { mpack_pack_uint(1), mpack_pack_boolean(1), mpack_pack_float(1.5),
+      mpack_pack_chunk("hi", 2) },
+    { mpack_pack_uint(1), mpack_pack_sint(-2), mpack_pack_nil(),
+      mpack_pack_chunk("hi", 2) },
+    { mpack_pack_uint(1), mpack_pack_sint(-2), mpack_pack_float(1.5),
+      mpack_pack_str(2) }
+  };
+  s = 0;
+  for (size_t i = 0; i < ARRAY_SIZE(bad); i++) {
+    w = out;
+    bl = sizeof(out);
+    if (mpack_template_fill(&t, bad[i], &w, &bl) == MPACK_ERROR
+        && w == out) {
+      s++;
+    }
+  }
+  ok(s == (int)ARRAY_SIZE(bad), "template rejects values of the wrong type");
+
+  /* out of space or slots while building */
+  char small[4];
+  mpack_template_init(&t, small, sizeof(small));
+  ok(mpack_template_write(&t, constant) == MPACK_OK
+      && mpack_template_slot(&t, MPACK_SLOT_UINT) == MPACK_NOMEM
+      && mpack_template_write(&t, method) == MPACK_OK
+      && mpack_template_write(&t, method + 1) == MPACK_NOMEM,
+      "template reports running out of space");
+  char *exact = malloc(9);
+  mpack_template_init(&t, exact, 9);
+  ok(mpack_template_slot(&t, MPACK_SLOT_UINT) == MPACK_OK
+      && mpack_template_slot(&t, MPACK_SLOT_SINT) == MPACK_NOMEM
+      && t.size == 9 && (uint8_t)exact[0] == 0xcf,
+      "template slot is not written past a full buffer");
+  free(exact);
+  /* a token that doesn't fit leaves nothing behind, and a full template
+   * rejects further tokens without touching the buffer */
+  exact = malloc(3);
+  mpack_template_init(&t, exact, 3);
+  mpack_token_t nil = mpack_pack_nil(), u16 = mpack_pack_uint(0x100);
+  ok(mpack_template_write(&t, &nil) == MPACK_OK
+      && mpack_template_write(&t, &u16) == MPACK_NOMEM && t.size == 1
+      && mpack_template_write(&t, &nil) == MPACK_OK
+      && mpack_template_write(&t, &nil) == MPACK_OK
+      && mpack_template_write(&t, &nil) == MPACK_NOMEM && t.size == 3
+      && !memcmp(exact, "\xc0\xc0\xc0", 3),
+      "template write checks room before writing");
+  free(exact);
+  mpack_template_init(&t, tbuf, sizeof(tbuf));
+  s = MPACK_OK;
+  for (int i = 0; i < MPACK_TEMPLATE_MAX_SLOTS; i++) {
+    s |= mpack_template_slot(&t, MPACK_SLOT_STR);
+  }
+  ok(s == MPACK_OK && mpack_template_slot(&t, MPACK_SLOT_STR) == MPACK_NOMEM,
+      "template has a fixed number of slots");
+}
+
+static void typed_reads_values(void)
+{
+  /* [5 as uint 64, -3 as int 16, 1.5, true, "hello", nil, {}] */
+  const uint8_t input[] = {
+    0x97, 0xcf, 0, 0, 0, 0, 0, 0, 0, 5, 0xd1, 0xff, 0xfd,
+    0xca, 0x3f, 0xc0, 0, 0, 0xc3, 0xa5, 'h', 'e', 'l', 'l', 'o', 0xc0, 0x80
+  };
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+    const char *b = (const char *)input;
+    size_t cs = chunksizes[i], bl = 0;
+    mpack_uint32_t alen = 0, mlen = 1, step = 0, l;
+    mpack_uintmax_t u = 0;
+    mpack_sintmax_t sv = 0;
+    double d = 0;
+    int flag = 0;
+    char str[8];
+    size_t slen = 0;
+    const char *p;
+    int s = MPACK_OK, done = 0;
+
+    while (!done) {
+      if (s == MPACK_EOF || !bl) {
+        bl = MIN(cs, sizeof(input) - (size_t)((const uint8_t *)b - input));
+      }
+      switch (step) {
+        case 0: s = mpack_read_array_len(&tb, &b, &bl, &alen); break;
+        case 1: s = mpack_read_uint(&tb, &b, &bl, &u); break;
+        case 2: s = mpack_read_sint(&tb, &b, &bl, &sv); break;
+        case 3: s = mpack_read_double(&tb, &b, &bl, &d); break;
+        case 4: s = mpack_read_bool(&tb, &b, &bl, &flag); break;
+        case 5:
+          s = mpack_read_str_span(&tb, &b, &bl, &p, &l);
+          if (s != MPACK_ERROR && slen + l <= sizeof(str)) {
+            memcpy(str + slen, p, l);
+            slen += l;
+          }
+          break;
+        case 6: s = mpack_read_nil(&tb, &b, &bl); break;
+        case 7: s = mpack_read_map_len(&tb, &b, &bl, &mlen); break;
+        default: done = 1; break;
+      }
+      if (s == MPACK_OK) step++;
+      if (s == MPACK_ERROR) break;
+    }
+
+    ok(s == MPACK_OK && !bl && alen == 7 && u == 5 && sv == -3 && d == 1.5
+        && flag && slen == 5 && !memcmp(str, "hello", 5) && mlen == 0,
+        "typed readers decode values in steps of %zu", cs);
+  }
+
+  /* mismatches leave the input untouched, also for split values */
+  const uint8_t mixed[] = { 0xd1, 0xff, 0xfd, 0xcd, 0x01, 0x00 };
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  const char *b = (const char *)mixed;
+  size_t bl = 2;
+  mpack_uintmax_t u = 0;
+  mpack_sintmax_t sv = 0;
+  int flag;
+  ok(mpack_read_sint(&tb, &b, &bl, &sv) == MPACK_EOF && !bl,
+      "typed reader keeps a partial value");
+  bl = 4;
+  ok(mpack_read_uint(&tb, &b, &bl, &u) == MPACK_ERROR && bl == 4
+      && b == (const char *)mixed + 2
+      && mpack_read_bool(&tb, &b, &bl, &flag) == MPACK_ERROR && bl == 4
+      && mpack_read_sint(&tb, &b, &bl, &sv) == MPACK_OK && sv == -3
+      && mpack_read_str_span(&tb, &b, &bl, &(const char *){0},
+        &(mpack_uint32_t){0}) == MPACK_ERROR && bl == 3
+      && mpack_read_sint(&tb, &b, &bl, &sv) == MPACK_OK && sv == 256,
+      "typed readers put back values of the wrong type");
+
+  /* range checks */
+  const uint8_t big[] = { 0xcf, 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0 };
+  const uint8_t small[] = { 0xd3, 0xff, 0xff, 0xff, 0xff, 0x80, 0, 0, 0 };
+  b = (const char *)big;
+  bl = sizeof(big);
+  mpack_tokbuf_init(&tb);
+  ok(mpack_read_sint(&tb, &b, &bl, &sv) == MPACK_ERROR
+      && bl == sizeof(big), "typed reader rejects out of range values");
+  int s = mpack_read_uint(&tb, &b, &bl, &u);
+#ifdef FORCE_32BIT_INTS
+  ok(s == MPACK_ERROR, "typed reader rejects values wider than uintmax");
+#else
+  ok(s == MPACK_OK && u == 0xffffffff00000000, "typed reader reads uint 64");
+#endif
+  b = (const char *)small;
+  bl = sizeof(small);
+  ok(mpack_read_sint(&tb, &b, &bl, &sv) == MPACK_OK
+      && sv == -(mpack_sintmax_t)0x7fffffff - 1 && !bl,
+      "typed reader narrows int 64 values that fit");
+}
+
+static void typed_writes_values(void)
+{
+  static const char payload[] = "a string that doesn't fit in a fixstr";
+  mpack_sintmax_t sints[] = {
+    -1, -32, -33, -128, -129, -32768, -32769, -0x7fffffff - 1, 5,
+#ifndef FORCE_32BIT_INTS
+    -0x80000001LL, INT64_MIN
+#endif
+  };
+  mpack_uintmax_t uints[] = {
+    0, 0x7f, 0x80, 0xff, 0x100, 0xffff, 0x10000,
+#ifndef FORCE_32BIT_INTS
+    0x100000000, UINT64_MAX
+#endif
+  };
+  double doubles[] = { 1.5, 0.1 };
+  mpack_uint32_t lens[] = { 0, 15, 16, 0x10000 };
+  char expected[256];
+  char *e = expected;
+  size_t el = sizeof(expected);
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+
+  /* reference output from the generic writer */
+  mpack_token_t toks[64];
+  size_t n = 0;
+  toks[n++] = mpack_pack_nil();
+  toks[n++] = mpack_pack_boolean(1);
+  for (size_t i = 0; i < ARRAY_SIZE(sints); i++) {
+    toks[n++] = mpack_pack_sint(sints[i]);
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(uints); i++) {
+    toks[n++] = mpack_pack_uint(uints[i]);
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(doubles); i++) {
+    toks[n++] = mpack_pack_float(doubles[i]);
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(lens); i++) {
+    toks[n++] = mpack_pack_array(lens[i]);
+    toks[n++] = mpack_pack_map(lens[i]);
+  }
+  toks[n++] = mpack_pack_str(0);
+  toks[n++] = mpack_pack_str(3);
+  toks[n++] = mpack_pack_chunk(payload, 3);
+  toks[n++] = mpack_pack_str(sizeof(payload) - 1);
+  toks[n++] = mpack_pack_chunk(payload, sizeof(payload) - 1);
+  for (size_t i = 0; i < n; i++) {
+    mpack_write(&tb, &e, &el, toks + i);
+  }
+  size_t explen = (size_t)(e - expected);
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    char out[256];
+    char *w = out;
+    size_t cs = chunksizes[i], bl = 0, step = 0;
+    size_t steps = 2 + ARRAY_SIZE(sints) + ARRAY_SIZE(uints)
+      + ARRAY_SIZE(doubles) + ARRAY_SIZE(lens) * 2 + 3;
+    int s = MPACK_OK;
+    mpack_tokbuf_init(&tb);
+
+    while (step < steps && s != MPACK_ERROR) {
+      size_t k = step;
+      bl = MIN(cs, sizeof(out) - (size_t)(w - out));
+      if (k < 1) {
+        s = mpack_write_nil(&tb, &w, &bl);
+      } else if ((k -= 1) < 1) {
+        s = mpack_write_bool(&tb, &w, &bl, 1);
+      } else if ((k -= 1) < ARRAY_SIZE(sints)) {
+        s = mpack_write_sint(&tb, &w, &bl, sints[k]);
+      } else if ((k -= ARRAY_SIZE(sints)) < ARRAY_SIZE(uints)) {
+        s = mpack_write_uint(&tb, &w, &bl, uints[k]);
+      } else if ((k -= ARRAY_SIZE(uints)) < ARRAY_SIZE(doubles)) {
+        s = mpack_write_double(&tb, &w, &bl, doubles[k]);
+      } else if ((k -= ARRAY_SIZE(doubles)) < ARRAY_SIZE(lens) * 2) {
+        s = k % 2 ? mpack_write_map_len(&tb, &w, &bl, lens[k / 2])
+          : mpack_write_array_len(&tb, &w, &bl, lens[k / 2]);
+      } else {
+        k -= ARRAY_SIZE(lens) * 2;
+        s = mpack_write_str(&tb, &w, &bl, payload,
+            k == 0 ? 0 : k == 1 ? 3 : sizeof(payload) - 1);
+      }
+      if (s == MPACK_OK) step++;
+    }
+
+    ok(s == MPACK_OK && (size_t)(w - out) == explen
+        && !memcmp(out, expected, explen),
+        "typed writers match mpack_write in steps of %zu", cs);
+  }
+}
+
+static size_t typed_encode_array(char *buf, size_t buflen,
+    const mpack_token_t *toks, size_t count)
+{
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  char *w = buf;
+  mpack_token_t hdr = mpack_pack_array((mpack_uint32_t)count);
+  mpack_write(&tb, &w, &buflen, &hdr);
+  for (size_t i = 0; i < count; i++) {
+    mpack_write(&tb, &w, &buflen, toks + i);
+  }
+  return (size_t)(w - buf);
+}
+
+/* reads the array header and then the elements with `call`, feeding `cs`
+ * bytes at a time */
+#define TYPED_READ_ARRAY(call, len, pos, cs, buf, buflen, status)      \
+  do {                                                                 \
+    mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;                    \
+    const char *b = buf;                                               \
+    size_t bl;                                                         \
+    len = 0;                                                           \
+    pos = 0;                                                           \
+    do {                                                               \
+      bl = MIN(cs, buflen - (size_t)(b - buf));                        \
+      status = mpack_read_array_len(&tb, &b, &bl, &len);               \
+    } while (status == MPACK_EOF);                                     \
+    do {                                                               \
+      bl = MIN(cs, buflen - (size_t)(b - buf));                        \
+      status = call;                                                   \
+    } while (status == MPACK_EOF && b < buf + buflen);                 \
+  } while (0)
+
+static void typed_reads_arrays(void)
+{
+  char buf[128];
+  mpack_token_t f64[] = {
+    mpack_pack_double(1.5), mpack_pack_double(0.1), mpack_pack_uint(2),
+    mpack_pack_float(0.25), mpack_pack_sint(-3), mpack_pack_double(-7)
+  };
+  mpack_token_t f32[] = {
+    mpack_pack_float(0.5), mpack_pack_float(2.5), mpack_pack_double(0.1),
+    mpack_pack_uint(7)
+  };
+  mpack_token_t sints[] = {
+    mpack_pack_sint(1), mpack_pack_sint(-1), mpack_pack_sint(-32),
+    mpack_pack_sint(127), mpack_pack_sint(-33), mpack_pack_sint(300),
+    mpack_pack_sint(-70000), mpack_pack_sint(4)
+  };
+  mpack_token_t i32[] = {
+    mpack_pack_sint(1), mpack_pack_sint(-5), mpack_pack_sint(-70000),
+    mpack_pack_sint(-0x7fffffff - 1), mpack_pack_uint(70000),
+    mpack_pack_uint(0x7fffffff), mpack_pack_sint(-3), mpack_pack_uint(0)
+  };
+  mpack_token_t u8[] = {
+    mpack_pack_uint(1), mpack_pack_uint(200), mpack_pack_uint(255),
+    mpack_pack_uint(0), mpack_pack_uint(0x7f)
+  };
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    size_t cs = chunksizes[i], n;
+    mpack_uint32_t len, pos;
+    int s;
+
+    double dv[ARRAY_SIZE(f64)];
+    n = typed_encode_array(buf, sizeof(buf), f64, ARRAY_SIZE(f64));
+    TYPED_READ_ARRAY(mpack_read_array_f64(&tb, &b, &bl, dv, len, &pos),
+        len, pos, cs, buf, n, s);
+    ok(s == MPACK_OK && pos == ARRAY_SIZE(f64) && dv[0] == 1.5
+        && dv[1] == 0.1 && dv[2] == 2 && dv[3] == 0.25 && dv[4] == -3
+        && dv[5] == -7, "read f64 array in steps of %zu", cs);
+
+    float fv[ARRAY_SIZE(f32)];
+    n = typed_encode_array(buf, sizeof(buf), f32, ARRAY_SIZE(f32));
+    TYPED_READ_ARRAY(mpack_read_array_f32(&tb, &b, &bl, fv, len, &pos),
+        len, pos, cs, buf, n, s);
+    ok(s == MPACK_OK && pos == ARRAY_SIZE(f32) && fv[0] == 0.5f
+        && fv[1] == 2.5f && fv[2] == 0.1f && fv[3] == 7,
+        "read f32 array in steps of %zu", cs);
+
+    mpack_sintmax_t sv[ARRAY_SIZE(sints)];
+    n = typed_encode_array(buf, sizeof(buf), sints, ARRAY_SIZE(sints));
+    TYPED_READ_ARRAY(mpack_read_array_sint(&tb, &b, &bl, sv, len, &pos),
+        len, pos, cs, buf, n, s);
+    ok(s == MPACK_OK && pos == ARRAY_SIZE(sints) && sv[0] == 1
+        && sv[1] == -1 && sv[2] == -32 && sv[3] == 127 && sv[4] == -33
+        && sv[5] == 300 && sv[6] == -70000 && sv[7] == 4,
+        "read sint array in steps of %zu", cs);
+
+    mpack_sint32_t iv[ARRAY_SIZE(i32)];
+    n = typed_encode_array(buf, sizeof(buf), i32, ARRAY_SIZE(i32));
+    TYPED_READ_ARRAY(mpack_read_array_i32(&tb, &b, &bl, iv, len, &pos),
+        len, pos, cs, buf, n, s);
+    ok(s == MPACK_OK && pos == ARRAY_SIZE(i32) && iv[0] == 1
+        && iv[1] == -5 && iv[2] == -70000 && iv[3] == -0x7fffffff - 1
+        && iv[4] == 70000 && iv[5] == 0x7fffffff && iv[6] == -3 && !iv[7],
+        "read i32 array in steps of %zu", cs);
+
+    unsigned char uv[ARRAY_SIZE(u8)];
+    n = typed_encode_array(buf, sizeof(buf), u8, ARRAY_SIZE(u8));
+    TYPED_READ_ARRAY(mpack_read_array_u8(&tb, &b, &bl, uv, len, &pos),
+        len, pos, cs, buf, n, s);
+    ok(s == MPACK_OK && pos == ARRAY_SIZE(u8) && uv[0] == 1 && uv[1] == 200
+        && uv[2] == 255 && uv[3] == 0 && uv[4] == 0x7f,
+        "read u8 array in steps of %zu", cs);
+  }
+
+  /* elements out of range stop the run and stay in the input */
+  mpack_token_t bad[] = {
+    mpack_pack_uint(1), mpack_pack_uint(0x80000000), mpack_pack_uint(2)
+  };
+  size_t n = typed_encode_array(buf, sizeof(buf), bad, ARRAY_SIZE(bad));
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  const char *b = buf + 1;
+  size_t bl = n - 1;
+  mpack_sint32_t iv[3];
+  unsigned char uv[3];
+  mpack_uint32_t pos = 0;
+  ok(mpack_read_array_i32(&tb, &b, &bl, iv, 3, &pos) == MPACK_ERROR
+      && pos == 1 && b == buf + 2 && (uint8_t)*b == 0xce,
+      "read i32 array rejects values that don't fit");
+  pos = 0;
+  b = buf + 1;
+  bl = n - 1;
+  ok(mpack_read_array_u8(&tb, &b, &bl, uv, 3, &pos) == MPACK_ERROR
+      && pos == 1 && b == buf + 2,
+      "read u8 array rejects values that don't fit");
+}
+
+/* writes with `call` into `out`, `cs` bytes at a time */
+#define TYPED_WRITE_ARRAY(call, pos, cs, out, outlen, status)          \
+  do {                                                                 \
+    mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;                    \
+    char *b = out;                                                     \
+    size_t bl;                                                         \
+    pos = 0;                                                           \
+    do {                                                               \
+      bl = MIN(cs, sizeof(out) - (size_t)(b - out));                   \
+      status = call;                                                   \
+    } while (status == MPACK_EOF);                                     \
+    outlen = (size_t)(b - out);                                        \
+  } while (0)
+
+static void typed_writes_arrays(void)
+{
+  double f64[] = { 1.5, 0.1, -7, 1e300 };
+  float f32[] = { 0.5f, 0.1f, 3, NAN, INFINITY, -INFINITY, -0.0f };
+  mpack_sintmax_t sints[] = { 1, -1, -33, 300, -70000, 0x7fffffff };
+  mpack_sint32_t i32[] = { 0, -5, 70000, -0x7fffffff - 1 };
+  unsigned char u8[] = { 1, 200, 255 };
+  mpack_token_t toks[8];
+  char expected[128];
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    size_t cs = chunksizes[i], n, outlen;
+    mpack_uint32_t pos, len, rpos;
+    char out[128];
+    int s;
+
+    for (size_t j = 0; j < ARRAY_SIZE(f64); j++) {
+      toks[j] = mpack_pack_float(f64[j]);
+    }
+    n = typed_encode_array(expected, sizeof(expected), toks, ARRAY_SIZE(f64));
+    TYPED_WRITE_ARRAY(mpack_write_array_f64(&tb, &b, &bl, f64,
+          ARRAY_SIZE(f64), &pos, 0), pos, cs, out, outlen, s);
+    ok(s == MPACK_OK && pos == ARRAY_SIZE(f64) + 1 && outlen == n
+        && !memcmp(out, expected, n),
+        "write f64 array in steps of %zu", cs);
+    double dv[ARRAY_SIZE(f64)];
+    TYPED_WRITE_ARRAY(mpack_write_array_f64(&tb, &b, &bl, f64,
+          ARRAY_SIZE(f64), &pos, 1), pos, cs, out, outlen, s);
+    TYPED_READ_ARRAY(mpack_read_array_f64(&tb, &b, &bl, dv, len, &rpos),
+        len, rpos, cs, out, outlen, s);
+    ok(s == MPACK_OK && outlen == 1 + ARRAY_SIZE(f64) * 9
+        && !memcmp(dv, f64, sizeof(f64)),
+        "write fixed f64 array in steps of %zu", cs);
+
+    for (size_t j = 0; j < ARRAY_SIZE(f32); j++) {
+      toks[j] = mpack_pack_float(f32[j]);
+    }
+    n = typed_encode_array(expected, sizeof(expected), toks, ARRAY_SIZE(f32));
+    TYPED_WRITE_ARRAY(mpack_write_array_f32(&tb, &b, &bl, f32,
+          ARRAY_SIZE(f32), &pos, 0), pos, cs, out, outlen, s);
+    ok(s == MPACK_OK && outlen == n && !memcmp(out, expected, n),
+        "write f32 array in steps of %zu", cs);
+    float fv[ARRAY_SIZE(f32)];
+    TYPED_WRITE_ARRAY(mpack_write_array_f32(&tb, &b, &bl, f32,
+          ARRAY_SIZE(f32), &pos, 1), pos, cs, out, outlen, s);
+    TYPED_READ_ARRAY(mpack_read_array_f32(&tb, &b, &bl, fv, len, &rpos),
+        len, rpos, cs, out, outlen, s);
+    /* NaN included, every element keeps the float 32 format and its bits */
+    bool all_f32 = true;
+    for (size_t j = 0; j < ARRAY_SIZE(f32); j++) {
+      all_f32 = all_f32 && (uint8_t)out[1 + j * 5] == 0xca;
+    }
+    ok(s == MPACK_OK && outlen == 1 + ARRAY_SIZE(f32) * 5 && all_f32
+        && !memcmp(fv, f32, sizeof(f32)),
+        "write fixed f32 array in steps of %zu", cs);
+
+    for (size_t j = 0; j < ARRAY_SIZE(sints); j++) {
+      toks[j] = mpack_pack_sint(sints[j]);
+    }
+    n = typed_encode_array(expected, sizeof(expected), toks, ARRAY_SIZE(sints));
+    TYPED_WRITE_ARRAY(mpack_write_array_sint(&tb, &b, &bl, sints,
+          ARRAY_SIZE(sints), &pos, 0), pos, cs, out, outlen, s);
+    ok(s == MPACK_OK && outlen == n && !memcmp(out, expected, n),
+        "write sint array in steps of %zu", cs);
+    mpack_sintmax_t sv[ARRAY_SIZE(sints)];
+    TYPED_WRITE_ARRAY(mpack_write_array_sint(&tb, &b, &bl, sints,
+          ARRAY_SIZE(sints), &pos, 1), pos, cs, out, outlen, s);
+    TYPED_READ_ARRAY(mpack_read_array_sint(&tb, &b, &bl, sv, len, &rpos),
+        len, rpos, cs, out, outlen, s);
+    ok(s == MPACK_OK && outlen == 1 + ARRAY_SIZE(sints) * 9
+        && !memcmp(sv, sints, sizeof(sints)),
+        "write fixed sint array in steps of %zu", cs);
+
+    for (size_t j = 0; j < ARRAY_SIZE(i32); j++) {
+      toks[j] = mpack_pack_sint(i32[j]);
+    }
+    n = typed_encode_array(expected, sizeof(expected), toks, ARRAY_SIZE(i32));
+    TYPED_WRITE_ARRAY(mpack_write_array_i32(&tb, &b, &bl, i32,
+          ARRAY_SIZE(i32), &pos, 0), pos, cs, out, outlen, s);
+    ok(s == MPACK_OK && outlen == n && !memcmp(out, expected, n),
+        "write i32 array in steps of %zu", cs);
+    mpack_sint32_t iv[ARRAY_SIZE(i32)];
+    TYPED_WRITE_ARRAY(mpack_write_array_i32(&tb, &b, &bl, i32,
+          ARRAY_SIZE(i32), &pos, 1), pos, cs, out, outlen, s);
+    TYPED_READ_ARRAY(mpack_read_array_i32(&tb, &b, &bl, iv, len, &rpos),
+        len, rpos, cs, out, outlen, s);
+    ok(s == MPACK_OK && outlen == 1 + ARRAY_SIZE(i32) * 5
+        && !memcmp(iv, i32, sizeof(i32)),
+        "write fixed i32 array in steps of %zu", cs);
+
+    for (size_t j = 0; j < ARRAY_SIZE(u8); j++) {
+      toks[j] = mpack_pack_uint(u8[j]);
+    }
+    n = typed_encode_array(expected, sizeof(expected), toks, ARRAY_SIZE(u8));
+    TYPED_WRITE_ARRAY(mpack_write_array_u8(&tb, &b, &bl, u8,
+          ARRAY_SIZE(u8), &pos, 0), pos, cs, out, outlen, s);
+    ok(s == MPACK_OK && outlen == n && !memcmp(out, expected, n),
+        "write u8 array in steps of %zu", cs);
+    unsigned char uv[ARRAY_SIZE(u8)];
+    TYPED_WRITE_ARRAY(mpack_write_array_u8(&tb, &b, &bl, u8,
+          ARRAY_SIZE(u8), &pos, 1), pos, cs, out, outlen, s);
+    TYPED_READ_ARRAY(mpack_read_array_u8(&tb, &b, &bl, uv, len, &rpos),
+        len, rpos, cs, out, outlen, s);
+    ok(s == MPACK_OK && outlen == 1 + ARRAY_SIZE(u8) * 2
+        && !memcmp(uv, u8, sizeof(u8)),
+        "write fixed u8 array in steps of %zu", cs);
+  }
+}
+
+static void typed_array_ext_round_trip(void)
+{
+  static double values[] = { 1.5, -2, 0.1, 1e300 };
+  static mpack_sint32_t ints[] = { 1, -1, 0x7fffffff, -70000 };
+  mpack_typed_array_t in = { 0 };
+  char buf[128];
+  /* aligned copy of the output, offset so the elements are aligned */
+  union { double d[16]; char c[128]; } aligned;
+  double storage[ARRAY_SIZE(values)];
+  in.kind = MPACK_ARRAY_F64;
+  in.count = ARRAY_SIZE(values);
+  in.data = values;
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    size_t cs = chunksizes[i], n;
+    mpack_uint32_t pos = 0;
+    mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+    char *w = buf;
+    int s;
+    do {
+      size_t bl = MIN(cs, sizeof(buf) - (size_t)(w - buf));
+      s = mpack_write_typed_array(&tb, &w, &bl, &in, &pos);
+    } while (s == MPACK_EOF);
+    n = (size_t)(w - buf);
+    ok(s == MPACK_OK && pos == 3 && n == 3 + 6 + sizeof(values)
+        && (uint8_t)buf[0] == 0xc7 && buf[2] == MPACK_EXT_TYPED_ARRAY
+        && buf[3] == MPACK_ARRAY_F64,
+        "write typed array in steps of %zu", cs);
+
+    mpack_typed_array_t out = { 0 };
+    const char *r = buf;
+    mpack_tokbuf_init(&tb);
+    do {
+      size_t bl = MIN(cs, n - (size_t)(r - buf));
+      s = mpack_read_typed_array(&tb, &r, &bl, &out, storage);
+    } while (s == MPACK_EOF);
+    ok(s == MPACK_OK && r == buf + n && out.kind == MPACK_ARRAY_F64
+        && out.count == ARRAY_SIZE(values)
+        && !memcmp(out.data, values, sizeof(values)),
+        "read typed array in steps of %zu", cs);
+  }
+
+  /* in a single aligned buffer the elements are referenced in place */
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  char *w = aligned.c + 7;
+  size_t bl = sizeof(aligned) - 7;
+  mpack_uint32_t pos = 0;
+  mpack_typed_array_t out = { 0 };
+  ok(mpack_write_typed_array(&tb, &w, &bl, &in, &pos) == MPACK_OK);
+  const char *r = aligned.c + 7;
+  bl = 3 + 6 + sizeof(values);
+  mpack_tokbuf_init(&tb);
+  ok(mpack_read_typed_array(&tb, &r, &bl, &out, NULL) == MPACK_OK && !bl
+      && out.data == aligned.d + 2, "typed array is read without copying");
+
+  /* misaligned elements need storage */
+  memmove(aligned.c + 6, aligned.c + 7, 3 + 6 + sizeof(values));
+  r = aligned.c + 6;
+  bl = 3 + 6 + sizeof(values);
+  memset(&out, 0, sizeof(out));
+  mpack_tokbuf_init(&tb);
+  int s = mpack_read_typed_array(&tb, &r, &bl, &out, NULL);
+  ok(s == MPACK_NOMEM && out.count == ARRAY_SIZE(values)
+      && mpack_typed_array_size(&out) == sizeof(values)
+      && mpack_read_typed_array(&tb, &r, &bl, &out, storage) == MPACK_OK
+      && out.data == storage && !memcmp(storage, values, sizeof(values)),
+      "misaligned typed array is copied to storage");
+
+  /* elements in the other byte order are swapped */
+  mpack_typed_array_t iarr = { 0 };
+  mpack_sint32_t istorage[ARRAY_SIZE(ints)];
+  iarr.kind = MPACK_ARRAY_I32;
+  iarr.count = ARRAY_SIZE(ints);
+  iarr.data = ints;
+  w = buf;
+  bl = sizeof(buf);
+  pos = 0;
+  mpack_tokbuf_init(&tb);
+  mpack_write_typed_array(&tb, &w, &bl, &iarr, &pos);
+  buf[4] = (char)!buf[4];
+  for (size_t i = 0; i < ARRAY_SIZE(ints); i++) {
+    char *e = buf + 9 + i * 4, t;
+    t = e[0]; e[0] = e[3]; e[3] = t;
+    t = e[1]; e[1] = e[2]; e[2] = t;
+  }
+  r = buf;
+  bl = (size_t)(w - buf);
+  memset(&iarr, 0, sizeof(iarr));
+  mpack_tokbuf_init(&tb);
+  ok(mpack_read_typed_array(&tb, &r, &bl, &iarr, istorage) == MPACK_OK
+      && iarr.data == istorage && !memcmp(istorage, ints, sizeof(ints)),
+      "typed array in the other byte order is swapped");
+
+  /* other ext values and inconsistent layouts */
+  const uint8_t other[] = { 0xd4, 0x05, 0x00 };
+  const uint8_t badlen[] = {
+    0xc7, 7, MPACK_EXT_TYPED_ARRAY, MPACK_ARRAY_U16, 0, 0, 0, 0, 1, 0
+  };
+  r = (const char *)other;
+  bl = sizeof(other);
+  memset(&iarr, 0, sizeof(iarr));
+  mpack_tokbuf_init(&tb);
+  ok(mpack_read_typed_array(&tb, &r, &bl, &iarr, istorage) == MPACK_ERROR
+      && bl == sizeof(other), "typed array reader puts back other ext types");
+  r = (const char *)badlen;
+  bl = sizeof(badlen);
+  ok(mpack_read_typed_array(&tb, &r, &bl, &iarr, istorage) == MPACK_ERROR,
+      "typed array reader rejects inconsistent lengths");
+}
+
+static void json_transcodes_values(void)
+{
+  static const uint8_t input[] = {
+    0x84,
+    0xa1, 'a', 0x96, 0x01, 0xff, 0xa5, 'x', '"', '\n', 0x01, 'y', 0xc0, 0xc3,
+    0xc2,
+    0xcd, 0x01, 0x2c, 0xc4, 0x04, 0x00, 0x01, 0x02, 0x03,
+    0xfb, 0xd5, 0x07, 0xff, 0x61,
+    0xa1, 'f', 0x95, 0xcb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a,
+    0xca, 0x3f, 0xc0, 0x00, 0x00, 0x90, 0x80,
+    0xb3, 's', 'o', 'm', 'e', ' ', 'c', 'l', 'e', 'a', 'n', ' ', 't', 'e',
+    'x', 't', ' ', 'e', 'n', '\\',
+    0xcf, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xd3, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xd4, 0xfb, 0x2a
+  };
+  static const char *expected[] = {
+    "{\"a\":[1,-1,\"x\\\"\\n\\u0001y\",null,true,false],"
+      "\"300\":\"AAECAw==\",\"-5\":{\"type\":7,\"data\":\"/2E=\"},"
+      "\"f\":[0.1,1.5,[],{},\"some clean text en\\\\\"]}",
+    "18446744073709551615",
+    "-9223372036854775808",
+    "{\"type\":-5,\"data\":\"Kg==\"}"
+  };
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    for (size_t j = 0; j < ARRAY_SIZE(chunksizes); j++) {
+      size_t ics = chunksizes[i], ocs = chunksizes[j], v = 0;
+      const char *r = (const char *)input;
+      char out[256], *w = out, *start = out;
+      mpack_json_t json;
+      int matches = 1;
+      mpack_json_init(&json);
+      while (v < ARRAY_SIZE(expected)) {
+        size_t il = MIN(ics,
+            sizeof(input) - (size_t)(r - (const char *)input));
+        size_t ol = MIN(ocs, sizeof(out) - (size_t)(w - out));
+        size_t il0 = il, ol0 = ol;
+        int s = mpack_json_transcode(&json, &r, &il, &w, &ol);
+        if (s == MPACK_OK) {
+          matches = matches && (size_t)(w - start) == strlen(expected[v])
+            && !memcmp(start, expected[v], strlen(expected[v]));
+          start = w;
+          v++;
+        } else if (s != MPACK_EOF || (il == il0 && ol == ol0 && il && ol)) {
+          break;
+        }
+      }
+      ok(v == ARRAY_SIZE(expected) && matches
+          && r == (const char *)input + sizeof(input),
+          "json transcoder with input/output steps of %zu/%zu", ics, ocs);
+    }
+  }
+
+  /* containers and ext can't be map keys */
+  static const uint8_t badkey[] = { 0x81, 0x90, 0x01 };
+  const char *r = (const char *)badkey;
+  size_t il = sizeof(badkey);
+  char out[16], *w = out;
+  size_t ol = sizeof(out);
+  mpack_json_t json;
+  mpack_json_init(&json);
+  ok(mpack_json_transcode(&json, &r, &il, &w, &ol) == MPACK_ERROR,
+      "json transcoder rejects container keys");
+}
+
+/* Transcodes a single float token to JSON in `out`. */
+static const char *json_float(mpack_token_t tok, char *out, size_t outsize)
+{
+  char mpackbuf[9], *w = mpackbuf;
+  size_t wl = sizeof(mpackbuf);
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  mpack_write(&tb, &w, &wl, &tok);
+  const char *r = mpackbuf;
+  size_t il = sizeof(mpackbuf) - wl, ol = outsize - 1;
+  char *o = out;
+  mpack_json_t json;
+  mpack_json_init(&json);
+  if (mpack_json_transcode(&json, &r, &il, &o, &ol) != MPACK_OK) return "";
+  *o = 0;
+  return out;
+}
+
+static void json_formats_floats(void)
+{
+  static const struct {
+    double v;
+    bool single;
+    const char *json;
+  } cases[] = {
+    {1, false, "1"}, {-3, true, "-3"}, {123456, true, "123456"},
+    {1234567, true, "1234567"}, {999999999999999, false, "999999999999999"},
+    {1e15, false, "1e+15"}, {-0.0, false, "-0"}, {0.1, false, "0.1"},
+    {-2.5, false, "-2.5"}, {0.1f, true, "0.1"}, {1e-7, false, "1e-07"},
+    {0.30000000000000004, false, "0.30000000000000004"}
+  };
+  char out[48];
+  bool matches = true;
+  for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+    mpack_token_t tok = cases[i].single ? mpack_pack_float((float)cases[i].v)
+      : mpack_pack_double(cases[i].v);
+    if (strcmp(json_float(tok, out, sizeof(out)), cases[i].json)) {
+      diag("%s != %s", out, cases[i].json);
+      matches = false;
+    }
+  }
+  ok(matches, "json transcoder writes floats in their shortest form");
+
+  const char *locales[] = { "de_DE.UTF-8", "fr_FR.UTF-8", "de_DE", "fr_FR" };
+  const char *locale = NULL;
+  for (size_t i = 0; i < ARRAY_SIZE(locales) && !locale; i++) {
+    locale = setlocale(LC_NUMERIC, locales[i]);
+  }
+  skip(!locale, 1, "no locale with a comma decimal point");
+  ok(!strcmp(json_float(mpack_pack_double(-2.5), out, sizeof(out)), "-2.5"),
+      "json transcoder writes floats independently of the locale");
+  end_skip;
+  setlocale(LC_NUMERIC, "C");
+}
+
+/* Feeds `json` to the JSON reader the way a stream would: after each
+ * MPACK_EOF, `ics` more bytes are appended to the unconsumed input. */
+static int json_read_in_steps(const char *json, size_t ics, size_t ocs,
+    char *out, size_t outsize, size_t *outlen)
+{
+  mpack_json_reader_t reader;
+  size_t jsonlen = strlen(json), avail = MIN(ics, jsonlen);
+  const char *r = json;
+  char *w = out;
+  int s;
+  mpack_json_reader_init(&reader);
+  do {
+    size_t il = avail - (size_t)(r - json);
+    size_t ol = MIN(ocs, outsize - (size_t)(w - out));
+    s = mpack_json_read(&reader, &r, &il, &w, &ol);
+    if (s == MPACK_EOF) {
+      if (avail == jsonlen && ol) break;
+      avail += MIN(ics, jsonlen - avail);
+    }
+  } while (s == MPACK_EOF);
+  *outlen = (size_t)(w - out);
+  return s;
+}
+
+static void json_reads_values(void)
+{
+  static const char json[] =
+    "{ \"a\" : [1, -1, \"x\\\"\\n\\u0001y\", null, true, false],\n"
+    "  \"\\u00e9\\u20ac\\ud83d\\ude00\": [],\t\"e\": {},"
+    "  \"f\": [0.1, 1.5, 300, -200, 18446744073709551615,"
+    " -9223372036854775808, 18446744073709551616, \"[{,}]\"] } ";
+  static const uint8_t expected[] = {
+    0x84,
+    0xa1, 'a', 0x96, 0x01, 0xff, 0xa5, 'x', '"', '\n', 0x01, 'y', 0xc0, 0xc3,
+    0xc2,
+    0xa9, 0xc3, 0xa9, 0xe2, 0x82, 0xac, 0xf0, 0x9f, 0x98, 0x80, 0x90,
+    0xa1, 'e', 0x80,
+    0xa1, 'f', 0x98, 0xcb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a,
+    0xca, 0x3f, 0xc0, 0x00, 0x00, 0xcd, 0x01, 0x2c, 0xd1, 0xff, 0x38,
+    0xcf, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xd3, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xca, 0x5f, 0x80, 0x00, 0x00,
+    0xa5, '[', '{', ',', '}', ']'
+  };
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    for (size_t j = 0; j < ARRAY_SIZE(chunksizes); j++) {
+      char out[128];
+      size_t n;
+      int s = json_read_in_steps(json, chunksizes[i], chunksizes[j], out,
+          sizeof(out), &n);
+      ok(s == MPACK_OK && n == sizeof(expected)
+          && !memcmp(out, expected, n),
+          "json reader with input/output steps of %zu/%zu", chunksizes[i],
+          chunksizes[j]);
+    }
+  }
+
+  /* fixtures without strings (which use a prefix convention in the tests) */
+  for (int f = 0; f < fixture_count; f++) {
+    char js[256], out[256];
+    size_t n;
+    int matches = 1;
+    if (fixtures[f].generator || strchr(fixtures[f].json, '"')
+        || strlen(fixtures[f].json) + 2 > sizeof(js)) {
+      continue;
+    }
+    snprintf(js, sizeof(js), "%s ", fixtures[f].json);
+    /* integral floats such as "1.0" are read back as integers */
+    const char *expected = (const char *)fixtures[f].msgpack;
+    size_t expectedlen = fixtures[f].msgpacklen;
+    char number[9];
+    mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+    mpack_token_t tok;
+    const char *r = expected;
+    size_t rl = expectedlen;
+    if (!mpack_read(&tb, &r, &rl, &tok) && tok.type == MPACK_TOKEN_FLOAT
+        && fabs(mpack_unpack_float(tok)) <= 9007199254740991.) {
+      char *w = number;
+      size_t wl = sizeof(number);
+      tok = mpack_pack_number(mpack_unpack_float(tok));
+      mpack_tokbuf_init(&tb);
+      mpack_write(&tb, &w, &wl, &tok);
+      expected = number;
+      expectedlen = sizeof(number) - wl;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+      int s = json_read_in_steps(js, chunksizes[i], chunksizes[i], out,
+          sizeof(out), &n);
+      matches = matches && s == MPACK_OK && n == expectedlen
+        && !memcmp(out, expected, n);
+    }
+    ok(matches, "json reader converts '%s'", fixtures[f].json);
+  }
+
+  static const char *invalid[] = {
+    "[1,]", "[1 2]", "{1:2}", "{\"a\" 1}", "[\"\\x\"]", "[\"\\udc00\"]",
+    "[nul]", "[1.2.3]", "\"a\nb\"", "]", "[+1]", "[01]", "[-01]", "[-]",
+    "[1.]", "[.5]", "[1e]", "[1e+]", "[1.5e2.1]"
+  };
+  for (size_t i = 0; i < ARRAY_SIZE(invalid); i++) {
+    char out[64], name[64];
+    size_t n, k = 0;
+    /* control characters would end the TAP line */
+    for (const char *c = invalid[i]; *c && k + 5 < sizeof(name); c++) {
+      k += (size_t)snprintf(name + k, sizeof(name) - k,
+          (unsigned char)*c < 0x20 ? "\\x%02x" : "%c", (unsigned char)*c);
+    }
+    name[k] = 0;
+    ok(json_read_in_steps(invalid[i], SIZE_MAX, SIZE_MAX, out, sizeof(out),
+          &n) == MPACK_ERROR, "json reader rejects %s", name);
+  }
+
+  /* numbers with a fraction or exponent are packed like mpack_pack_number */
+  static const uint8_t numbers[] = {
+    0x96, 0x01, 0xd1, 0xff, 0x38, 0x64, 0x00, 0x00, 0xca, 0x40, 0x20, 0x00, 0x00
+  };
+  char out[64];
+  size_t n;
+  ok(json_read_in_steps("[1.0, -2e2, 1E+2, 0, -0, 2.5]", SIZE_MAX, SIZE_MAX,
+        out, sizeof(out), &n) == MPACK_OK && n == sizeof(numbers)
+      && !memcmp(out, numbers, n), "json reader packs numbers by value");
+
+  /* numbers longer than any fixed buffer: 1.000...01 is read as 1, and
+   * 2^53 + 1 followed by 900 fraction digits ending in 1 is just above the
+   * halfway point, so it must round up to 2^53 + 2 rather than to even */
+  static char longnum[1024];
+  static const uint8_t one[] = { 0x01 };
+  static const uint8_t above[] = {
+    0xcb, 0x43, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01
+  };
+  static const uint8_t big[] = {
+    0xcb, 0x4e, 0x42, 0x8b, 0xc8, 0xab, 0xe4, 0x9f, 0x64
+  };
+  memset(longnum, '0', sizeof(longnum));
+  memcpy(longnum, "[1.", 3);
+  memcpy(longnum + 80, "1] ", 4);
+  ok(json_read_in_steps(longnum, SIZE_MAX, SIZE_MAX, out, sizeof(out), &n)
+      == MPACK_OK && n == 2 && !memcmp(out + 1, one, sizeof(one)),
+      "json reader accepts long fractions");
+  memset(longnum, '0', sizeof(longnum));
+  memcpy(longnum, "[9007199254740993.", 18);
+  memcpy(longnum + 918, "1] ", 4);
+  ok(json_read_in_steps(longnum, SIZE_MAX, SIZE_MAX, out, sizeof(out), &n)
+      == MPACK_OK && n == 1 + sizeof(above)
+      && !memcmp(out + 1, above, sizeof(above)),
+      "json reader rounds numbers with more than 800 digits");
+  memset(longnum, '0', sizeof(longnum));
+  memcpy(longnum, "[1", 2);
+  memcpy(longnum + 71, "] ", 3);
+  ok(json_read_in_steps(longnum, SIZE_MAX, SIZE_MAX, out, sizeof(out), &n)
+      == MPACK_OK && n == 1 + sizeof(big) && !memcmp(out + 1, big, sizeof(big)),
+      "json reader converts 70 digit integers to floats");
+
+  const char *locales[] = { "de_DE.UTF-8", "fr_FR.UTF-8", "de_DE", "fr_FR" };
+  const char *locale = NULL;
+  for (size_t i = 0; i < ARRAY_SIZE(locales) && !locale; i++) {
+    locale = setlocale(LC_NUMERIC, locales[i]);
+  }
+  skip(!locale, 1, "no locale with a comma decimal point");
+  ok(json_read_in_steps("[1.0, -2e2, 1E+2, 0, -0, 2.5]", SIZE_MAX, SIZE_MAX,
+        out, sizeof(out), &n) == MPACK_OK && n == sizeof(numbers)
+      && !memcmp(out, numbers, n),
+      "json reader reads numbers independently of the locale");
+  end_skip;
+  setlocale(LC_NUMERIC, "C");
+}
+
+typedef int (*transcode_cb)(mpack_cbor_t *cbor, const char **in,
+    size_t *inlen, char **out, size_t *outlen);
+
+/* Feeds `in` in pieces of `ics` bytes with `ocs` bytes of output space per
+ * call. Returns the last status. */
+static int cbor_transcode_in_steps(transcode_cb transcode, const uint8_t *in,
+    size_t inlen, size_t ics, size_t ocs, char *out, size_t outsize,
+    size_t *outlen)
+{
+  mpack_cbor_t cbor;
+  const char *r = (const char *)in;
+  char *w = out;
+  int s = MPACK_EOF;
+  mpack_cbor_init(&cbor);
+  do {
+    size_t il = MIN(ics, inlen - (size_t)(r - (const char *)in));
+    size_t ol = MIN(ocs, outsize - (size_t)(w - out));
+    if (!ol) break;
+    s = transcode(&cbor, &r, &il, &w, &ol);
+  } while (s != MPACK_ERROR
+      && (s == MPACK_EOF || r < (const char *)in + inlen));
+  *outlen = (size_t)(w - out);
+  return s;
+}
+
+#define LONG_TEXT 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', \
+  'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', \
+  '0', '1', '2', '3'
+
+static void cbor_transcodes_values(void)
+{
+  static const uint8_t cbor[] = {
+    0xa6,
+    0x61, 'a', 0x84, 0x01, 0x20, 0x39, 0x01, 0xf3,
+    0x1b, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x61, 'b', 0x43, 0x01, 0x02, 0x03,
+    0x61, 't', 0xc5, 0x42, 0xaa, 0xbb,
+    0x61, 'f', 0x82, 0xfa, 0x3f, 0xc0, 0x00, 0x00,
+    0xfb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a,
+    0x61, 's', 0x78, 0x1e, LONG_TEXT,
+    0x61, 'n', 0x83, 0xf6, 0xf5, 0xf4
+  };
+  static const uint8_t msgpack[] = {
+    0x86,
+    0xa1, 'a', 0x94, 0x01, 0xff, 0xd1, 0xfe, 0x0c,
+    0xcf, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0xa1, 'b', 0xc4, 0x03, 0x01, 0x02, 0x03,
+    0xa1, 't', 0xd5, 0x05, 0xaa, 0xbb,
+    0xa1, 'f', 0x92, 0xca, 0x3f, 0xc0, 0x00, 0x00,
+    0xcb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a,
+    0xa1, 's', 0xbe, LONG_TEXT,
+    0xa1, 'n', 0x93, 0xc0, 0xc3, 0xc2
+  };
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    for (size_t j = 0; j < ARRAY_SIZE(chunksizes); j++) {
+      char out[128], out2[128];
+      size_t n, m;
+      int s = cbor_transcode_in_steps(mpack_cbor_to_msgpack, cbor,
+          sizeof(cbor), chunksizes[i], chunksizes[j], out, sizeof(out), &n);
+      int s2 = cbor_transcode_in_steps(mpack_cbor_from_msgpack, msgpack,
+          sizeof(msgpack), chunksizes[i], chunksizes[j], out2, sizeof(out2),
+          &m);
+      ok(s == MPACK_OK && n == sizeof(msgpack) && !memcmp(out, msgpack, n)
+          && s2 == MPACK_OK && m == sizeof(cbor) && !memcmp(out2, cbor, m),
+          "cbor transcoder with input/output steps of %zu/%zu", chunksizes[i],
+          chunksizes[j]);
+    }
+  }
+
+  /* half floats are widened, undefined becomes nil */
+  static const uint8_t half[] = {
+    0x84, 0xf9, 0x3e, 0x00, 0xf9, 0x00, 0x01, 0xf9, 0xfc, 0x00, 0xf7
+  };
+  static const uint8_t widened[] = {
+    0x94, 0xca, 0x3f, 0xc0, 0x00, 0x00, 0xca, 0x33, 0x80, 0x00, 0x00,
+    0xca, 0xff, 0x80, 0x00, 0x00, 0xc0
+  };
+  char out[32];
+  size_t n;
+  ok(cbor_transcode_in_steps(mpack_cbor_to_msgpack, half, sizeof(half),
+        SIZE_MAX, SIZE_MAX, out, sizeof(out), &n) == MPACK_OK
+      && n == sizeof(widened) && !memcmp(out, widened, n),
+      "cbor half floats are read as float 32");
+
+  /* indefinite lengths, tags on other items and negative ext types */
+  static const uint8_t indefinite[] = { 0x9f, 0x01, 0xff };
+  static const uint8_t tagged_int[] = { 0xc1, 0x01 };
+  static const uint8_t big_tag[] = { 0xd8, 0x80, 0x41, 0x00 };
+  static const uint8_t negative_ext[] = { 0xd4, 0xff, 0x00 };
+  ok(cbor_transcode_in_steps(mpack_cbor_to_msgpack, indefinite,
+        sizeof(indefinite), SIZE_MAX, SIZE_MAX, out, sizeof(out), &n)
+      == MPACK_ERROR, "cbor indefinite lengths are rejected");
+  ok(cbor_transcode_in_steps(mpack_cbor_to_msgpack, tagged_int,
+        sizeof(tagged_int), 1, SIZE_MAX, out, sizeof(out), &n)
+      == MPACK_ERROR, "cbor tags must apply to byte strings");
+  ok(cbor_transcode_in_steps(mpack_cbor_to_msgpack, big_tag,
+        sizeof(big_tag), SIZE_MAX, SIZE_MAX, out, sizeof(out), &n)
+      == MPACK_ERROR, "cbor tags above 127 are rejected");
+  ok(cbor_transcode_in_steps(mpack_cbor_from_msgpack, negative_ext,
+        sizeof(negative_ext), SIZE_MAX, SIZE_MAX, out, sizeof(out), &n)
+      == MPACK_ERROR, "negative ext types have no cbor tag");
+
+  /* a tag and a byte string header with 8 byte arguments, split anywhere */
+  static const uint8_t tagged_bstr8[] = {
+    0xdb, 0, 0, 0, 0, 0, 0, 0, 0x05, 0x5b, 0, 0, 0, 0, 0, 0, 0, 0x02,
+    0xaa, 0xbb
+  };
+  static const uint8_t fixext2[] = { 0xd5, 0x05, 0xaa, 0xbb };
+  size_t splits = 0;
+  for (size_t k = 1; k < sizeof(tagged_bstr8); k++) {
+    mpack_cbor_t cbor;
+    const char *r = (const char *)tagged_bstr8;
+    char *w = out;
+    size_t il = k, ol = sizeof(out);
+    mpack_cbor_init(&cbor);
+    int s1 = mpack_cbor_to_msgpack(&cbor, &r, &il, &w, &ol);
+    il = sizeof(tagged_bstr8) - k;
+    int s2 = mpack_cbor_to_msgpack(&cbor, &r, &il, &w, &ol);
+    if (s1 == MPACK_OK && s2 == MPACK_OK && !il
+        && (size_t)(w - out) == sizeof(fixext2)
+        && !memcmp(out, fixext2, sizeof(fixext2))) {
+      splits++;
+    }
+  }
+  ok(splits == sizeof(tagged_bstr8) - 1,
+      "cbor tagged byte string with long headers is read at every split");
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    ok(cbor_transcode_in_steps(mpack_cbor_to_msgpack, tagged_bstr8,
+          sizeof(tagged_bstr8), chunksizes[i], SIZE_MAX, out, sizeof(out), &n)
+        == MPACK_OK && n == sizeof(fixext2) && !memcmp(out, fixext2, n),
+        "cbor tagged byte string in steps of %zu", chunksizes[i]);
+  }
+  static const uint8_t two_tags[] = { 0xc5, 0xc5, 0x41, 0x00 };
+  ok(cbor_transcode_in_steps(mpack_cbor_to_msgpack, two_tags,
+        sizeof(two_tags), 1, SIZE_MAX, out, sizeof(out), &n)
+      == MPACK_ERROR, "cbor nested tags are rejected");
+}
+
+typedef struct {
+  mpack_uint32_t nodes;
+  /* nodes and root offset of each record, indexed by record */
+  mpack_uint32_t *counts;
+  size_t *starts;
+  size_t root;
+} batch_worker_t;
+
+static void batch_enter(mpack_parser_t *parser, mpack_node_t *node)
+{
+  batch_worker_t *w = parser->data.p;
+  mpack_node_t *parent = MPACK_PARENT_NODE(node);
+  w->nodes++;
+  if (!parent) w->root = node->start;
+}
+
+static void batch_exit(mpack_parser_t *parser, mpack_node_t *node)
+{
+  (void)parser;
+  (void)node;
+}
+
+static void batch_record(mpack_parser_t *parser, mpack_uint32_t record)
+{
+  batch_worker_t *w = parser->data.p;
+  w->counts[record] = w->nodes;
+  w->starts[record] = w->root;
+  w->nodes = 0;
+}
+
+static void batch_parses_record_ranges(void)
+{
+  static const char *records[] = {
+    "1", "[1, \"s:ab\", {\"k\": 2}]", "{\"a\": [1, 2, 3], \"c\": null}",
+    "\"s:abcdefghijklmnopqrstuvwxyz0123456789\"", "[[[1]]]", "true",
+    "{\"k\": {\"k\": {\"k\": 1}}}", "-300", "[1, 2]", "\"b:xyz\""
+  };
+  enum { COUNT = 30 };
+  uint8_t *buf = malloc(COUNT * MSGPACK_BUFLEN), *w = buf;
+  size_t ends[COUNT], all[COUNT], len;
+  mpack_uint32_t count, total = 0;
+  mpack_uint32_t counts[COUNT], counts2[COUNT];
+  size_t starts[COUNT], starts2[COUNT];
+
+  for (int i = 0; i < COUNT; i++) {
+    to_msgpack(records[i % ARRAY_SIZE(records)], &w);
+  }
+  len = (size_t)(w - buf);
+
+  /* frame with a small capacity, resuming at the last end */
+  int s;
+  do {
+    size_t base = total ? all[total - 1] : 0;
+    s = mpack_batch_frame((const char *)buf + base, len - base, ends, 7,
+        &count);
+    for (mpack_uint32_t i = 0; i < count; i++) all[total + i] = base + ends[i];
+    total += count;
+  } while (s == MPACK_NOMEM);
+  ok(s == MPACK_OK && total == COUNT && all[COUNT - 1] == len,
+      "batch framing finds every record");
+  ok(mpack_batch_frame((const char *)buf, len - 1, ends, COUNT, &count)
+      == MPACK_EOF && count == COUNT - 1 && ends[count - 1] == all[count - 1],
+      "batch framing stops before a truncated record");
+
+  /* parse everything with one parser, then in 4 ranges with one each */
+  mpack_parser_t parser;
+  batch_worker_t one = { 0, counts, starts, 0 };
+  mpack_parser_init(&parser, 0);
+  parser.data.p = &one;
+  ok(mpack_batch_parse(&parser, (const char *)buf, all, 0, COUNT, batch_enter,
+        batch_exit, batch_record) == MPACK_OK, "batch parses all records");
+
+  int matches = 1;
+  mpack_uint32_t next = 0;
+  for (mpack_uint32_t part = 0; part < 4; part++) {
+    mpack_uint32_t first, last;
+    batch_worker_t worker = { 0, counts2, starts2, 0 };
+    matches = matches && mpack_batch_split(all, COUNT, 4, part, &first,
+        &last) == MPACK_OK && first == next && last >= first;
+    next = last;
+    mpack_parser_init(&parser, 0);
+    parser.data.p = &worker;
+    matches = matches && mpack_batch_parse(&parser, (const char *)buf, all,
+        first, last, batch_enter, batch_exit, batch_record) == MPACK_OK;
+  }
+  ok(matches && next == COUNT
+      && !memcmp(counts, counts2, sizeof(counts))
+      && !memcmp(starts, starts2, sizeof(starts))
+      && starts[0] == 0 && starts[5] == all[4],
+      "batch ranges cover every record with matching results");
+  mpack_uint32_t first, last;
+  ok(mpack_batch_split(all, COUNT, 0, 0, &first, &last) == MPACK_ERROR
+      && mpack_batch_split(all, COUNT, 4, 4, &first, &last) == MPACK_ERROR,
+      "batch split rejects a part outside of parts");
+  free(buf);
+}
+
+static size_t element_starts[32];
+static mpack_uint32_t segment_exits;
+
+static void segment_enter(mpack_parser_t *parser, mpack_node_t *node)
+{
+  mpack_node_t *parent = MPACK_PARENT_NODE(node), *grandparent;
+  (void)parser;
+  if (!parent) return;
+  grandparent = MPACK_PARENT_NODE(parent);
+  if (!grandparent) element_starts[parent->pos] = node->start;
+}
+
+static void segment_exit(mpack_parser_t *parser, mpack_node_t *node)
+{
+  mpack_node_t *parent = MPACK_PARENT_NODE(node);
+  (void)parser;
+  if (!parent) segment_exits++;
+}
+
+static void batch_parses_array_segments(void)
+{
+  static const char *elements[] = {
+    "1", "\"s:abcdefghijklmnopqrstuvwxyz\"", "[1, [2, 3]]", "{\"k\": 3}",
+    "-5", "\"b:ab\"", "null"
+  };
+  char json[512];
+  size_t jl = 0;
+  json[jl++] = '[';
+  for (int i = 0; i < 25; i++) {
+    jl += (size_t)snprintf(json + jl, sizeof(json) - jl, "%s%s", i ? ", " : "",
+        elements[i % ARRAY_SIZE(elements)]);
+  }
+  json[jl++] = ']';
+  json[jl] = 0;
+
+  uint8_t buf[MSGPACK_BUFLEN], *w = buf;
+  to_msgpack(json, &w);
+  size_t len = (size_t)(w - buf);
+
+  /* reference: parse the whole array at once */
+  mpack_parser_t parser;
+  size_t expected[32];
+  const char *r = (const char *)buf;
+  size_t rl = len;
+  mpack_parser_init(&parser, 0);
+  segment_exits = 0;
+  mpack_parse(&parser, &r, &rl, segment_enter, segment_exit);
+  memcpy(expected, element_starts, sizeof(expected));
+  memset(element_starts, 0, sizeof(element_starts));
+
+  size_t offsets[8];
+  mpack_uint32_t length;
+  ok(mpack_batch_index((const char *)buf, len, 4, offsets, 7, &length)
+      == MPACK_NOMEM && length == 25, "array index needs a slot per segment");
+  ok(mpack_batch_index((const char *)buf, len - 1, 4, offsets, 8, &length)
+      == MPACK_EOF, "array index detects truncated arrays");
+  ok(mpack_batch_index((const char *)buf, len, 4, offsets, 8, &length)
+      == MPACK_OK && offsets[0] == 3 && offsets[1] == expected[4]
+      && offsets[7] == len, "array index records every 4th element");
+
+  /* segments in any order, each with its own parser */
+  int status = MPACK_OK;
+  segment_exits = 0;
+  for (mpack_uint32_t seg = 7; seg--;) {
+    mpack_parser_init(&parser, 0);
+    status |= mpack_batch_parse_segment(&parser, (const char *)buf, offsets, 4,
+        length, seg, segment_enter, segment_exit);
+  }
+  ok(status == MPACK_OK && segment_exits == 7
+      && !memcmp(element_starts, expected, sizeof(expected)),
+      "array segments are parsed with global element indexes");
+}
+
+static void batch_stitches_array_slices(void)
+{
+  enum { LENGTH = 20, PARTS = 3 };
+  char slices[PARTS][64], out[128];
+  const char *ptrs[PARTS];
+  size_t sizes[PARTS];
+  mpack_uint32_t next = 0;
+  int matches = 1;
+
+  /* each slice is encoded on its own, as a worker would */
+  for (mpack_uint32_t part = 0; part < PARTS; part++) {
+    mpack_uint32_t first, last;
+    mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+    char *w = slices[part];
+    size_t wl = sizeof(slices[part]);
+    matches = matches && mpack_batch_slice(LENGTH, PARTS, part, &first,
+        &last) == MPACK_OK && first == next && last - first >= LENGTH / PARTS
+      && last - first <= LENGTH / PARTS + 1;
+    next = last;
+    for (mpack_uint32_t i = first; i < last; i++) {
+      mpack_token_t tok = mpack_pack_uint(i * 50);
+      matches = matches && mpack_write(&tb, &w, &wl, &tok) == MPACK_OK;
+    }
+    ptrs[part] = slices[part];
+    sizes[part] = (size_t)(w - slices[part]);
+  }
+  ok(matches && next == LENGTH, "array slices cover every element");
+  mpack_uint32_t first, last;
+  ok(mpack_batch_slice(LENGTH, 0, 0, &first, &last) == MPACK_ERROR
+      && mpack_batch_slice(LENGTH, PARTS, PARTS, &first, &last) == MPACK_ERROR,
+      "array slice rejects a part outside of parts");
+
+  char *w = out;
+  size_t wl = 10;
+  ok(mpack_batch_stitch(&w, &wl, LENGTH, ptrs, sizes, PARTS) == MPACK_EOF
+      && w == out && wl == 10, "stitching needs room for the whole array");
+  wl = sizeof(out);
+  ok(mpack_batch_stitch(&w, &wl, LENGTH, ptrs, sizes, PARTS) == MPACK_OK,
+      "array slices are stitched");
+
+  const char *r = out;
+  size_t rl = (size_t)(w - out);
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  mpack_token_t tok;
+  matches = (uint8_t)out[0] == 0xdd && mpack_read(&tb, &r, &rl, &tok) == 0
+    && tok.type == MPACK_TOKEN_ARRAY && tok.length == LENGTH;
+  for (mpack_uint32_t i = 0; i < LENGTH; i++) {
+    matches = matches && mpack_read(&tb, &r, &rl, &tok) == MPACK_OK
+      && tok.type == MPACK_TOKEN_UINT && mpack_unpack_uint(tok) == i * 50;
+  }
+  ok(matches && !rl, "stitched array reads back in order");
+}
+
+static void token_size_matches_writer(void)
+{
+  mpack_token_t toks[10];
+  int matches = 1;
+
+  toks[0] = mpack_pack_nil();
+  toks[1] = mpack_pack_uint(300);
+  toks[2] = mpack_pack_sint(-33);
+  toks[3] = mpack_pack_float(1.5);
+  toks[4] = mpack_pack_str(40);
+  toks[5] = mpack_pack_bin(70000);
+  toks[6] = mpack_pack_ext(3, 16);
+  toks[7] = mpack_pack_ext(3, 17);
+  toks[8] = mpack_pack_array(20);
+  toks[9] = mpack_pack_map(70000);
+  for (size_t i = 0; i < sizeof(toks) / sizeof(toks[0]); i++) {
+    mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+    char out[16], *w = out;
+    size_t wl = sizeof(out);
+    matches = matches && mpack_write(&tb, &w, &wl, toks + i) == MPACK_OK
+      && mpack_token_size(toks + i) == (size_t)(w - out);
+  }
+  ok(matches, "token sizes match what is written");
+  toks[0].type = MPACK_TOKEN_CHUNK;
+  toks[0].length = 40;
+  ok(mpack_token_size(toks) == 40, "chunk size is its length");
+}
+
+static int ring_write(mpack_ring_t *ring, mpack_uint32_t value, char **region)
+{
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  mpack_token_t tok = mpack_pack_uint(value);
+  size_t size = mpack_token_size(&tok), left = size;
+  char *w;
+  int status;
+
+  if ((status = mpack_ring_reserve(ring, size, region))) return status;
+  w = *region;
+  return mpack_write(&tb, &w, &left, &tok) || left;
+}
+
+static bool ring_read(mpack_ring_t *ring, mpack_uint32_t value)
+{
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  mpack_token_t tok;
+  const char *r;
+  size_t rl;
+  bool rv;
+
+  if (mpack_ring_peek(ring, &r, &rl)) return false;
+  rv = mpack_read(&tb, &r, &rl, &tok) == MPACK_OK && !rl
+    && tok.type == MPACK_TOKEN_UINT && mpack_unpack_uint(tok) == value;
+  mpack_ring_release(ring);
+  return rv;
+}
+
+static void ring_delivers_in_reservation_order(void)
+{
+  size_t mem[8];
+  mpack_ring_t ring;
+  char *a, *b, *c;
+  const char *r;
+  size_t rl;
+
+  mpack_ring_init(&ring, mem, sizeof(mem));
+  ok(mpack_ring_peek(&ring, &r, &rl) == MPACK_EOF, "new ring is empty");
+  ok(!ring_write(&ring, 1, &a) && !ring_write(&ring, 300, &b),
+      "regions are reserved and written");
+  mpack_ring_publish(&ring, b, 3);
+  ok(mpack_ring_peek(&ring, &r, &rl) == MPACK_EOF,
+      "later region waits for the earlier one");
+  mpack_ring_publish(&ring, a, 1);
+  ok(ring_read(&ring, 1) && ring_read(&ring, 300)
+      && mpack_ring_peek(&ring, &r, &rl) == MPACK_EOF,
+      "regions are read in reservation order");
+
+  /* the next region doesn't fit before the end of the buffer */
+  ok(!mpack_ring_reserve(&ring, 9, &a) && !ring_write(&ring, 2, &b)
+      && b == (char *)mem + MPACK_RING_HEADER,
+      "region after the end of the buffer wraps around");
+  memset(a, 0xc0, 9);
+  mpack_ring_publish(&ring, a, 9);
+  mpack_ring_publish(&ring, b, 1);
+  ok(!ring_write(&ring, 70000, &c) && ring_write(&ring, 3, &a) == MPACK_EOF,
+      "full ring can't be reserved");
+  ok(!mpack_ring_peek(&ring, &r, &rl) && rl == 9, "region size is kept");
+  mpack_ring_release(&ring);
+  mpack_ring_publish(&ring, c, 5);
+  ok(ring_read(&ring, 2) && ring_read(&ring, 70000)
+      && mpack_ring_peek(&ring, &r, &rl) == MPACK_EOF,
+      "wrapped region is read after the skipped space");
+  ok(mpack_ring_reserve(&ring, sizeof(mem), &a) == MPACK_NOMEM,
+      "region bigger than the ring is rejected");
+
+  /* the ring is empty with head and tail in the middle of the buffer, where
+   * a large region doesn't fit before the end */
+  ok(mpack_ring_reserve(&ring, 40, &a) == MPACK_EOF
+      && mpack_ring_peek(&ring, &r, &rl) == MPACK_EOF,
+      "large region waits for the consumer to skip the end of the buffer");
+  ok(!mpack_ring_reserve(&ring, 40, &a) && a == (char *)mem + MPACK_RING_HEADER,
+      "large region wraps around once the end of the buffer is skipped");
+  mpack_ring_publish(&ring, a, 40);
+  ok(!mpack_ring_peek(&ring, &r, &rl) && r == a && rl == 40,
+      "large region is read");
+  mpack_ring_release(&ring);
+}
+
+#if MPACK_RING_ATOMIC
+enum { RING_PRODUCERS = 4, RING_MESSAGES = 20000 };
+
+struct ring_producer {
+  pthread_t thread;
+  mpack_ring_t *ring;
+  mpack_uint32_t id;
+};
+
+/* payload of message `seq` from producer `id`, its length varies so regions
+ * wrap around at different offsets */
+static mpack_uint32_t ring_payload(mpack_uint32_t id, mpack_uint32_t seq,
+    char *out)
+{
+  mpack_uint32_t len = 1 + (seq * 7 + id * 13) % 61;
+  for (mpack_uint32_t k = 0; k < len; k++) {
+    out[k] = (char)(id * 31 + seq + k);
+  }
+  return len;
+}
+
+static void *ring_produce(void *arg)
+{
+  struct ring_producer *p = arg;
+
+  for (mpack_uint32_t seq = 0; seq < RING_MESSAGES; seq++) {
+    mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+    mpack_token_t toks[4];
+    char payload[64], *region, *w;
+    size_t size = 0, left;
+    mpack_uint32_t len = ring_payload(p->id, seq, payload);
+
+    toks[0] = mpack_pack_uint(p->id);
+    toks[1] = mpack_pack_uint(seq);
+    toks[2] = mpack_pack_str(len);
+    toks[3] = mpack_pack_chunk(payload, len);
+    for (int i = 0; i < 4; i++) size += mpack_token_size(toks + i);
+    while (mpack_ring_reserve(p->ring, size, &region) == MPACK_EOF) {
+      sched_yield();
+    }
+    w = region;
+    left = size;
+    for (int i = 0; i < 4; i++) mpack_write(&tb, &w, &left, toks + i);
+    mpack_ring_publish(p->ring, region, size);
+  }
+
+  return NULL;
+}
+
+/* Reads one message written by ring_produce, returning its producer id or
+ * RING_PRODUCERS if it is malformed or out of order. */
+static mpack_uint32_t ring_consume(const char *r, size_t rl,
+    mpack_uint32_t *next)
+{
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  mpack_token_t toks[4];
+  char payload[64];
+  mpack_uint32_t id, len;
+
+  for (int i = 0; i < 4; i++) {
+    if (mpack_read(&tb, &r, &rl, toks + i)) return RING_PRODUCERS;
+  }
+  if (rl || toks[0].type != MPACK_TOKEN_UINT
+      || (id = (mpack_uint32_t)mpack_unpack_uint(toks[0])) >= RING_PRODUCERS
+      || toks[1].type != MPACK_TOKEN_UINT
+      || mpack_unpack_uint(toks[1]) != next[id]) {
+    return RING_PRODUCERS;
+  }
+  len = ring_payload(id, next[id], payload);
+  if (toks[2].length != len || toks[3].length != len
+      || memcmp(toks[3].data.chunk_ptr, payload, len)) {
+    return RING_PRODUCERS;
+  }
+  next[id]++;
+  return id;
+}
+
+static void ring_is_shared_by_threads(void)
+{
+  static size_t mem[512];
+  struct ring_producer producers[RING_PRODUCERS];
+  mpack_uint32_t next[RING_PRODUCERS] = { 0 };
+  mpack_ring_t ring;
+  const char *r;
+  size_t rl, received = 0;
+  bool matches = true;
+
+  mpack_ring_init(&ring, mem, sizeof(mem));
+  for (mpack_uint32_t i = 0; i < RING_PRODUCERS; i++) {
+    producers[i].ring = &ring;
+    producers[i].id = i;
+    pthread_create(&producers[i].thread, NULL, ring_produce, producers + i);
+  }
+  while (matches && received < RING_PRODUCERS * RING_MESSAGES) {
+    if (mpack_ring_peek(&ring, &r, &rl)) {
+      sched_yield();
+      continue;
+    }
+    matches = ring_consume(r, rl, next) < RING_PRODUCERS;
+    mpack_ring_release(&ring);
+    received++;
+  }
+  /* stop the producers if a check failed before all were received */
+  while (!matches && received < RING_PRODUCERS * RING_MESSAGES) {
+    if (!mpack_ring_peek(&ring, &r, &rl)) {
+      mpack_ring_release(&ring);
+      received++;
+    }
+  }
+  for (int i = 0; i < RING_PRODUCERS; i++) {
+    pthread_join(producers[i].thread, NULL);
+  }
+  for (int i = 0; i < RING_PRODUCERS; i++) {
+    matches = matches && next[i] == RING_MESSAGES;
+  }
+  ok(matches && mpack_ring_peek(&ring, &r, &rl) == MPACK_EOF,
+      "ring keeps the order and bytes of %d producers", RING_PRODUCERS);
+}
+#endif
+
+static int recycled;
+
+static void pipe_recycle(mpack_pipe_block_t *block)
+{
+  recycled++;
+}
+
+static void pipe_passes_token_batches(void)
+{
+  enum { SPLIT = 35 };
+  mpack_pipe_batch_t batches[1];
+  mpack_pipe_block_t blocks[2];
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  mpack_pipe_t pipe;
+  mpack_pipe_batch_t *batch;
+  mpack_token_t tok;
+  char in[512], *w = in;
+  const char *r;
+  size_t wl = sizeof(in), rl;
+  bool matches;
+
+  /* array of 70 uints and a str, split inside the 12th uint */
+  tok = mpack_pack_array(71);
+  mpack_write(&tb, &w, &wl, &tok);
+  for (mpack_uint32_t i = 0; i < 70; i++) {
+    tok = mpack_pack_uint(i * 1000);
+    mpack_write(&tb, &w, &wl, &tok);
+  }
+  tok = mpack_pack_str(2);
+  mpack_write(&tb, &w, &wl, &tok);
+  tok = mpack_pack_chunk("hi", 2);
+  mpack_write(&tb, &w, &wl, &tok);
+
+  recycled = 0;
+  mpack_tokbuf_init(&tb);
+  mpack_pipe_init(&pipe, batches, 1);
+  mpack_pipe_block_init(blocks, pipe_recycle, NULL);
+  mpack_pipe_block_init(blocks + 1, pipe_recycle, NULL);
+  ok(!mpack_pipe_peek(&pipe), "new pipe is empty");
+  r = in;
+  rl = SPLIT;
+  ok(mpack_pipe_decode(&pipe, &tb, blocks, &r, &rl) == MPACK_OK && !rl,
+      "first block is decoded");
+  mpack_pipe_block_unref(blocks);
+  r = in + SPLIT;
+  rl = (size_t)(w - in) - SPLIT;
+  ok(mpack_pipe_decode(&pipe, &tb, blocks + 1, &r, &rl) == MPACK_EOF
+      && r == in + SPLIT, "decoding stops when the pipe is full");
+
+  batch = mpack_pipe_peek(&pipe);
+  matches = batch && batch->count == 12 && batch->block == blocks
+    && batch->tokens[0].type == MPACK_TOKEN_ARRAY;
+  for (mpack_uint32_t i = 1; matches && i < 12; i++) {
+    matches = mpack_unpack_uint(batch->tokens[i]) == (i - 1) * 1000;
+  }
+  ok(matches && !recycled, "batch holds the tokens of the first block");
+  mpack_pipe_release(&pipe);
+  ok(recycled == 1, "block is recycled after its last batch");
+
+  ok(mpack_pipe_decode(&pipe, &tb, blocks + 1, &r, &rl) == MPACK_OK,
+      "second block is decoded");
+  mpack_pipe_block_unref(blocks + 1);
+  batch = mpack_pipe_peek(&pipe);
+  matches = batch && batch->count == 61 && batch->block == blocks + 1;
+  for (mpack_uint32_t i = 0; matches && i < 59; i++) {
+    matches = mpack_unpack_uint(batch->tokens[i]) == (i + 11) * 1000;
+  }
+  ok(matches && batch->tokens[60].type == MPACK_TOKEN_CHUNK
+      && batch->tokens[60].data.chunk_ptr == w - 2 && recycled == 1,
+      "split token and chunk pointers are kept");
+  mpack_pipe_release(&pipe);
+  ok(recycled == 2 && !mpack_pipe_peek(&pipe),
+      "pipe is drained");
+}
+
+#if MPACK_RING_ATOMIC
+enum { PIPE_TOKENS = 30000, PIPE_BLOCKS = 4096 };
+
+struct pipe_decoder {
+  mpack_pipe_t *pipe;
+  const char *in;
+  size_t inlen, nblocks;
+  mpack_pipe_block_t blocks[PIPE_BLOCKS];
+  int recycles[PIPE_BLOCKS];
+  int status, done;
+};
+
+static void pipe_count_recycle(mpack_pipe_block_t *block)
+{
+  __atomic_add_fetch((int *)block->data, 1, __ATOMIC_RELAXED);
+}
+
+/* decodes the input in blocks of varying size, so tokens are split across
+ * blocks at every offset */
+static void *pipe_decode(void *arg)
+{
+  struct pipe_decoder *d = arg;
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  size_t pos = 0, b;
+
+  for (b = 0; pos < d->inlen && b < PIPE_BLOCKS && !d->status; b++) {
+    size_t rl = 1 + (b * 13) % 200;
+    const char *r = d->in + pos;
+    if (rl > d->inlen - pos) rl = d->inlen - pos;
+    pos += rl;
+    mpack_pipe_block_init(d->blocks + b, pipe_count_recycle, d->recycles + b);
+    while ((d->status = mpack_pipe_decode(d->pipe, &tb, d->blocks + b, &r,
+            &rl)) == MPACK_EOF) {
+      sched_yield();
+    }
+    mpack_pipe_block_unref(d->blocks + b);
+  }
+
+  d->nblocks = b;
+  if (pos < d->inlen) d->status = MPACK_NOMEM;
+  __atomic_store_n(&d->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void pipe_is_shared_by_threads(void)
+{
+  static char in[PIPE_TOKENS * 5];
+  static struct pipe_decoder d;
+  mpack_pipe_batch_t batches[4];
+  mpack_tokbuf_t tb = MPACK_TOKBUF_INITIAL_VALUE;
+  mpack_pipe_t pipe;
+  pthread_t thread;
+  char *w = in;
+  size_t wl = sizeof(in), received = 0;
+  bool matches = true, recycled_once = true;
+
+  /* uints of every size */
+  for (mpack_uint32_t i = 0; i < PIPE_TOKENS; i++) {
+    mpack_token_t tok = mpack_pack_uint(i * 40503u >> (i % 32));
+    mpack_write(&tb, &w, &wl, &tok);
+  }
+
+  memset(&d, 0, sizeof(d));
+  d.pipe = &pipe;
+  d.in = in;
+  d.inlen = (size_t)(w - in);
+  mpack_pipe_init(&pipe, batches, ARRAY_SIZE(batches));
+  pthread_create(&thread, NULL, pipe_decode, &d);
+  for (;;) {
+    int done = __atomic_load_n(&d.done, __ATOMIC_ACQUIRE);
+    mpack_pipe_batch_t *batch = mpack_pipe_peek(&pipe);
+    if (!batch) {
+      if (done) break;
+      sched_yield();
+      continue;
+    }
+    for (mpack_uint32_t i = 0; i < batch->count; i++, received++) {
+      mpack_uint32_t v = (mpack_uint32_t)received;
+      matches = matches && received < PIPE_TOKENS
+        && batch->tokens[i].type == MPACK_TOKEN_UINT
+        && mpack_unpack_uint(batch->tokens[i]) == (v * 40503u >> (v % 32));
+    }
+    mpack_pipe_release(&pipe);
+  }
+  pthread_join(thread, NULL);
+
+  for (size_t b = 0; b < d.nblocks; b++) {
+    recycled_once = recycled_once && d.recycles[b] == 1;
+  }
+  ok(!d.status && matches && received == PIPE_TOKENS,
+      "pipe passes every token from the decoder thread");
+  ok(recycled_once, "each of %zu blocks is recycled once", d.nblocks);
+}
+#endif
+
+static int reqdata;
+static void rpc_check_outgoing(mpack_rpc_session_t *session,
+    struct rpc_message *m, size_t cs, bool invert)
+{
+  uint8_t buf[MSGPACK_BUFLEN];
+  uint8_t *b = buf;
+  uint8_t rbuf[MSGPACK_BUFLEN];
+  char *ptr = (char *)rbuf;
+  to_msgpack(m->payload + 2, &b);
+
+  int status = MPACK_EOF;
+  while (status == MPACK_EOF) {
+    size_t bl = cs;
+    if (m->type == MPACK_RPC_REQUEST || m->payload[3] == '0') {
+      status = mpack_rpc_request(session, &ptr, &bl, d(&reqdata));
+    } else if (m->type == MPACK_RPC_RESPONSE || m->payload[3] == '1') {
+      status = mpack_rpc_reply(session, &ptr, &bl, m->id);
+    } else if (m->type == MPACK_RPC_NOTIFICATION || m->payload[3] == '2') {
+      status = mpack_rpc_notify(session, &ptr, &bl);
+    } else return; /* inverted error checking, return */
+  }
+  if (m->type == MPACK_RPC_REQUEST) {
+    to_msgpack(m->method, (uint8_t **)&ptr);
+    to_msgpack(m->args, (uint8_t **)&ptr);
+  } else if (m->type == MPACK_RPC_RESPONSE) {
+    to_msgpack(m->error, (uint8_t **)&ptr);
+    to_msgpack(m->result, (uint8_t **)&ptr);
+  } else if (m->type == MPACK_RPC_NOTIFICATION) {
+    to_msgpack(m->method, (uint8_t **)&ptr);
+    to_msgpack(m->args, (uint8_t **)&ptr);
+  } else {
+    if (!invert)
+      ok(status == m->type, "%s: expected error matched", m->payload);
+    return;
+  }
+  cmp_mem(buf, rbuf, (size_t)((uint8_t *)ptr - rbuf),
+      cs == SIZE_MAX ? "%s: outgoing message matches in a single step" :
+      "%s: outgoing message matches in steps of %zu%s", m->payload, cs,
+      invert ? " (inverted)" : "");
+}
+
+static const char *get_error_string(int type)
+{
+  if (type == MPACK_RPC_EARRAY) return "invalid array";
+  if (type == MPACK_RPC_EARRAYL) return "invalid array length";
+  else if (type == MPACK_RPC_ETYPE) return "invalid message type"; 
+  else if (type == MPACK_RPC_EMSGID) return "invalid message id"; 
+  else if (type == MPACK_RPC_ERESPID) return "unmatched response id"; else abort();
+}
+
+static void rpc_check_incoming(mpack_rpc_session_t *session,
+    struct rpc_message *m, size_t cs, bool invert)
+{
+  uint8_t buf[MSGPACK_BUFLEN];
+  uint8_t *b = buf;
+  uint8_t dbuf[MSGPACK_BUFLEN];
+  uint8_t *db = dbuf;
+  const char *ptr = (const char *)buf;
+  to_msgpack(m->payload + 2, &b);
+  mpack_rpc_message_t msg;
+  int type = MPACK_EOF;
+  while (type == MPACK_EOF) {
+    size_t bl = cs;
+    type = mpack_rpc_receive(session, &ptr, &bl, &msg);
+  }
+  bool result;
+  if (m->type == MPACK_RPC_REQUEST) {
+    result = msg.id == m->id;
+    to_msgpack(m->method, &db);
+    to_msgpack(m->args, &db);
+  } else if (m->type == MPACK_RPC_RESPONSE) {
+    to_msgpack(m->error, &db);
+    to_msgpack(m->result, &db);
+    result = msg.id == m->id;
+    result = msg.data.p == &reqdata;
+  } else if (m->type == MPACK_RPC_NOTIFICATION) {
+    result = true;
+    to_msgpack(m->method, &db);
+    to_msgpack(m->args, &db);
+  } else {
+    if (!invert)
+      ok(type == m->type, "%s: expected error matched(%s)", m->payload,
+          get_error_string(type));
+    return;
+  }
+
+  result = result && type == m->type;
+  ok(result && !memcmp(dbuf, ptr, (size_t)(db - dbuf)),
+      cs == SIZE_MAX ? "%s: incoming message matches in a single step" :
+      "%s: incoming message matches in steps of %zu%s", m->payload, cs,
+      invert ? " (inverted)" : "");
+}
+
+static void rpc_fixture_test(int fixture_idx)
+{
+  const struct rpc_fixture *fixture = rpc_fixtures + fixture_idx;
+
+  for (size_t i = 0; i < ARRAY_SIZE(chunksizes); i++) {
+    for (size_t j = 0; j < 2; j++) { /* test the library from both endpoints */ 
+      mpack_rpc_session_t session;
+      mpack_rpc_session_init(&session, fixture->capacity);
+      for (size_t k = 0; k < fixture->count; k++) {
+        size_t cs = chunksizes[i];
+        struct rpc_message *msg = fixture->messages + k;
+        if (msg->payload[0] == '<') {
+          if (j) rpc_check_outgoing(&session, msg, cs, j);
+          else rpc_check_incoming(&session, msg, cs, j);
+        } else if (msg->payload[1] == '>') {
+          if (j) rpc_check_incoming(&session, msg, cs, j);
+          else rpc_check_outgoing(&session, msg, cs, j);
+        }
+      }
+    }
+  }
+}
+
+int main(void)
+{
+  for (int i = 0; i < fixture_count; i++) {
+    fixture_test(fixtures, i);
+  }
+  signed_positive_packs_with_unsigned_format();
+  positive_signed_format_unpacks_as_unsigned();
+  negative_boundaries_pack_with_smallest_format();
+  negative_boundaries_roundtrip();
+  unpacking_c1_returns_eread();
+  parsing_very_deep_objects_returns_enomem();
+  unparsing_very_deep_objects_returns_enomem();
+  parse_interns_keys();
+  parse_reports_spans();
+  unparse_writes_raw_values();
+  parse_throw();
+  unparse_throw();
+  does_not_write_invalid_tokens();
+  rpc_copy_session_maintains_state();
+  rpc_request_id_wrap();
+  schema_init();
+  schema_decodes_structs();
+  schema_decode_rejects_mismatches();
+  schema_encodes_structs();
+  schema_gen_matches_runtime();
+  schema_gen_encodes_structs();
+  schema_gen_decodes_out_of_order();
+  index_finds_map_values();
+  arena_collects_chunks();
+  for (int i = 0; i < fixture_count; i++) {
+    dom_fixture_test(i);
+  }
+  dom_references_and_mutates();
+  dom_reuses_clean_subtrees();
+  template_fills_slots();
+  typed_reads_values();
+  typed_writes_values();
+  typed_reads_arrays();
+  typed_writes_arrays();
+  typed_array_ext_round_trip();
+  json_transcodes_values();
+  json_formats_floats();
+  json_reads_values();
+  cbor_transcodes_values();
+  batch_parses_record_ranges();
+  batch_parses_array_segments();
+  batch_stitches_array_slices();
+  token_size_matches_writer();
+  ring_delivers_in_reservation_order();
+#if MPACK_RING_ATOMIC
+  ring_is_shared_by_threads();
+#endif
+  pipe_passes_token_batches();
+#if MPACK_RING_ATOMIC
+  pipe_is_shared_by_threads();
+#endif
   number_conv = true;  /* test using mpack_{pack,unpack}_number to do the
                           numeric conversions */
   for (int i = 0; i < rpc_fixture_count; i++) {
@@ -0,0 +1,380 @@
+/* mpack-bench: compares the code generated by mpack-gen with the runtime
+ * schema encoder/decoder and with hand-written mpack_parse/mpack_unparse
+ * callbacks, using the structs in test/schema.idl. It also parses a batch of
+ * records with one mpack_parse loop and with mpack_batch_parse on 1 to
+ * MAX_THREADS threads.
+ *
+ * Usage: mpack-bench [iterations]
+ *
+ * Built and run by `make bench`, which uses the amalgamation and the code
+ * generated for the tests. */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MPACK_API static
+#include "mpack.c"
+#include "schema_gen.c"
+
+#define BUFLEN 256
+#define RECORDS 10000
+#define MAX_THREADS 8
+
+/* keys in declaration order, sprite first, then vec2 */
+static const char *const keys[] = {
+  "label", "visible", "id", "delta", "area", "ratio", "origin", "frame-index",
+  "x", "y"
+};
+#define VEC2_KEYS 8
+
+static mpack_keyset_t keyset;
+
+static void sample(struct sprite *s)
+{
+  memset(s, 0, sizeof(*s));
+  strcpy(s->label, "player");
+  s->visible = 1;
+  s->id = 123456789;
+  s->delta = -300;
+  s->area = 2.5;
+  s->ratio = 0.5f;
+  s->origin.x = 70000;
+  s->origin.y = -1;
+  s->frame = 42;
+}
+
+/* mpack_unparse callbacks: the map nodes hold the struct in data[0] and
+ * whether it is a vec2 in data[1] */
+static void unparse_enter(mpack_parser_t *parser, mpack_node_t *node)
+{
+  mpack_node_t *parent = MPACK_PARENT_NODE(node);
+  const struct sprite *s;
+  const struct vec2 *v;
+  size_t field;
+
+  if (!parent) {
+    node->tok = mpack_pack_map(8);
+    node->data[0].p = parser->data.p;
+    node->data[1].u = 0;
+    return;
+  }
+
+  if (parent->tok.type == MPACK_TOKEN_STR) {
+    node->tok = mpack_pack_chunk(parent->data[0].p, parent->tok.length);
+    return;
+  }
+
+  field = parent->pos + (parent->data[1].u ? VEC2_KEYS : 0);
+  if (!parent->key_visited) {
+    node->tok = mpack_pack_str((mpack_uint32_t)strlen(keys[field]));
+    node->data[0].p = (void *)keys[field];
+    return;
+  }
+
+  s = parent->data[0].p;
+  v = parent->data[0].p;
+  switch (field) {
+    case 0:
+      node->tok = mpack_pack_str((mpack_uint32_t)strlen(s->label));
+      node->data[0].p = (void *)s->label;
+      break;
+    case 1: node->tok = mpack_pack_boolean(s->visible ? 1 : 0); break;
+    case 2: node->tok = mpack_pack_uint(s->id); break;
+    case 3: node->tok = mpack_pack_sint(s->delta); break;
+    case 4: node->tok = mpack_pack_float(s->area); break;
+    case 5: node->tok = mpack_pack_float((double)s->ratio); break;
+    case 6:
+      node->tok = mpack_pack_map(2);
+      node->data[0].p = (void *)&s->origin;
+      node->data[1].u = 1;
+      break;
+    case 7: node->tok = mpack_pack_uint(s->frame); break;
+    case 8: node->tok = mpack_pack_sint(v->x); break;
+    default: node->tok = mpack_pack_sint(v->y); break;
+  }
+}
+
+/* ints that fit in an uint are always read as uint */
+static mpack_sintmax_t unpack_int(mpack_token_t tok)
+{
+  return tok.type == MPACK_TOKEN_UINT ? (mpack_sintmax_t)mpack_unpack_uint(tok)
+    : mpack_unpack_sint(tok);
+}
+
+/* mpack_parse callbacks: map nodes hold the struct in data[0] and the id of
+ * the last key in data[1], string values their destination in data[0] */
+static void parse_enter(mpack_parser_t *parser, mpack_node_t *node)
+{
+  mpack_node_t *parent = MPACK_PARENT_NODE(node);
+  struct sprite *s;
+  struct vec2 *v;
+
+  if (!parent) {
+    node->data[0].p = parser->data.p;
+    return;
+  }
+
+  if (node->tok.type == MPACK_TOKEN_CHUNK) {
+    if (parent->data[0].p) {
+      memcpy((char *)parent->data[0].p + parent->pos,
+          node->tok.data.chunk_ptr, node->tok.length);
+    }
+    return;
+  }
+
+  if (!parent->key_visited) {
+    parent->data[1].i = node->key_id;
+    return;
+  }
+
+  s = parent->data[0].p;
+  v = parent->data[0].p;
+  switch (parent->data[1].i) {
+    case 0:
+      if (node->tok.length < sizeof(s->label)) {
+        node->data[0].p = s->label;
+        s->label[node->tok.length] = 0;
+      }
+      break;
+    case 1: s->visible = mpack_unpack_boolean(node->tok) ? 1 : 0; break;
+    case 2: s->id = mpack_unpack_uint(node->tok); break;
+    case 3: s->delta = unpack_int(node->tok); break;
+    case 4: s->area = mpack_unpack_number(node->tok); break;
+    case 5: s->ratio = (float)mpack_unpack_number(node->tok); break;
+    case 6: node->data[0].p = &s->origin; break;
+    case 7: s->frame = (mpack_uint32_t)mpack_unpack_uint(node->tok); break;
+    case 8: v->x = (mpack_sint32_t)unpack_int(node->tok); break;
+    case 9: v->y = (mpack_sint32_t)unpack_int(node->tok); break;
+    default: break;
+  }
+}
+
+static void walk_exit(mpack_parser_t *parser, mpack_node_t *node)
+{
+  (void)parser;
+  (void)node;
+}
+
+static size_t encode_generated(struct sprite *s, char *buf)
+{
+  mpack_schema_encoder_t e;
+  char *b = buf;
+  size_t bl = BUFLEN;
+  sprite_encoder_init(&e, s);
+  if (sprite_encode(&e, &b, &bl)) abort();
+  return (size_t)(b - buf);
+}
+
+static size_t encode_schema(struct sprite *s, char *buf)
+{
+  mpack_schema_encoder_t e;
+  char *b = buf;
+  size_t bl = BUFLEN;
+  mpack_schema_encoder_init(&e, &sprite_schema, s);
+  if (mpack_schema_encode(&e, &b, &bl)) abort();
+  return (size_t)(b - buf);
+}
+
+static size_t encode_callbacks(struct sprite *s, char *buf)
+{
+  mpack_parser_t parser;
+  char *b = buf;
+  size_t bl = BUFLEN;
+  mpack_parser_init(&parser, 0);
+  parser.data.p = s;
+  if (mpack_unparse(&parser, &b, &bl, unparse_enter, walk_exit)) abort();
+  return (size_t)(b - buf);
+}
+
+static void decode_generated(struct sprite *s, char *buf, size_t len)
+{
+  mpack_schema_decoder_t d;
+  const char *b = buf;
+  sprite_decoder_init(&d, s);
+  if (sprite_decode(&d, &b, &len) || len) abort();
+}
+
+static void decode_schema(struct sprite *s, char *buf, size_t len)
+{
+  mpack_schema_decoder_t d;
+  const char *b = buf;
+  mpack_schema_decoder_init(&d, &sprite_schema, s);
+  if (mpack_schema_decode(&d, &b, &len) || len) abort();
+}
+
+static void decode_callbacks(struct sprite *s, char *buf, size_t len)
+{
+  mpack_parser_t parser;
+  const char *b = buf;
+  mpack_parser_init(&parser, 0);
+  parser.keyset = &keyset;
+  parser.data.p = s;
+  if (mpack_parse(&parser, &b, &len, parse_enter, walk_exit) || len) {
+    abort();
+  }
+}
+
+/* one range of a batch, parsed by its own thread */
+struct batch_job {
+  pthread_t thread;
+  const char *buf;
+  const size_t *ends;
+  mpack_uint32_t first, last;
+  struct sprite *out;
+  int status;
+};
+
+/* the next record is decoded into the next struct */
+static void batch_record(mpack_parser_t *parser, mpack_uint32_t record)
+{
+  (void)record;
+  parser->data.p = (struct sprite *)parser->data.p + 1;
+}
+
+static void *batch_parse(void *arg)
+{
+  struct batch_job *job = arg;
+  mpack_parser_t parser;
+  mpack_parser_init(&parser, 0);
+  parser.keyset = &keyset;
+  parser.data.p = job->out + job->first;
+  job->status = mpack_batch_parse(&parser, job->buf, job->ends, job->first,
+      job->last, parse_enter, walk_exit, batch_record);
+  return NULL;
+}
+
+/* frames the batch and parses it on `threads` threads */
+static void decode_batch(struct sprite *out, const char *buf, size_t len,
+    size_t *ends, mpack_uint32_t threads)
+{
+  struct batch_job jobs[MAX_THREADS];
+  mpack_uint32_t count, t;
+
+  if (mpack_batch_frame(buf, len, ends, RECORDS, &count)) abort();
+  for (t = 0; t < threads; t++) {
+    jobs[t].buf = buf;
+    jobs[t].ends = ends;
+    jobs[t].out = out;
+    mpack_batch_split(ends, count, threads, t, &jobs[t].first, &jobs[t].last);
+    if (pthread_create(&jobs[t].thread, NULL, batch_parse, jobs + t)) abort();
+  }
+  for (t = 0; t < threads; t++) {
+    pthread_join(jobs[t].thread, NULL);
+    if (jobs[t].status) abort();
+  }
+}
+
+/* the same batch parsed by one mpack_parse loop */
+static void decode_loop(struct sprite *out, const char *buf, size_t len)
+{
+  mpack_parser_t parser;
+  const char *b = buf;
+  mpack_parser_init(&parser, 0);
+  parser.keyset = &keyset;
+  while (len) {
+    parser.data.p = out++;
+    if (mpack_parse(&parser, &b, &len, parse_enter, walk_exit)) abort();
+  }
+}
+
+typedef size_t (*encode_fn)(struct sprite *s, char *buf);
+typedef void (*decode_fn)(struct sprite *s, char *buf, size_t len);
+
+/* wall clock time, the batch is parsed by several threads */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double secs, long iterations,
+    size_t len)
+{
+  printf("%-20s %8.1f ns/msg %8.1f MB/s\n", name,
+      secs * 1e9 / (double)iterations,
+      (double)len * (double)iterations / secs / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+  static const char *const names[] = { "generated", "schema", "callbacks" };
+  encode_fn encoders[] = { encode_generated, encode_schema, encode_callbacks };
+  decode_fn decoders[] = { decode_generated, decode_schema, decode_callbacks };
+  long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+  static char batch[RECORDS * BUFLEN];
+  static struct sprite records[RECORDS], outs[RECORDS];
+  static size_t ends[RECORDS];
+  struct sprite in, out;
+  char expected[BUFLEN], buf[BUFLEN], name[64];
+  size_t len, batchlen, i;
+  mpack_uint32_t threads;
+  long n, rounds;
+
+  if (iterations <= 0 || mpack_keyset_init(&keyset, keys, 10)) return 1;
+
+  sample(&in);
+  len = encode_schema(&in, expected);
+  /* every path must produce and accept the same message */
+  for (i = 0; i < 3; i++) {
+    memset(&out, 0, sizeof(out));
+    if (encoders[i](&in, buf) != len || memcmp(buf, expected, len)) {
+      fprintf(stderr, "%s encoder output differs\n", names[i]);
+      return 1;
+    }
+    decoders[i](&out, expected, len);
+    if (memcmp(&out, &in, sizeof(in))) {
+      fprintf(stderr, "%s decoder output differs\n", names[i]);
+      return 1;
+    }
+  }
+
+  printf("%ld iterations, %u byte message\n", iterations, (unsigned)len);
+  for (i = 0; i < 3; i++) {
+    double start = now();
+    for (n = 0; n < iterations; n++) encoders[i](&in, buf);
+    sprintf(name, "encode %s", names[i]);
+    report(name, now() - start, iterations, len);
+  }
+  for (i = 0; i < 3; i++) {
+    double start = now();
+    for (n = 0; n < iterations; n++) decoders[i](&out, expected, len);
+    sprintf(name, "decode %s", names[i]);
+    report(name, now() - start, iterations, len);
+  }
+
+  /* a batch of records that differ in their id */
+  batchlen = 0;
+  for (i = 0; i < RECORDS; i++) {
+    records[i] = in;
+    records[i].id = i;
+    batchlen += encode_schema(records + i, batch + batchlen);
+  }
+  rounds = iterations / RECORDS > 0 ? iterations / RECORDS : 1;
+  for (threads = 0; threads <= MAX_THREADS; threads = threads ? threads * 2
+      : 1) {
+    double start = now();
+    memset(outs, 0, sizeof(outs));
+    for (n = 0; n < rounds; n++) {
+      if (threads) {
+        decode_batch(outs, batch, batchlen, ends, threads);
+      } else {
+        decode_loop(outs, batch, batchlen);
+      }
+    }
+    if (threads) {
+      sprintf(name, "batch %u threads", (unsigned)threads);
+    } else {
+      sprintf(name, "batch parse loop");
+    }
+    report(name, now() - start, rounds * RECORDS, batchlen / RECORDS);
+    if (memcmp(outs, records, sizeof(records))) {
+      fprintf(stderr, "%s output differs\n", name);
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,833 @@
+/* mpack-gen: generates C89 encoders/decoders for structs described in a small
+ * IDL. The generated code depends on the schema module (src/schema.h): each
+ * struct gets a statically indexed mpack_schema_t, used as the resumable slow
+ * path, plus straight-line functions used when the whole message fits in the
+ * buffer.
+ *
+ * Usage: mpack-gen <input.idl> <output prefix>
+ *
+ * Writes <prefix>.h and <prefix>.c. The IDL looks like this:
+ *
+ *   # comments extend to the end of the line
+ *   struct point {
+ *     sint32 x;
+ *     sint32 y;
+ *   }
+ *
+ *   struct shape {
+ *     str[16] label = "shape-label";  # optional key, defaults to the name
+ *     bool visible;
+ *     point origin;                   # structs must be declared before use
+ *   }
+ *
+ * Field types: bool, uint, sint, uint32, sint32, float, double, str[N] and
+ * the name of a previously declared struct. */
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_NAME 64
+#define MAX_KEY 31  /* MPACK_SCHEMA_MAX_KEY */
+#define MAX_FIELDS 64  /* MPACK_SCHEMA_MAX_FIELDS */
+#define MAX_STRUCTS 256
+
+/* same values as mpack_field_type_t */
+enum {
+  T_BOOLEAN = 1,
+  T_UINT,
+  T_SINT,
+  T_UINT32,
+  T_SINT32,
+  T_FLOAT,
+  T_DOUBLE,
+  T_STR,
+  T_MAP
+};
+
+static const struct {
+  const char *idl, *ctype, *field;
+  size_t max_size;
+} types[] = {
+  {NULL, NULL, NULL, 0},
+  {"bool", "int", "MPACK_FIELD_BOOLEAN", 1},
+  {"uint", "mpack_uintmax_t", "MPACK_FIELD_UINT", 9},
+  {"sint", "mpack_sintmax_t", "MPACK_FIELD_SINT", 9},
+  {"uint32", "mpack_uint32_t", "MPACK_FIELD_UINT32", 5},
+  {"sint32", "mpack_sint32_t", "MPACK_FIELD_SINT32", 5},
+  {"float", "float", "MPACK_FIELD_FLOAT", 5},
+  {"double", "double", "MPACK_FIELD_DOUBLE", 9},
+  {"str", "char", "MPACK_FIELD_STR", 0},
+  {NULL, "struct", "MPACK_FIELD_MAP", 0}
+};
+
+struct field {
+  char name[MAX_NAME];
+  char key[MAX_KEY + 1];
+  int type;
+  size_t size;  /* str[N] capacity */
+  int ref;      /* index of the nested struct */
+};
+
+struct type {
+  char name[MAX_NAME];
+  struct field fields[MAX_FIELDS];
+  unsigned count;
+  size_t max_size;
+};
+
+static struct type structs[MAX_STRUCTS];
+static unsigned struct_count;
+
+static const char *input_path;
+static char *src;
+static size_t src_pos;
+static unsigned line = 1;
+
+static void die(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "%s:%u: ", input_path, line);
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+  exit(1);
+}
+
+static void skip_space(void)
+{
+  for (;;) {
+    char c = src[src_pos];
+    if (c == '\n') {
+      line++;
+      src_pos++;
+    } else if (isspace((unsigned char)c)) {
+      src_pos++;
+    } else if (c == '#') {
+      while (src[src_pos] && src[src_pos] != '\n') src_pos++;
+    } else {
+      return;
+    }
+  }
+}
+
+static int peek(void)
+{
+  skip_space();
+  return (unsigned char)src[src_pos];
+}
+
+static void expect(char c)
+{
+  if (peek() != c) die("expected '%c'", c);
+  src_pos++;
+}
+
+static void ident(char *out)
+{
+  size_t len = 0;
+  int c = peek();
+  if (!isalpha(c) && c != '_') die("expected identifier");
+  while (isalnum((unsigned char)src[src_pos]) || src[src_pos] == '_') {
+    if (len == MAX_NAME - 1) die("identifier too long");
+    out[len++] = src[src_pos++];
+  }
+  out[len] = 0;
+}
+
+static size_t number(void)
+{
+  size_t rv = 0;
+  if (!isdigit(peek())) die("expected number");
+  while (isdigit((unsigned char)src[src_pos])) {
+    rv = rv * 10 + (size_t)(src[src_pos++] - '0');
+    if (rv > 0xffffffff) die("number too large");
+  }
+  return rv;
+}
+
+static void quoted(char *out, size_t max)
+{
+  size_t len = 0;
+  expect('"');
+  while (src[src_pos] != '"') {
+    if (!src[src_pos] || src[src_pos] == '\n') die("unterminated string");
+    if (len == max) die("key is longer than %u bytes", (unsigned)max);
+    out[len++] = src[src_pos++];
+  }
+  src_pos++;
+  out[len] = 0;
+}
+
+static int find_struct(const char *name)
+{
+  unsigned i;
+  for (i = 0; i < struct_count; i++) {
+    if (!strcmp(structs[i].name, name)) return (int)i;
+  }
+  return -1;
+}
+
+static size_t str_header_size(size_t len)
+{
+  return len < 0x20 ? 1 : len < 0x100 ? 2 : len < 0x10000 ? 3 : 5;
+}
+
+static void parse_field(struct type *t)
+{
+  struct field *f;
+  char tname[MAX_NAME];
+  unsigned i;
+
+  if (t->count == MAX_FIELDS) die("too many fields in '%s'", t->name);
+  f = t->fields + t->count;
+  ident(tname);
+
+  for (i = T_BOOLEAN; i < T_MAP; i++) {
+    if (!strcmp(types[i].idl, tname)) break;
+  }
+
+  f->type = (int)i;
+  f->ref = -1;
+
+  if (f->type == T_STR) {
+    expect('[');
+    if (!(f->size = number())) die("str capacity must be positive");
+    expect(']');
+  } else if (f->type == T_MAP && (f->ref = find_struct(tname)) < 0) {
+    die("unknown type '%s'", tname);
+  }
+
+  ident(f->name);
+  if (peek() == '=') {
+    src_pos++;
+    quoted(f->key, MAX_KEY);
+  } else if (strlen(f->name) > MAX_KEY) {
+    die("'%s' is too long to be used as a key", f->name);
+  } else {
+    strcpy(f->key, f->name);
+  }
+  expect(';');
+
+  for (i = 0; i < t->count; i++) {
+    if (!strcmp(t->fields[i].name, f->name)) die("duplicate field");
+    if (!strcmp(t->fields[i].key, f->key)) die("duplicate key");
+  }
+
+  t->max_size += 1 + strlen(f->key);
+  if (f->type == T_STR) {
+    t->max_size += str_header_size(f->size - 1) + f->size - 1;
+  } else if (f->type == T_MAP) {
+    t->max_size += structs[f->ref].max_size;
+  } else {
+    t->max_size += types[f->type].max_size;
+  }
+  t->count++;
+}
+
+static void parse(void)
+{
+  while (peek()) {
+    char kw[MAX_NAME];
+    struct type *t;
+    ident(kw);
+    if (strcmp(kw, "struct")) die("expected 'struct'");
+    if (struct_count == MAX_STRUCTS) die("too many structs");
+    t = structs + struct_count;
+    ident(t->name);
+    if (find_struct(t->name) >= 0) die("duplicate struct '%s'", t->name);
+    expect('{');
+    while (peek() != '}') {
+      if (!peek()) die("unexpected end of input");
+      parse_field(t);
+    }
+    src_pos++;
+    if (!t->count) die("struct '%s' has no fields", t->name);
+    t->max_size += t->count < 0x10 ? 1 : 3;
+    struct_count++;
+  }
+}
+
+/* writes bytes as a C string literal, escaping everything but alphanumerics */
+static void literal(FILE *out, const unsigned char *bytes, size_t len)
+{
+  size_t i;
+  fputc('"', out);
+  for (i = 0; i < len; i++) {
+    if (isalnum(bytes[i]) || bytes[i] == '_' || bytes[i] == '-') {
+      fputc(bytes[i], out);
+    } else {
+      fprintf(out, "\\%03o", bytes[i]);
+    }
+  }
+  fputc('"', out);
+}
+
+static size_t map_header(unsigned count, unsigned char *out)
+{
+  if (count < 0x10) {
+    out[0] = (unsigned char)(0x80 | count);
+    return 1;
+  }
+  out[0] = 0xde;
+  out[1] = 0;
+  out[2] = (unsigned char)count;
+  return 3;
+}
+
+static size_t encoded_key(const struct field *f, unsigned char *out)
+{
+  size_t len = strlen(f->key);
+  out[0] = (unsigned char)(0xa0 | len);
+  memcpy(out + 1, f->key, len);
+  return len + 1;
+}
+
+static void upper(char *out, const char *in)
+{
+  while (*in) *out++ = (char)toupper((unsigned char)*in++);
+  *out = 0;
+}
+
+static void gen_header(FILE *out, const char *guard)
+{
+  unsigned i, j;
+
+  fprintf(out, "/* Generated by mpack-gen from %s. Do not edit. */\n",
+      input_path);
+  fprintf(out, "#ifndef %s\n#define %s\n\n#include \"mpack.h\"\n",
+      guard, guard);
+
+  for (i = 0; i < struct_count; i++) {
+    const struct type *t = structs + i;
+    char name[MAX_NAME];
+    upper(name, t->name);
+    fprintf(out, "\nstruct %s {\n", t->name);
+    for (j = 0; j < t->count; j++) {
+      const struct field *f = t->fields + j;
+      if (f->type == T_STR) {
+        fprintf(out, "  char %s[%u];\n", f->name, (unsigned)f->size);
+      } else if (f->type == T_MAP) {
+        fprintf(out, "  struct %s %s;\n", structs[f->ref].name, f->name);
+      } else {
+        fprintf(out, "  %s %s;\n", types[f->type].ctype, f->name);
+      }
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "/* largest possible encoding of struct %s */\n", t->name);
+    fprintf(out, "#define %s_MAX_SIZE %u\n\n", name, (unsigned)t->max_size);
+    fprintf(out, "extern const mpack_schema_t %s_schema;\n\n", t->name);
+    fprintf(out,
+        "void %s_encoder_init(mpack_schema_encoder_t *e,\n"
+        "    const struct %s *v);\n"
+        "int %s_encode(mpack_schema_encoder_t *e, char **b, size_t *bl);\n"
+        "size_t %s_pack(const struct %s *v, char *b);\n"
+        "void %s_decoder_init(mpack_schema_decoder_t *d, struct %s *v);\n"
+        "int %s_decode(mpack_schema_decoder_t *d, const char **b, "
+        "size_t *bl);\n",
+        t->name, t->name, t->name, t->name, t->name, t->name, t->name,
+        t->name);
+  }
+
+  fprintf(out, "\n#endif  /* %s */\n", guard);
+}
+
+/* Helpers shared by the generated functions. Scalars and string headers are
+ * read and written directly, without a tokbuf: the fast paths only run when
+ * the whole message is available, and anything unusual (types the field
+ * doesn't take, truncated input) makes them return 0 so the schema decoder
+ * takes over. Tokens are built the same way mpack_read builds them, so
+ * conversions and range checks are shared with the schema decoder through
+ * mpack_schema_store. */
+static void gen_helpers(FILE *out, const char *p)
+{
+  fprintf(out,
+"static mpack_uint32_t %s_r4(const unsigned char *b) FUNUSED;\n"
+"static int %s_rscalar(const char **b, const char *end,\n"
+"    const mpack_field_t *f, void *base) FUNUSED;\n"
+"static int %s_rstr(const char **b, const char *end, char *s,\n"
+"    size_t size) FUNUSED;\n"
+"static char *%s_w4(char *b, mpack_uint32_t v) FUNUSED;\n"
+"static char *%s_wuint(char *b, mpack_token_t tok) FUNUSED;\n"
+"static char *%s_wsint(char *b, mpack_token_t tok) FUNUSED;\n"
+"static char *%s_wfloat(char *b, mpack_token_t tok) FUNUSED;\n"
+"static char *%s_wstr(char *b, const char *s, size_t size) FUNUSED;\n"
+"\n",
+  p, p, p, p, p, p, p, p);
+
+  fprintf(out,
+"static mpack_uint32_t %s_r4(const unsigned char *b)\n"
+"{\n"
+"  return (mpack_uint32_t)b[0] << 24 | (mpack_uint32_t)b[1] << 16\n"
+"    | (mpack_uint32_t)b[2] << 8 | b[3];\n"
+"}\n"
+"\n"
+"static int %s_rscalar(const char **buf, const char *end,\n"
+"    const mpack_field_t *f, void *base)\n"
+"{\n"
+"  const unsigned char *b = (const unsigned char *)*buf;\n"
+"  mpack_token_t tok;\n"
+"  unsigned c, n;\n"
+"\n"
+"  if (*buf == end) return 0;\n"
+"  c = *b++;\n"
+"  tok.length = 1;\n"
+"  tok.data.value.hi = 0;\n"
+"  tok.data.value.lo = c;\n"
+"  if (c < 0x80) {\n"
+"    tok.type = MPACK_TOKEN_UINT;\n"
+"  } else if (c >= 0xe0) {\n"
+"    tok.type = MPACK_TOKEN_SINT;\n"
+"  } else if (c == 0xc0) {\n"
+"    tok.type = MPACK_TOKEN_NIL;\n"
+"    tok.length = 0;\n"
+"    tok.data.value.lo = 0;\n"
+"  } else if (c == 0xc2 || c == 0xc3) {\n"
+"    tok.type = MPACK_TOKEN_BOOLEAN;\n"
+"    tok.data.value.lo = c & 1;\n"
+"  } else if (c >= 0xca && c <= 0xd3) {\n"
+"    /* float 32/64, uint 8-64, int 8-64 */\n"
+"    n = c < 0xcc ? 4u << (c - 0xca) : 1u << ((c - 0xcc) & 3);\n"
+"    if ((size_t)(end - (const char *)b) < n) return 0;\n"
+"    tok.type = c < 0xcc ? MPACK_TOKEN_FLOAT\n"
+"      : c < 0xd0 ? MPACK_TOKEN_UINT : MPACK_TOKEN_SINT;\n"
+"    tok.length = n;\n"
+"    if (n == 8) {\n"
+"      tok.data.value.hi = %s_r4(b);\n"
+"      tok.data.value.lo = %s_r4(b + 4);\n"
+"    } else if (n == 4) {\n"
+"      tok.data.value.lo = %s_r4(b);\n"
+"    } else if (n == 2) {\n"
+"      tok.data.value.lo = (mpack_uint32_t)b[0] << 8 | b[1];\n"
+"    } else {\n"
+"      tok.data.value.lo = b[0];\n"
+"    }\n"
+"    b += n;\n"
+"    /* like mpack_read, non-negative ints are always uint */\n"
+"    if (tok.type == MPACK_TOKEN_SINT\n"
+"        && !((n == 8 ? tok.data.value.hi : tok.data.value.lo)\n"
+"          >> (n == 8 ? 31 : n * 8 - 1))) {\n"
+"      tok.type = MPACK_TOKEN_UINT;\n"
+"    }\n"
+"  } else {\n"
+"    return 0;\n"
+"  }\n"
+"\n"
+"  *buf = (const char *)b;\n"
+"  return !mpack_schema_store(f, base, tok);\n"
+"}\n"
+"\n"
+"static int %s_rstr(const char **buf, const char *end, char *s,\n"
+"    size_t size)\n"
+"{\n"
+"  const unsigned char *b = (const unsigned char *)*buf;\n"
+"  size_t left = (size_t)(end - *buf), len;\n"
+"  unsigned c;\n"
+"\n"
+"  if (!left) return 0;\n"
+"  c = *b++;\n"
+"  left--;\n"
+"  if (c == 0xc0) {\n"
+"    /* nil leaves the field untouched */\n"
+"    *buf = (const char *)b;\n"
+"    return 1;\n"
+"  } else if (c >= 0xa0 && c < 0xc0) {\n"
+"    len = c & 0x1f;\n"
+"  } else if (c == 0xd9 && left >= 1) {\n"
+"    len = b[0];\n"
+"    b++;\n"
+"    left--;\n"
+"  } else if (c == 0xda && left >= 2) {\n"
+"    len = (size_t)b[0] << 8 | b[1];\n"
+"    b += 2;\n"
+"    left -= 2;\n"
+"  } else if (c == 0xdb && left >= 4) {\n"
+"    len = %s_r4(b);\n"
+"    b += 4;\n"
+"    left -= 4;\n"
+"  } else {\n"
+"    return 0;\n"
+"  }\n"
+"\n"
+"  /* the string must fit with the terminating NUL */\n"
+"  if (len >= size || len > left) return 0;\n"
+"  memcpy(s, b, len);\n"
+"  s[len] = 0;\n"
+"  *buf = (const char *)b + len;\n"
+"  return 1;\n"
+"}\n"
+"\n",
+  p, p, p, p, p, p, p);
+
+  fprintf(out,
+"static char *%s_w4(char *b, mpack_uint32_t v)\n"
+"{\n"
+"  b[0] = (char)(v >> 24 & 0xff);\n"
+"  b[1] = (char)(v >> 16 & 0xff);\n"
+"  b[2] = (char)(v >> 8 & 0xff);\n"
+"  b[3] = (char)(v & 0xff);\n"
+"  return b + 4;\n"
+"}\n"
+"\n"
+"/* same widths as mpack_write */\n"
+"static char *%s_wuint(char *b, mpack_token_t tok)\n"
+"{\n"
+"  mpack_uint32_t hi = tok.data.value.hi, lo = tok.data.value.lo;\n"
+"\n"
+"  if (hi) {\n"
+"    *b++ = (char)0xcf;\n"
+"    return %s_w4(%s_w4(b, hi), lo);\n"
+"  } else if (lo > 0xffff) {\n"
+"    *b++ = (char)0xce;\n"
+"    return %s_w4(b, lo);\n"
+"  } else if (lo > 0xff) {\n"
+"    b[0] = (char)0xcd;\n"
+"    b[1] = (char)(lo >> 8);\n"
+"    b[2] = (char)(lo & 0xff);\n"
+"    return b + 3;\n"
+"  } else if (lo > 0x7f) {\n"
+"    *b++ = (char)0xcc;\n"
+"  }\n"
+"  *b++ = (char)lo;\n"
+"  return b;\n"
+"}\n"
+"\n"
+"static char *%s_wsint(char *b, mpack_token_t tok)\n"
+"{\n"
+"  mpack_uint32_t hi = tok.data.value.hi, lo = tok.data.value.lo;\n"
+"\n"
+"  if (tok.type == MPACK_TOKEN_UINT) return %s_wuint(b, tok);\n"
+"\n"
+"  if (lo < 0x80000000) {\n"
+"    *b++ = (char)0xd3;\n"
+"    return %s_w4(%s_w4(b, hi), lo);\n"
+"  } else if (lo < 0xffff8000) {\n"
+"    *b++ = (char)0xd2;\n"
+"    return %s_w4(b, lo);\n"
+"  } else if (lo < 0xffffff80) {\n"
+"    b[0] = (char)0xd1;\n"
+"    b[1] = (char)(lo >> 8 & 0xff);\n"
+"    b[2] = (char)(lo & 0xff);\n"
+"    return b + 3;\n"
+"  } else if (lo < 0xffffffe0) {\n"
+"    *b++ = (char)0xd0;\n"
+"  }\n"
+"  *b++ = (char)(lo & 0xff);\n"
+"  return b;\n"
+"}\n"
+"\n"
+"static char *%s_wfloat(char *b, mpack_token_t tok)\n"
+"{\n"
+"  if (tok.length == 4) {\n"
+"    *b++ = (char)0xca;\n"
+"    return %s_w4(b, tok.data.value.lo);\n"
+"  }\n"
+"  *b++ = (char)0xcb;\n"
+"  return %s_w4(%s_w4(b, tok.data.value.hi), tok.data.value.lo);\n"
+"}\n"
+"\n"
+"static char *%s_wstr(char *b, const char *s, size_t size)\n"
+"{\n"
+"  mpack_uint32_t len = 0;\n"
+"  /* cut to what the decoder accepts if there is no NUL */\n"
+"  while (len + 1 < size && s[len]) len++;\n"
+"  if (len < 0x20) {\n"
+"    *b++ = (char)(0xa0 | len);\n"
+"  } else if (len < 0x100) {\n"
+"    *b++ = (char)0xd9;\n"
+"    *b++ = (char)len;\n"
+"  } else if (len < 0x10000) {\n"
+"    *b++ = (char)0xda;\n"
+"    *b++ = (char)(len >> 8);\n"
+"    *b++ = (char)(len & 0xff);\n"
+"  } else {\n"
+"    *b++ = (char)0xdb;\n"
+"    b = %s_w4(b, len);\n"
+"  }\n"
+"  memcpy(b, s, len);\n"
+"  return b + len;\n"
+"}\n",
+  p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p);
+}
+
+static void gen_schema(FILE *out, const struct type *t)
+{
+  unsigned char first[MAX_KEY + 1], next[MAX_FIELDS];
+  unsigned i;
+
+  memset(first, 0xff, sizeof(first));
+  memset(next, 0xff, sizeof(next));
+  /* same index mpack_keyindex_init builds in mpack_schema_init */
+  for (i = t->count; i--;) {
+    size_t len = strlen(t->fields[i].key);
+    next[i] = first[len];
+    first[len] = (unsigned char)i;
+  }
+
+  fprintf(out, "\nstatic const mpack_field_t %s_fields[] = {\n", t->name);
+  for (i = 0; i < t->count; i++) {
+    const struct field *f = t->fields + i;
+    fprintf(out, "  ");
+    if (f->type == T_MAP) {
+      fprintf(out, "MPACK_FIELD_NESTED(struct %s, %s, ", t->name, f->name);
+      literal(out, (const unsigned char *)f->key, strlen(f->key));
+      fprintf(out, ", &%s_schema)", structs[f->ref].name);
+    } else {
+      fprintf(out, "MPACK_FIELD(struct %s, %s, ", t->name, f->name);
+      literal(out, (const unsigned char *)f->key, strlen(f->key));
+      fprintf(out, ", %s)", types[f->type].field);
+    }
+    fprintf(out, "%s\n", i + 1 < t->count ? "," : "");
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "const mpack_schema_t %s_schema = {\n  %s_fields,\n  %u,\n  {",
+      t->name, t->name, t->count);
+  for (i = 0; i <= MAX_KEY; i++) {
+    fprintf(out, "%s%s%u", i ? "," : "", i % 12 ? " " : "\n    ", first[i]);
+  }
+  fprintf(out, "\n  },\n  {");
+  for (i = 0; i < t->count; i++) {
+    fprintf(out, "%s%s%u", i ? "," : "", i % 12 ? " " : "\n    ", next[i]);
+  }
+  fprintf(out, "\n  },\n  {");
+  for (i = 0; i < t->count; i++) {
+    fprintf(out, "%s%s%u", i ? "," : "", i % 12 ? " " : "\n    ",
+        (unsigned)strlen(t->fields[i].key));
+  }
+  fprintf(out, "\n  }\n};\n");
+}
+
+static void gen_pack(FILE *out, const struct type *t, const char *p)
+{
+  unsigned char bytes[MAX_KEY + 1];
+  size_t len;
+  unsigned i;
+
+  fprintf(out, "\nsize_t %s_pack(const struct %s *v, char *buf)\n{\n"
+      "  char *b = buf;\n", t->name, t->name);
+  len = map_header(t->count, bytes);
+  fprintf(out, "  memcpy(b, ");
+  literal(out, bytes, len);
+  fprintf(out, ", %u);\n  b += %u;\n", (unsigned)len, (unsigned)len);
+
+  for (i = 0; i < t->count; i++) {
+    const struct field *f = t->fields + i;
+    len = encoded_key(f, bytes);
+    fprintf(out, "  memcpy(b, ");
+    literal(out, bytes, len);
+    fprintf(out, ", %u);\n  b += %u;\n", (unsigned)len, (unsigned)len);
+    switch (f->type) {
+      case T_BOOLEAN:
+        fprintf(out, "  *b++ = (char)(v->%s ? 0xc3 : 0xc2);\n", f->name);
+        break;
+      case T_UINT:
+      case T_UINT32:
+        fprintf(out, "  b = %s_wuint(b, mpack_pack_uint(v->%s));\n",
+            p, f->name);
+        break;
+      case T_SINT:
+      case T_SINT32:
+        fprintf(out, "  b = %s_wsint(b, mpack_pack_sint(v->%s));\n",
+            p, f->name);
+        break;
+      case T_FLOAT:
+        fprintf(out,
+            "  b = %s_wfloat(b, mpack_pack_float((double)v->%s));\n",
+            p, f->name);
+        break;
+      case T_DOUBLE:
+        fprintf(out, "  b = %s_wfloat(b, mpack_pack_float(v->%s));\n",
+            p, f->name);
+        break;
+      case T_STR:
+        fprintf(out, "  b = %s_wstr(b, v->%s, sizeof(v->%s));\n",
+            p, f->name, f->name);
+        break;
+      default:
+        fprintf(out, "  b += %s_pack(&v->%s, b);\n",
+            structs[f->ref].name, f->name);
+        break;
+    }
+  }
+
+  fprintf(out, "  return (size_t)(b - buf);\n}\n");
+}
+
+static void gen_unpack(FILE *out, const struct type *t, const char *p)
+{
+  unsigned char bytes[MAX_KEY + 1];
+  size_t len;
+  unsigned i;
+
+  fprintf(out,
+      "\n/* decodes messages that have every key in declaration order, anything\n"
+      " * else is left to the schema decoder */\n"
+      "static int %s_unpack(struct %s *v, const char **buf, const char *end)\n"
+      "{\n"
+      "  const char *b = *buf;\n", t->name, t->name);
+  len = map_header(t->count, bytes);
+  fprintf(out, "  if ((size_t)(end - b) < %u || memcmp(b, ", (unsigned)len);
+  literal(out, bytes, len);
+  fprintf(out, ", %u)) return 0;\n  b += %u;\n", (unsigned)len,
+      (unsigned)len);
+
+  for (i = 0; i < t->count; i++) {
+    const struct field *f = t->fields + i;
+    len = encoded_key(f, bytes);
+    fprintf(out, "  if ((size_t)(end - b) < %u || memcmp(b, ", (unsigned)len);
+    literal(out, bytes, len);
+    fprintf(out, ", %u)) return 0;\n  b += %u;\n", (unsigned)len,
+        (unsigned)len);
+    if (f->type == T_STR) {
+      fprintf(out, "  if (!%s_rstr(&b, end, v->%s, sizeof(v->%s))) "
+          "return 0;\n", p, f->name, f->name);
+    } else if (f->type == T_MAP) {
+      fprintf(out, "  if (!%s_unpack(&v->%s, &b, end)) return 0;\n",
+          structs[f->ref].name, f->name);
+    } else {
+      fprintf(out, "  if (!%s_rscalar(&b, end, %s_fields + %u, v)) "
+          "return 0;\n", p, t->name, i);
+    }
+  }
+
+  fprintf(out, "  *buf = b;\n  return 1;\n}\n");
+}
+
+static void gen_entry_points(FILE *out, const struct type *t)
+{
+  char name[MAX_NAME];
+  upper(name, t->name);
+  fprintf(out,
+"\nvoid %s_encoder_init(mpack_schema_encoder_t *e, const struct %s *v)\n"
+"{\n"
+"  mpack_schema_encoder_init(e, &%s_schema, v);\n"
+"}\n"
+"\n"
+"int %s_encode(mpack_schema_encoder_t *e, char **b, size_t *bl)\n"
+"{\n"
+"  if (e->state == MPACK_SCHEMA_HEADER && !e->tokbuf.plen\n"
+"      && *bl >= %s_MAX_SIZE) {\n"
+"    size_t n = %s_pack((const struct %s *)e->frames[0].base, *b);\n"
+"    *b += n;\n"
+"    *bl -= n;\n"
+"    e->state = MPACK_SCHEMA_DONE;\n"
+"    return MPACK_OK;\n"
+"  }\n"
+"  return mpack_schema_encode(e, b, bl);\n"
+"}\n"
+"\n"
+"void %s_decoder_init(mpack_schema_decoder_t *d, struct %s *v)\n"
+"{\n"
+"  mpack_schema_decoder_init(d, &%s_schema, v);\n"
+"}\n"
+"\n"
+"int %s_decode(mpack_schema_decoder_t *d, const char **b, size_t *bl)\n"
+"{\n"
+"  if (d->state == MPACK_SCHEMA_HEADER && !d->tokbuf.plen) {\n"
+"    const char *p = *b;\n"
+"    if (%s_unpack((struct %s *)d->frames[0].base, &p, *b + *bl)) {\n"
+"      *bl -= (size_t)(p - *b);\n"
+"      *b = p;\n"
+"      d->state = MPACK_SCHEMA_DONE;\n"
+"      return MPACK_OK;\n"
+"    }\n"
+"  }\n"
+"  return mpack_schema_decode(d, b, bl);\n"
+"}\n",
+  t->name, t->name, t->name, t->name, name, t->name, t->name, t->name,
+  t->name, t->name, t->name, t->name, t->name);
+}
+
+static void gen_source(FILE *out, const char *header, const char *p)
+{
+  unsigned i;
+
+  fprintf(out, "/* Generated by mpack-gen from %s. Do not edit. */\n",
+      input_path);
+  fprintf(out, "#include <string.h>\n\n#include \"%s\"\n\n", header);
+  for (i = 0; i < struct_count; i++) {
+    fprintf(out, "static int %s_unpack(struct %s *v, const char **b,\n"
+        "    const char *end);\n", structs[i].name, structs[i].name);
+  }
+  gen_helpers(out, p);
+  for (i = 0; i < struct_count; i++) {
+    gen_schema(out, structs + i);
+    gen_pack(out, structs + i, p);
+    gen_unpack(out, structs + i, p);
+    gen_entry_points(out, structs + i);
+  }
+}
+
+static char *read_file(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  char *rv;
+  long size;
+  if (!f || fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0
+      || fseek(f, 0, SEEK_SET)) {
+    perror(path);
+    exit(1);
+  }
+  rv = malloc((size_t)size + 1);
+  if (!rv || fread(rv, 1, (size_t)size, f) != (size_t)size) {
+    perror(path);
+    exit(1);
+  }
+  rv[size] = 0;
+  fclose(f);
+  return rv;
+}
+
+static FILE *open_output(const char *prefix, const char *ext)
+{
+  char path[4096];
+  FILE *f;
+  snprintf(path, sizeof(path), "%s%s", prefix, ext);
+  if (!(f = fopen(path, "w"))) {
+    perror(path);
+    exit(1);
+  }
+  return f;
+}
+
+int main(int argc, char **argv)
+{
+  char header[4096], guard[4096], prefix[4096];
+  const char *base;
+  FILE *h, *c;
+  size_t i;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <input.idl> <output prefix>\n", argv[0]);
+    return 1;
+  }
+
+  input_path = argv[1];
+  src = read_file(input_path);
+  parse();
+
+  base = strrchr(argv[2], '/');
+  base = base ? base + 1 : argv[2];
+  snprintf(header, sizeof(header), "%s.h", base);
+  /* helper and include guard names are derived from the output file name */
+  for (i = 0; base[i] && i < sizeof(prefix) - 1; i++) {
+    prefix[i] = isalnum((unsigned char)base[i]) ? base[i] : '_';
+  }
+  prefix[i] = 0;
+  upper(guard, prefix);
+  strcat(guard, "_H");
+
+  h = open_output(argv[2], ".h");
+  gen_header(h, guard);
+  c = open_output(argv[2], ".c");
+  gen_source(c, header, prefix);
+  if (fclose(h) || fclose(c)) {
+    perror(argv[2]);
+    return 1;
+  }
+  free(src);
+  return 0;
+}